@@ -29,11 +29,56 @@
 #include <iosfwd>
 //#include "MarkName.h"
 #include <string>
+#include <vector>
 
 class ComparisonPrinter {
       public:
+      ///How the best window pair of two traces is searched for.
+      enum SearchStrategy {
+          ///Every window pair (MaxCorrelationWithFlips).
+          Search_Exhaustive = 0,
+          ///Windows warped within a band (DtwCorrelation); not exact.
+          Search_Elastic = 1
+      };
+
+      ComparisonPrinter() : _numThreads(1), _seed(337), _searchStrategy(Search_Exhaustive), _warpBand(8),
+                            _maxShiftPercentage(0.0f) {}
       virtual ~ComparisonPrinter() {}
 
+      /**
+       * Threads used by the max correlation search and the T samples
+       * (1 = serial, <= 0 = all cores). Results do not depend on it.
+       */
+      void setNumThreads(int numThreads) { _numThreads = numThreads; }
+      int numThreads() const { return _numThreads; }
+
+      /**
+       * Seed of the random streams used for validation. Each comparison
+       * draws from streams keyed by (seed, comparison id, sample id),
+       * so it does not matter in which order or on which thread the
+       * comparisons run.
+       */
+      void setSeed(unsigned long seed) { _seed = seed; }
+      unsigned long seed() const { return _seed; }
+
+      /**
+       * A SearchStrategy value, and the Sakoe-Chiba band of
+       * Search_Elastic in samples. Printers that always search one
+       * way ignore them.
+       */
+      void setSearchStrategy(int strategy) { _searchStrategy = strategy; }
+      int searchStrategy() const { return _searchStrategy; }
+      void setWarpBand(int band) { _warpBand = band; }
+      int warpBand() const { return _warpBand; }
+
+      /**
+       * The leash of the search: how far, as a fraction of the trace
+       * length, the best window pair may be shifted apart. 0 (the
+       * default) compares windows at the same position in both traces.
+       */
+      void setMaxShiftPercentage(float fraction) { _maxShiftPercentage = fraction; }
+      float maxShiftPercentage() const { return _maxShiftPercentage; }
+
       /**
        * The following is to be printed:
        * (m1) <trace1> (m2) <trace2> (FlippableCorLoc) <t1>
@@ -66,6 +111,7 @@ class ComparisonPrinter {
       // maxlocal_info includes three items: 
       //   loc1 <spalce> loca2  <spalce> flipped <space> max_corr 
       // as defined in file `ValueLoc.cpp' 
+      // comparisonId names the pair for the random streams (see setSeed).
       virtual void doPairComparison(const std::string& dataDir,
                                const std::string& file1,
                                const std::string& file2,
@@ -73,9 +119,52 @@ class ComparisonPrinter {
                                int valWindow,
                                int numRigidPairs, 
                                int numRandomPairs, 
-                               std::ostream& out) const = 0; 
+                               std::ostream& out,
+                               unsigned long long comparisonId) const = 0; 
                   
+      /**
+       * Runs doPairComparison() on every pair (i < j) of files,
+       * in the order (0,1), (0,2), ..., (1,2), ..., with comparison
+       * ids counting up from 0 in that order.
+       *
+       * Printers that can share work between pairs (reading and
+       * tabulating each trace once) override this; the output must
+       * stay the same as this loop's.
+       */
+      virtual void doAllPairComparisons(const std::string& dataDir,
+                               const std::vector<std::string>& files,
+                               int searchWindow,
+                               int valWindow,
+                               int numRigidPairs,
+                               int numRandomPairs,
+                               std::ostream& out) const
+      {
+          const int total = files.size();
+          unsigned long long comparisonId = 0;
+          for (int i = 0; i < total - 1; i++) {
+              for (int j = i + 1; j < total; j++) {
+                  doPairComparison(dataDir, files[i], files[j], searchWindow, valWindow,
+                                   numRigidPairs, numRandomPairs, out, comparisonId++);
+              }
+          }
+      }
+
+      /**
+       * The line of column names printed above the comparisons.
+       */
+      virtual std::string columns() const
+      {
+          return "file1        \t file2                        \t loc1 \t loc2 \t flipped_maxcorr \t T_sample_size: \t T_mean            \t T_var \n";
+      }
+
       virtual std::string name() const = 0;
+
+      protected:
+      int _numThreads;
+      unsigned long _seed;
+      int _searchStrategy;
+      int _warpBand;
+      float _maxShiftPercentage;
 };
 
 #endif
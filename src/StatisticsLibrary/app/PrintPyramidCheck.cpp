@@ -0,0 +1,143 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#include "PrintPyramidCheck.h"
+#include "PrintTrimmedOneOne.h"
+#include "../base/flipcorrelation.h"
+#include "../base/FlippableCorLoc.h"
+#include "../base/pyramidcorrelation.h"
+#include "../io/readtrace.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <vector>
+using namespace std;
+
+static double secondsSince(const chrono::steady_clock::time_point& start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+PrintPyramidCheck::PrintPyramidCheck(int trim) : _trim(trim) {}
+
+PrintPyramidCheck::Outcome PrintPyramidCheck::checkPair(const std::string& dataDir,
+                                                        const std::string& file1,
+                                                        const std::string& file2,
+                                                        int searchWindow,
+                                                        std::ostream& out) const
+{
+    out << file1 << " \t " << file2 << "             \t ";
+
+    auto_ptr<vector<int> > trace1 = readTrace(dataDir.c_str(), file1.c_str());
+    auto_ptr<vector<int> > trace2 = readTrace(dataDir.c_str(), file2.c_str());
+    trimVector(*trace1, _trim);  //remove trim from beginning and end
+    trimVector(*trace2, _trim);
+    const int length1 = trace1->size();
+    const int length2 = trace2->size();
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    const FlippableCorLoc e = maxCorWithFlips(trace1->begin(), trace2->begin(), length1, length2,
+                                              searchWindow, _maxShiftPercentage, false, _numThreads);
+    Outcome ret;
+    ret.exhaustiveSeconds = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    const FlippableCorLoc p = maxCorPyramid(trace1->begin(), trace2->begin(), length1, length2,
+                                            searchWindow, _maxShiftPercentage, 3, _numThreads);
+    ret.pyramidSeconds = secondsSince(start);
+
+    ret.sameLocs = e.loc1() == p.loc1() && e.loc2() == p.loc2();
+    ret.sameShift = e.loc2() - e.loc1() == p.loc2() - p.loc1();
+    ret.corLoss = e.cor() - p.cor();
+
+    out << e.loc1() << " \t " << e.loc2() << " \t " << e.cor() << " \t "
+        << p.loc1() << " \t " << p.loc2() << " \t " << p.cor() << " \t "
+        << ret.sameLocs << " \t " << ret.sameShift << " \t "
+        << ret.exhaustiveSeconds << " \t " << ret.pyramidSeconds << "\n";
+    return ret;
+}
+
+void PrintPyramidCheck::doPairComparison(const std::string& dataDir,
+                                         const std::string& file1,
+                                         const std::string& file2,
+                                         int searchWindow,
+                                         int valWindow,
+                                         int numRigidPairs,
+                                         int numRandomPairs,
+                                         std::ostream& out,
+                                         unsigned long long comparisonId) const
+{
+    (void) valWindow;
+    (void) numRigidPairs;
+    (void) numRandomPairs;
+    (void) comparisonId;
+    checkPair(dataDir, file1, file2, searchWindow, out);
+}
+
+void PrintPyramidCheck::doAllPairComparisons(const std::string& dataDir,
+                                             const std::vector<std::string>& files,
+                                             int searchWindow,
+                                             int valWindow,
+                                             int numRigidPairs,
+                                             int numRandomPairs,
+                                             std::ostream& out) const
+{
+    (void) valWindow;
+    (void) numRigidPairs;
+    (void) numRandomPairs;
+
+    int numPairs = 0, diffLocs = 0, diffShift = 0;
+    double maxLoss = 0.0, exhaustiveSeconds = 0.0, pyramidSeconds = 0.0;
+    const int total = files.size();
+    for (int i = 0; i < total - 1; i++) {
+        for (int j = i + 1; j < total; j++) {
+            const Outcome o = checkPair(dataDir, files[i], files[j], searchWindow, out);
+            ++numPairs;
+            if (!o.sameLocs) ++diffLocs;
+            if (!o.sameShift) ++diffShift;
+            maxLoss = max(maxLoss, o.corLoss);
+            exhaustiveSeconds += o.exhaustiveSeconds;
+            pyramidSeconds += o.pyramidSeconds;
+        }
+    }
+
+    const double percent = (numPairs > 0) ? 100.0 / numPairs : 0.0;
+    out << "\n#pairs: " << numPairs << '\n';
+    out << "#differ.locs: " << diffLocs << " (" << diffLocs * percent << "%)\n";
+    out << "#differ.shift: " << diffShift << " (" << diffShift * percent << "%)\n";
+    out << "#max.r.loss: " << maxLoss << '\n';
+    out << "#seconds.exhaustive: " << exhaustiveSeconds << '\n';
+    out << "#seconds.pyramid: " << pyramidSeconds << '\n';
+}
+
+std::string PrintPyramidCheck::columns() const
+{
+    return "file1        \t file2                        \t loc1 \t loc2 \t maxcorr \t pyr_loc1 \t pyr_loc2 \t pyr_maxcorr \t same_locs \t same_shift \t exh_seconds \t pyr_seconds \n";
+}
+
+std::string PrintPyramidCheck::name() const
+{
+     return "pyramidcheck";
+}
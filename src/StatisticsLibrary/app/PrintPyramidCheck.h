@@ -0,0 +1,88 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#ifndef __PrintPyramidCheck_h__
+#define __PrintPyramidCheck_h__
+
+#include "ComparisonPrinter.h"
+
+/**
+ * Verification harness for the pyramid search (pyramidcorrelation.h).
+ *
+ * For every pair, trims the traces as PrintTrimmedOneOne does and
+ * runs the exhaustive search and the pyramid search with the same
+ * leash (maxShiftPercentage(), max.shift: in the parameter file). It
+ * prints both results, whether they found the same window pair and
+ * the same shift, and how long each took. A few # lines at the end
+ * sum up how often they differ. No T statistic is computed.
+ */
+class PrintPyramidCheck : public ComparisonPrinter {
+   public:
+    ///trim as in PrintTrimmedOneOne; main() checks the oneone printer, so 0.
+    explicit PrintPyramidCheck(int trim = 0);
+
+    void doPairComparison(const std::string& dataDir,
+                          const std::string& file1,
+                          const std::string& file2,
+                          int searchWindow,
+                          int valWindow,
+                          int numRigidPairs,
+                          int numRandomPairs,
+                          std::ostream& out,
+                          unsigned long long comparisonId) const;
+
+    ///The pairs in the usual order, then the summary.
+    void doAllPairComparisons(const std::string& dataDir,
+                              const std::vector<std::string>& files,
+                              int searchWindow,
+                              int valWindow,
+                              int numRigidPairs,
+                              int numRandomPairs,
+                              std::ostream& out) const;
+
+    std::string columns() const;
+
+    std::string name() const;
+
+   private:
+    ///What one pair came to.
+    struct Outcome {
+        bool sameLocs;
+        bool sameShift;
+        double corLoss; ///< Exhaustive r less pyramid r.
+        double exhaustiveSeconds;
+        double pyramidSeconds;
+    };
+
+    Outcome checkPair(const std::string& dataDir,
+                      const std::string& file1,
+                      const std::string& file2,
+                      int searchWindow,
+                      std::ostream& out) const;
+
+    ///The amount to drop from the front and back of each trace.
+    int _trim;
+};
+
+#endif
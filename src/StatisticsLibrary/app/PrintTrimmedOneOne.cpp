@@ -24,17 +24,21 @@
  */
 
 #include "PrintTrimmedOneOne.h"
+#include "../base/dtwcorrelation.h"
 #include "../base/flipcorrelation.h"
 #include "../base/FlippableCorLoc.h"
 #include "../base/intcorrelation.h"
 #include "../base/intnolev_functors.h"
 #include "../base/random.h"
+#include "../base/parallel.h"
 //#include "../base/timing.h"
 #include "../io/readtrace.h"
 #include "../base/stats.h"
+#include <algorithm>
 #include <iostream>
 //#include "MarkName.h"
 #include <memory>
+#include <sstream>
 #include <string>
 #include <vector>
 using namespace std;
@@ -46,6 +50,8 @@ auto_ptr<vector<int> > readTrace(const string& dataDir, const MarkName& m, int t
   return readTrace(dataDir.c_str(), m.tip(), m.side(), m.angle(), m.specimen(), traceNum);
 }
 */
+typedef MaxCorrelationWithFlips<vector<int>::iterator> MaxCorSearch;
+
 void trimVector(vector<int>& v, int trim)
 {
      //XXX! There's no particular reason for this not to be generic
@@ -122,38 +128,25 @@ void PrintTrimmedOneOne::printComparison(const std::string& dataDir,
 }
 */
 
-/* added by maverick to replace printComparison
- *
+/**
+ * The rest of doPairComparison() once both traces are read and
+ * tabulated: the search, the T samples, and the output line after
+ * the file names.
  */
-void PrintTrimmedOneOne::doPairComparison(const std::string& dataDir,
-                                          const std::string& file1,
-                                          const std::string& file2,
-                                          int searchWindow,
-                                          int valWindow,
-                                          int numRigidPairs, 
-                                          int numRandomPairs, 
-                                          std::ostream& out) const { 
-     
-
-    //Ru He update:
-    //out << file1 << "," << file2 << ",  ";
-	out << file1 << " \t " << file2 << "             \t ";
-	//
-
-	//cout << "test";
-
-	//system("pause");
-
-    auto_ptr<vector<int> > trace1 = readTrace(dataDir.c_str(), file1.c_str()); 
-    auto_ptr<vector<int> > trace2 = readTrace(dataDir.c_str(), file2.c_str());
-
-    trimVector(*trace1, _trim);  //remove trim from beginning and end 
-    trimVector(*trace2, _trim);
-
-    const int length1 = trace1->size(); 
-    const int length2 = trace2->size();
-
-	int tmp = 0;
+static void printPreparedComparison(const MaxCorSearch::Prepared& t1,
+                                    const MaxCorSearch::Prepared& t2,
+                                    int searchWindow,
+                                    int valWindow,
+                                    int numRigidPairs,
+                                    int numRandomPairs,
+                                    std::ostream& out,
+                                    unsigned long seed,
+                                    unsigned long long comparisonId,
+                                    int numThreads,
+                                    int searchStrategy,
+                                    int warpBand,
+                                    float maxShiftPercentage)
+{
 	//cout << "length1=" << length1 << endl; 
 	//cout << "length2=" << length2 << endl;
 
@@ -163,12 +156,12 @@ void PrintTrimmedOneOne::doPairComparison(const std::string& dataDir,
 	//Ru He Test:
 	//ofstream out_debug_maxCorWithFlips("T:\\debug_maxCorWithFlips.txt");
 	//out_debug_maxCorWithFlips << "loc1" << " \t " << "loc2" << " \t " << "max_corr" << endl; 
-	FlippableCorLoc c = maxCorWithFlips(trace1->begin(),
-                                        trace2->begin(),
-                                        length1, 
-                                        length2,
-                                        searchWindow,
-                                        false);
+	//The leash defaults to 0 (the false this used to pass), which allows
+	//shift 0 only: the windows are compared at the same position in both traces.
+	FlippableCorLoc c = (ComparisonPrinter::Search_Elastic == searchStrategy)
+		? DtwCorrelation<const int*>(warpBand, numThreads)(t1.data(), t2.data(), t1.length(), t2.length(),
+		                                                  searchWindow, maxShiftPercentage)
+		: MaxCorSearch(numThreads)(t1, t2, maxShiftPercentage);
 	//out_debug_maxCorWithFlips << c.loc1() << " \t " << c.loc2() << " \t " << c.cor() << endl; 
 
 	/*
@@ -206,16 +199,18 @@ void PrintTrimmedOneOne::doPairComparison(const std::string& dataDir,
 	//Ru He update:
 	//For calculate the sample mean and var of T and output them
 	//
+	//Each sample draws from its own stream keyed by (seed, comparison, sample),
+	//so the samples can be spread over threads and T_vector comes out the same.
 	const int T_sample_size = 200;
-	vector<double> T_vector;
-	double temp_T;
-	for(int i = 0; i < T_sample_size; i++){
+	vector<double> T_vector(T_sample_size);
+	parallelFor(T_sample_size, numThreads, [&](int i) {
+	RandomStream rng(seed, comparisonId, i);
 	//
 
 
    IntRigidCorSampExcludeSearch compRigidCor;
-   auto_ptr<vector<double> > rigidCor = compRigidCor(*trace1, *trace2, c.loc1(), c.loc2(),
-                                                    searchWindow, numRigidPairs, valWindow);
+   auto_ptr<vector<double> > rigidCor = compRigidCor(t1.values(), t2.values(), c.loc1(), c.loc2(),
+                                                    searchWindow, numRigidPairs, valWindow, rng);
 
    //Ru He comments:
    //The original code is not correct since it can allow the overlap of search window and random window, (which is confirmed from Amy).
@@ -247,14 +242,13 @@ void PrintTrimmedOneOne::doPairComparison(const std::string& dataDir,
 
    //Ru He updates:
    IntRandomCorSampExcludeSearch compRandomCor;
-   auto_ptr<vector<double> > randomCor = compRandomCor(*trace1, *trace2, c.loc1(), c.loc2(),
-                                                    searchWindow, numRandomPairs, valWindow);
+   auto_ptr<vector<double> > randomCor = compRandomCor(t1.values(), t2.values(), c.loc1(), c.loc2(),
+                                                    searchWindow, numRandomPairs, valWindow, rng);
    //
 
    //Ru He update:
    //out << c.loc1() << "	" << c.loc2() << "	" << "	" << c.cor() << "	" << t1Statistic(*rigidCor, RandomCor) << "\n";
-   temp_T = t1Statistic(*rigidCor, *randomCor);
-   T_vector.push_back(temp_T);
+   T_vector[i] = t1Statistic(*rigidCor, *randomCor);
    //
 
 #if 0
@@ -267,7 +261,7 @@ void PrintTrimmedOneOne::doPairComparison(const std::string& dataDir,
       << t1Statistic(*rigidCor, RandomCor);*/
 
     //Ru He update:
-	}//for(int i = 0; i < T_sample_size; i++)
+	});//for(int i = 0; i < T_sample_size; i++)
 
 	double T_mean, T_var;
 	meanAndVar(T_vector, T_mean, T_var);
@@ -278,6 +272,115 @@ void PrintTrimmedOneOne::doPairComparison(const std::string& dataDir,
 
 }
 
+/* added by maverick to replace printComparison
+ *
+ */
+void PrintTrimmedOneOne::doPairComparison(const std::string& dataDir,
+                                          const std::string& file1,
+                                          const std::string& file2,
+                                          int searchWindow,
+                                          int valWindow,
+                                          int numRigidPairs, 
+                                          int numRandomPairs, 
+                                          std::ostream& out,
+                                          unsigned long long comparisonId) const { 
+     
+
+    //Ru He update:
+    //out << file1 << "," << file2 << ",  ";
+	out << file1 << " \t " << file2 << "             \t ";
+	//
+
+	//cout << "test";
+
+	//system("pause");
+
+    auto_ptr<vector<int> > trace1 = readTrace(dataDir.c_str(), file1.c_str()); 
+    auto_ptr<vector<int> > trace2 = readTrace(dataDir.c_str(), file2.c_str());
+
+    trimVector(*trace1, _trim);  //remove trim from beginning and end 
+    trimVector(*trace2, _trim);
+
+    const MaxCorSearch::Prepared t1(trace1->begin(), trace1->size(), searchWindow);
+    const MaxCorSearch::Prepared t2(trace2->begin(), trace2->size(), searchWindow);
+
+    printPreparedComparison(t1, t2, searchWindow, valWindow, numRigidPairs, numRandomPairs,
+                            out, _seed, comparisonId, _numThreads, _searchStrategy, _warpBand,
+                            _maxShiftPercentage);
+}
+
+/**
+ * Reads, trims and tabulates every trace once instead of once per pair,
+ * then runs the upper triangle of the pair matrix in tiles of
+ * TileSize x TileSize traces, so that a thread works on a few traces at
+ * a time. Each band of TileSize rows is printed as soon as it is done,
+ * in the same order and with the same comparison ids as the pair loop
+ * in ComparisonPrinter, so the output is the same as doPairComparison()
+ * on every pair for any number of threads.
+ */
+void PrintTrimmedOneOne::doAllPairComparisons(const std::string& dataDir,
+                                              const std::vector<std::string>& files,
+                                              int searchWindow,
+                                              int valWindow,
+                                              int numRigidPairs,
+                                              int numRandomPairs,
+                                              std::ostream& out) const
+{
+    const int total = files.size();
+    if (total < 2) return;
+
+    //Read, trim and tabulate each trace once.
+    vector<MaxCorSearch::Prepared> traces(total);
+    parallelFor(total, _numThreads, [&](int i) {
+        auto_ptr<vector<int> > trace = readTrace(dataDir.c_str(), files[i].c_str());
+        trimVector(*trace, _trim);
+        traces[i].assign(trace->begin(), trace->size(), searchWindow);
+    });
+
+    const int TileSize = 16;
+    const int numThreads = resolveNumThreads(_numThreads);
+    const int numBlocks = (total + TileSize - 1) / TileSize;
+    for (int band = 0; band < numBlocks; ++band) {
+        const int rowBegin = band * TileSize;
+        const int rowEnd = std::min(rowBegin + TileSize, total - 1);
+        if (rowBegin >= rowEnd) break;
+
+        //Where each row's pairs start among this band's lines, and the
+        //comparison id of the band's first pair, (rowBegin, rowBegin + 1).
+        vector<int> rowStart(rowEnd - rowBegin + 1, 0);
+        for (int i = rowBegin; i < rowEnd; ++i)
+            rowStart[i - rowBegin + 1] = rowStart[i - rowBegin] + (total - 1 - i);
+        const unsigned long long firstId = (unsigned long long) rowBegin * total
+            - (unsigned long long) rowBegin * (rowBegin + 1) / 2;
+
+        //One task per tile (this band x a block of columns). Once the
+        //tiles run out, the leftover threads go to each pair's search.
+        const int numTiles = numBlocks - band;
+        const int pairThreads = std::max(1, numThreads / numTiles);
+        vector<string> lines(rowStart.back());
+        parallelFor(numTiles, numThreads, [&](int tile) {
+            const int colBegin = (band + tile) * TileSize;
+            const int colEnd = std::min(colBegin + TileSize, total);
+            for (int i = rowBegin; i < rowEnd; ++i) {
+                for (int j = std::max(colBegin, i + 1); j < colEnd; ++j) {
+                    const int k = rowStart[i - rowBegin] + (j - i - 1);
+                    std::ostringstream line;
+                    line.copyfmt(out);
+                    line << files[i] << " \t " << files[j] << "             \t ";
+                    printPreparedComparison(traces[i], traces[j], searchWindow, valWindow,
+                                            numRigidPairs, numRandomPairs, line,
+                                            _seed, firstId + k, pairThreads,
+                                            _searchStrategy, _warpBand, _maxShiftPercentage);
+                    lines[k] = line.str();
+                }
+            }
+        });
+
+        for (size_t k = 0; k < lines.size(); ++k)
+            out << lines[k];
+    }
+}
+
 std::string PrintTrimmedOneOne::name() const
 {
     return "PrintTrimmedOneOne";
@@ -27,6 +27,10 @@
 #define __PrintTrimmedOneOne_h__
 
 #include "ComparisonPrinter.h"
+#include <vector>
+
+///Drops trim samples from the front and back of v.
+void trimVector(std::vector<int>& v, int trim);
 
 class PrintTrimmedOneOne : public ComparisonPrinter {
    public:
@@ -64,7 +68,21 @@ class PrintTrimmedOneOne : public ComparisonPrinter {
                           int valWindow,
                           int numRigidPairs, 
                           int numRandomPairs, 
-                          std::ostream& out) const; 
+                          std::ostream& out,
+                          unsigned long long comparisonId) const; 
+
+    /**
+     * Same output as doPairComparison() on every pair, but each
+     * trace is read and tabulated only once and the pairs are
+     * spread over numThreads() threads in tiles.
+     */
+    void doAllPairComparisons(const std::string& dataDir,
+                              const std::vector<std::string>& files,
+                              int searchWindow,
+                              int valWindow,
+                              int numRigidPairs,
+                              int numRandomPairs,
+                              std::ostream& out) const;
                      
     std::string name() const;
   
@@ -0,0 +1,349 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ *
+ * This computer software was prepared by The Ames
+ * Laboratory, hereinafter the Contractor, under
+ * Interagency Agreement number 2009-DN-R-119 between
+ * the National Institute of Justice (NIJ) and the
+ * Department of Energy (DOE). All rights in the computer
+ * software are reserved by NIJ/DOE on behalf of the
+ * United States Government and the Contractor as provided
+ * in its Contract, DE-AC02-07CH11358.  You are authorized
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY,
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE
+ * OF THIS SOFTWARE.
+ *
+ * This notice including this sentence
+ * must appear on any copies of this computer software.
+ */
+
+/*
+ * Times the hot paths of the statistics package one at a time, on
+ * synthetic striation traces, so that builds can be compared without
+ * a directory of real traces. Built by benchmark.pro.
+ *
+ * Each kernel is called once to see how long it takes, then timed
+ * over repeats runs of enough calls to fill min.seconds each. The
+ * output is tab separated: # lines with the settings, a line of column
+ * names, and a line per kernel with the best, median and mean time
+ * per call in microseconds and a checksum of what the kernel returned
+ * (the same checksum means the same results).
+ */
+
+#include "../base/flipcorrelation.h"
+#include "../base/FlippableCorLoc.h"
+#include "../base/fftcorrelation.h"
+#include "../base/getcurrenttime.h"
+#include "../base/intcorrelation.h"
+#include "../base/intnolev_functors.h"
+#include "../base/random.h"
+#include "../base/stats.h"
+#include "../io/converttracetoint.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+using namespace std;
+
+///What the benchmark is run with; see usage().
+struct Settings {
+    int length1;
+    int length2;
+    double correlation;
+    int searchWindow;
+    int valWindow;
+    int numPairs;
+    int numThreads;
+    int repeats;
+    double minSeconds;
+    unsigned long seed;
+    string kernels;
+
+    Settings() : length1(1500), length2(1500), correlation(0.8), searchWindow(100),
+        valWindow(50), numPairs(200), numThreads(1), repeats(5), minSeconds(0.05),
+        seed(337), kernels("all") {}
+};
+
+///Every kernel, in the order they are run.
+static const char* const AllKernels[] = {
+    "maxCorWithFlips",
+    "maxCorrelation",
+    "leveledMaxCorrelation",
+    "fftMaxCorrelation",
+    "fftLeveledMaxCorrelation",
+    "rigidPairs",
+    "randomPairs",
+    "nonrigidPairs",
+    "t1Statistic"
+};
+
+static void usage(const char* program)
+{
+    const Settings d;
+    cerr << "Usage: " << program << " [--<setting> <value>]...\n"
+         << " Settings:\n"
+         << "  --length1 <samples in trace 1; default " << d.length1 << ">\n"
+         << "  --length2 <samples in trace 2; default " << d.length2 << ">\n"
+         << "  --correlation <r of the matching stretch, in [0, 1]; default " << d.correlation << ">\n"
+         << "  --search.window <default " << d.searchWindow << ">\n"
+         << "  --val.window <default " << d.valWindow << ">\n"
+         << "  --num.pairs <validation pairs per draw; default " << d.numPairs << ">\n"
+         << "  --num.threads <threads for maxCorWithFlips and the FFT searches, 0 = all cores; default " << d.numThreads << ">\n"
+         << "  --repeats <timed runs per kernel; default " << d.repeats << ">\n"
+         << "  --min.seconds <length of a timed run; default " << d.minSeconds << ">\n"
+         << "  --seed <of the traces and the validation draws; default " << d.seed << ">\n"
+         << "  --kernels <comma separated, or all; default all> out of:\n  ";
+    for (size_t k = 0; k < sizeof(AllKernels) / sizeof(AllKernels[0]); ++k)
+        cerr << ' ' << AllKernels[k];
+    cerr << '\n';
+}
+
+///Reads value into v; false if it is not all a T.
+template <typename T>
+static bool parse(const string& value, T& v)
+{
+    istringstream in(value);
+    return (in >> v) && (in >> ws).eof();
+}
+
+static bool readSettings(int numArgs, char** args, Settings& s)
+{
+    for (int i = 1; i < numArgs; i += 2) {
+        const string name = args[i];
+        if (i + 1 >= numArgs) return false;
+        const string value = args[i + 1];
+        bool ok;
+        if (name == "--length1") ok = parse(value, s.length1);
+        else if (name == "--length2") ok = parse(value, s.length2);
+        else if (name == "--correlation") ok = parse(value, s.correlation);
+        else if (name == "--search.window") ok = parse(value, s.searchWindow);
+        else if (name == "--val.window") ok = parse(value, s.valWindow);
+        else if (name == "--num.pairs") ok = parse(value, s.numPairs);
+        else if (name == "--num.threads") ok = parse(value, s.numThreads);
+        else if (name == "--repeats") ok = parse(value, s.repeats);
+        else if (name == "--min.seconds") ok = parse(value, s.minSeconds);
+        else if (name == "--seed") ok = parse(value, s.seed);
+        else if (name == "--kernels") { s.kernels = value; ok = true; }
+        else ok = false;
+        if (!ok) {
+            cerr << "Bad setting: " << name << ' ' << value << '\n';
+            return false;
+        }
+    }
+    return s.length1 > 0 && s.length2 > 0 && s.searchWindow > 0 && s.valWindow > 0 &&
+        s.numPairs > 0 && s.repeats > 0 && s.minSeconds >= 0.0 &&
+        s.correlation >= 0.0 && s.correlation <= 1.0;
+}
+
+static bool wanted(const Settings& s, const string& kernel)
+{
+    if (s.kernels == "all") return true;
+    const string list = "," + s.kernels + ",";
+    return list.find("," + kernel + ",") != string::npos;
+}
+
+///A draw from N(0, 1), by Box-Muller.
+static double normal(RandomStream& rng)
+{
+    const double pi = acos(-1.0);
+    const double u = 1.0 - rng.random01(); //in (0, 1]
+    return sqrt(-2.0 * log(u)) * cos(2.0 * pi * rng.random01());
+}
+
+/**
+ * length samples of a striated surface, in um: white noise smoothed
+ * over about 8 samples, for the fine striations, with a few deeper
+ * grooves cut into it. Roughly mean 0 and variance 1.
+ */
+static vector<double> striations(int length, RandomStream& rng)
+{
+    const int width = 8;
+    vector<double> noise(length + width);
+    for (size_t i = 0; i < noise.size(); ++i) noise[i] = normal(rng);
+
+    vector<double> y(length, 0.0);
+    for (int i = 0; i < length; ++i) {
+        for (int j = 0; j < width; ++j) y[i] += noise[i + j];
+        y[i] /= sqrt((double) width);
+    }
+    const int numGrooves = max(1, length / 200);
+    for (int g = 0; g < numGrooves; ++g) {
+        const double center = length * rng.random01();
+        const double depth = 2.0 + 2.0 * rng.random01();
+        for (int i = max(0, (int) center - 12); i < min(length, (int) center + 13); ++i) {
+            const double d = (i - center) / 4.0;
+            y[i] -= depth * exp(-0.5 * d * d);
+        }
+    }
+    return y;
+}
+
+/**
+ * Two traces of one surface: trace 2 starts a quarter of trace 1 in,
+ * and is the surface times correlation plus unrelated striations, so
+ * windows that match correlate at about correlation. As ints, the way
+ * the stat package reads traces (see ConvertTraceToInt).
+ */
+static void syntheticPair(const Settings& s, vector<int>& y1, vector<int>& y2)
+{
+    RandomStream rng(s.seed, 0, 0);
+    const int shift = s.length1 / 4;
+    const vector<double> surface = striations(max(s.length1, shift + s.length2), rng);
+    const vector<double> other = striations(s.length2, rng);
+
+    vector<double> t1(surface.begin(), surface.begin() + s.length1);
+    vector<double> t2(s.length2);
+    const double rest = sqrt(1.0 - s.correlation * s.correlation);
+    for (int i = 0; i < s.length2; ++i)
+        t2[i] = s.correlation * surface[shift + i] + rest * other[i];
+
+    ConvertTraceToInt toInt;
+    y1 = *toInt(t1);
+    y2 = *toInt(t2);
+}
+
+static double secondsSince(const chrono::steady_clock::time_point& start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+///Times one kernel, and prints its line.
+template <typename Kernel>
+static void timeKernel(const Settings& s, const string& name, Kernel kernel, ostream& out)
+{
+    //A first call, to see how many make up a timed run.
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    double checksum = kernel();
+    const double once = secondsSince(start);
+    const int calls = max(1, (int) ceil(s.minSeconds / max(once, 1e-9)));
+
+    vector<double> perCall(s.repeats);
+    for (int r = 0; r < s.repeats; ++r) {
+        start = chrono::steady_clock::now();
+        for (int c = 0; c < calls; ++c) checksum = kernel();
+        perCall[r] = 1e6 * secondsSince(start) / calls;
+    }
+    const double mean = accumulate(perCall.begin(), perCall.end(), 0.0) / s.repeats;
+    sort(perCall.begin(), perCall.end());
+    const double median = (s.repeats % 2) ? perCall[s.repeats / 2]
+        : 0.5 * (perCall[s.repeats / 2 - 1] + perCall[s.repeats / 2]);
+
+    out << name << '\t' << s.length1 << '\t' << s.length2 << '\t' << s.searchWindow << '\t'
+        << calls << '\t' << s.repeats << '\t' << perCall[0] << '\t' << median << '\t'
+        << mean << '\t' << checksum << endl;
+}
+
+static double sum(const vector<double>& v)
+{
+    return accumulate(v.begin(), v.end(), 0.0);
+}
+
+int main(int numArgs, char** args)
+{
+    Settings s;
+    if (!readSettings(numArgs, args, s)) {
+        usage(args[0]);
+        return 1;
+    }
+
+    vector<int> y1, y2;
+    syntheticPair(s, y1, y2);
+    //maxCorrelation() and friends want traces of one length.
+    const int common = min(s.length1, s.length2);
+    const vector<int> x1(y1.begin(), y1.begin() + common);
+    const vector<int> x2(y2.begin(), y2.begin() + common);
+
+    ostream& out = cout;
+    out.precision(10);
+    out << "#benchmark: statistics kernels\n";
+    out << "#date: " << *getCurrentTime();
+#ifdef __VERSION__
+    out << "#compiler: " << __VERSION__ << '\n';
+#endif
+    out << "#length1: " << s.length1 << '\n';
+    out << "#length2: " << s.length2 << '\n';
+    out << "#correlation: " << s.correlation << '\n';
+    out << "#search.window: " << s.searchWindow << '\n';
+    out << "#val.window: " << s.valWindow << '\n';
+    out << "#num.pairs: " << s.numPairs << '\n';
+    out << "#num.threads: " << s.numThreads << '\n';
+    out << "#repeats: " << s.repeats << '\n';
+    out << "#min.seconds: " << s.minSeconds << '\n';
+    out << "#seed: " << s.seed << '\n';
+    out << "kernel\tlength1\tlength2\tsearch.window\tcalls\trepeats\tbest.us\tmedian.us\tmean.us\tchecksum\n";
+
+    try {
+        //Where the validation draws are made around, as in a comparison.
+        const FlippableCorLoc match = maxCorWithFlips(y1.begin(), y2.begin(), s.length1, s.length2,
+                                                      s.searchWindow, 1.0f, true, s.numThreads);
+        const int l1 = match.loc1(), l2 = match.loc2();
+
+        //Each call draws the same pairs, so the checksums repeat.
+        IntRigidCorSampExcludeSearch rigidSamp;
+        IntRandomCorSampExcludeSearch randomSamp;
+        IntNonrigidCorSampWithFlips nonrigidSamp;
+        RandomStream rigidRng(s.seed, 1, 0), randomRng(s.seed, 2, 0);
+        const auto_ptr<vector<double> > rigidCors =
+            rigidSamp(y1, y2, l1, l2, s.searchWindow, s.numPairs, s.valWindow, rigidRng);
+        const auto_ptr<vector<double> > randomCors =
+            randomSamp(y1, y2, l1, l2, s.searchWindow, s.numPairs, s.valWindow, randomRng);
+
+        if (wanted(s, "maxCorWithFlips"))
+            timeKernel(s, "maxCorWithFlips", [&]() {
+                return maxCorWithFlips(y1.begin(), y2.begin(), s.length1, s.length2,
+                                       s.searchWindow, 1.0f, true, s.numThreads).cor();
+            }, out);
+        if (wanted(s, "maxCorrelation"))
+            timeKernel(s, "maxCorrelation", [&]() {
+                return maxCorrelation(x1, x2, s.searchWindow).cor;
+            }, out);
+        if (wanted(s, "leveledMaxCorrelation"))
+            timeKernel(s, "leveledMaxCorrelation", [&]() {
+                return leveledMaxCorrelation(x1, x2, s.searchWindow).cor;
+            }, out);
+        //The same searches in the frequency domain: the checksums should
+        //match the two above (the leveled one up to rounding).
+        if (wanted(s, "fftMaxCorrelation"))
+            timeKernel(s, "fftMaxCorrelation", [&]() {
+                return fftMaxCorrelation(x1, x2, s.searchWindow, s.numThreads).cor;
+            }, out);
+        if (wanted(s, "fftLeveledMaxCorrelation"))
+            timeKernel(s, "fftLeveledMaxCorrelation", [&]() {
+                return fftLeveledMaxCorrelation(x1, x2, s.searchWindow, s.numThreads).cor;
+            }, out);
+        if (wanted(s, "rigidPairs"))
+            timeKernel(s, "rigidPairs", [&]() {
+                RandomStream rng(s.seed, 1, 0);
+                return sum(*rigidSamp(y1, y2, l1, l2, s.searchWindow, s.numPairs, s.valWindow, rng));
+            }, out);
+        if (wanted(s, "randomPairs"))
+            timeKernel(s, "randomPairs", [&]() {
+                RandomStream rng(s.seed, 2, 0);
+                return sum(*randomSamp(y1, y2, l1, l2, s.searchWindow, s.numPairs, s.valWindow, rng));
+            }, out);
+        if (wanted(s, "nonrigidPairs"))
+            timeKernel(s, "nonrigidPairs", [&]() {
+                RandomStream rng(s.seed, 3, 0);
+                return sum(*nonrigidSamp(x1, x2, s.numPairs, s.valWindow, rng));
+            }, out);
+        if (wanted(s, "t1Statistic"))
+            timeKernel(s, "t1Statistic", [&]() {
+                return t1Statistic(*rigidCors, *randomCors);
+            }, out);
+    } catch (exception& err) {
+        cerr << "Benchmark failed: " << err.what() << '\n';
+        return 1;
+    }
+    return 0;
+}
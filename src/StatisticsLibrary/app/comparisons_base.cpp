@@ -63,7 +63,12 @@ void comparisonsMain(int numArgs,
                 "  val.window: <validation window width>\n"
                 "  num.rigidpairs: <number of pairs to pick with the same shift for the pair>\n"
                 "  num.randompairs: <number of pairs to pick with different shift for the pair> \n"
-                "  output.file: <file in which to save results>\n";
+                "  output.file: <file in which to save results>\n"
+                " Optional fields (after the ones above):\n"
+                "  num.threads: <threads for the search and the T samples, 0 = all cores; default 1>\n"
+                "  search.strategy: <exhaustive, or elastic to let windows warp; default exhaustive>\n"
+                "  warp.band: <samples an elastic match may warp by; default 8>\n"
+                "  max.shift: <fraction of the trace the best windows may be shifted apart; default 0>\n";
 #ifdef MYDEBUG
        perror("Any key to quit.\n");
        system("pause"); 
@@ -92,6 +97,10 @@ void comparisonsMain(int numArgs,
     int numRigidPairs; // = 10; 
     int numRandomPairs; // = 12 ;
     string outputFile;
+    int numThreads = 1;
+    string searchStrategy = "exhaustive";
+    int warpBand = 8;
+    float maxShift = 0.0f;
 
     try {
     
@@ -114,6 +123,10 @@ void comparisonsMain(int numArgs,
         readLabeledValue(param, "num.randompairs:", numRandomPairs);
         
         readLabeledValue(param, "output.file:", outputFile);
+        readOptionalLabeledValue(param, "num.threads:", numThreads);
+        readOptionalLabeledValue(param, "search.strategy:", searchStrategy);
+        readOptionalLabeledValue(param, "warp.band:", warpBand);
+        readOptionalLabeledValue(param, "max.shift:", maxShift);
         param.close();
     } catch (runtime_error err) {
         cout << err.what() << "\n";
@@ -124,6 +137,11 @@ void comparisonsMain(int numArgs,
         exit(1);
 #endif
     }
+    if (searchStrategy != "exhaustive" && searchStrategy != "elastic") {
+        cerr << "Unknown search.strategy: " << searchStrategy << " (exhaustive or elastic)\n";
+        exit(1);
+    }
+
     ofstream out(outputFile.c_str()); 
     /* 
     ofstream out("testout.txt"); // serve for debug
@@ -146,17 +164,32 @@ void comparisonsMain(int numArgs,
     out << "#val.window: " << valWindow << '\n';
     out << "#num.rigidpairs: " << numRigidPairs << '\n';
     out << "#num.randompairs: " << numRandomPairs << '\n';
+    //Only when set, so runs with the defaults write the header they always did.
+    if (numThreads != 1)
+        out << "#num.threads: " << numThreads << '\n';
+    if (searchStrategy != "exhaustive")
+        out << "#search.strategy: " << searchStrategy << '\n';
+    if (warpBand != 8)
+        out << "#warp.band: " << warpBand << '\n';
+    if (maxShift != 0.0f)
+        out << "#max.shift: " << maxShift << '\n';
     out << "#alg.name: " << printComp->name() << '\n';
     out << "#seed: " << seed << "\n\n";
 
     setSeed(seed);
+    printComp->setSeed(seed);
+    printComp->setNumThreads(numThreads);
+    printComp->setSearchStrategy(searchStrategy == "elastic" ?
+        ComparisonPrinter::Search_Elastic : ComparisonPrinter::Search_Exhaustive);
+    printComp->setWarpBand(warpBand);
+    printComp->setMaxShiftPercentage(maxShift);
 
     out.precision(16); //setting decimal precision for all relevant output (r and T1)
 
 	//Ru He update:
 	//For (1) the better output format, (2) add mean of T and var of T
     //out << "file1, file2, loc1, loc2, flipped maxcorr, test_stat \n"; 
-	out << "file1        \t file2                        \t loc1 \t loc2 \t flipped_maxcorr \t T_sample_size: \t T_mean            \t T_var \n"; 
+	out << printComp->columns();
   
 
     /*
@@ -179,13 +212,9 @@ void comparisonsMain(int numArgs,
   
    vector<string> alltracefiles;
 
-   int total = listDirfun(dataDir.c_str(), &alltracefiles);
-   for (int i = 0; i < total - 1; i++)  {
-       for (int j=i+1; j < total; j++) {           
-           printComp -> doPairComparison(dataDir, alltracefiles[i], alltracefiles[j], 
-                                         searchWindow, valWindow, numRigidPairs, numRandomPairs, out);
-       }
-   }
+   listDirfun(dataDir.c_str(), &alltracefiles);
+   printComp -> doAllPairComparisons(dataDir, alltracefiles,
+                                     searchWindow, valWindow, numRigidPairs, numRandomPairs, out);
 
    /*
    // commented out by Maverick 
@@ -35,6 +35,8 @@
 
 #include <memory>
 #include "PrintOneOne.h"
+#include "PrintPyramidCheck.h"
+#include <string>
 using namespace std;
 
 // #include <iostream>
@@ -48,6 +50,15 @@ int main(int numArgs, char** args)
    //seed = 123;
    
 
+   //"--check-pyramid paramFile" compares the pyramid search with the
+   //exhaustive one on every pair instead (see PrintPyramidCheck.h).
+   if (numArgs == 3 && string(args[1]) == "--check-pyramid") {
+       args[1] = args[0];
+       comparisonsMain(numArgs - 1, args + 1,
+                       auto_ptr<ComparisonPrinter>(new PrintPyramidCheck), seed);
+       return 0;
+   }
+
    comparisonsMain(numArgs, args,
                    auto_ptr<ComparisonPrinter>(new PrintOneOne), seed); 
    
@@ -0,0 +1,341 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#include "arealcorrelation.h"
+#include "correlationsurface.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+typedef std::complex<double> Complex;
+
+/**
+ * An in-place radix-2 FFT of one size, with the bit reversal and the
+ * twiddles worked out once; every tile of a scan uses the same two.
+ * Unscaled both ways.
+ */
+class FftPlan {
+  public:
+    explicit FftPlan(int n) : _n(n), _reversed(n), _twiddles(n / 2)
+    {
+        for (int i = 1, j = 0; i < n; ++i) {
+            int bit = n >> 1;
+            for (; j & bit; bit >>= 1) j ^= bit;
+            j ^= bit;
+            _reversed[i] = j;
+        }
+        const double pi = std::acos(-1.0);
+        for (int k = 0; k < n / 2; ++k)
+            _twiddles[k] = std::polar(1.0, -2.0 * pi * k / n);
+    }
+
+    int size() const { return _n; }
+
+    void transform(Complex* a, bool inverse) const
+    {
+        for (int i = 1; i < _n; ++i) {
+            if (i < _reversed[i]) std::swap(a[i], a[_reversed[i]]);
+        }
+        for (int len = 2; len <= _n; len <<= 1) {
+            const int half = len / 2;
+            const int step = _n / len;
+            for (int k = 0; k < half; ++k) {
+                const Complex w = inverse ? std::conj(_twiddles[k * step]) : _twiddles[k * step];
+                for (int i = k; i < _n; i += len) {
+                    const Complex u = a[i];
+                    const Complex v = a[i + half] * w;
+                    a[i] = u + v;
+                    a[i + half] = u - v;
+                }
+            }
+        }
+    }
+
+  private:
+    int _n;
+    std::vector<int> _reversed;
+    std::vector<Complex> _twiddles;
+};
+
+/**
+ * 2D FFT of a rowPlan.size() wide, colPlan.size() high grid, row-major.
+ * Rows from usedRows down are taken to be 0 (zero padding) and skipped
+ * in the forward direction.
+ */
+static void fft2D(std::vector<Complex>& a, const FftPlan& rowPlan, const FftPlan& colPlan,
+                  bool inverse, int usedRows, std::vector<Complex>& column)
+{
+    const int nCols = rowPlan.size();
+    const int nRows = colPlan.size();
+    if (inverse) usedRows = nRows;
+    for (int r = 0; r < usedRows; ++r)
+        rowPlan.transform(&a[(size_t) r * nCols], inverse);
+
+    column.resize(nRows);
+    for (int c = 0; c < nCols; ++c) {
+        for (int r = 0; r < nRows; ++r) column[r] = a[(size_t) r * nCols + c];
+        colPlan.transform(&column[0], inverse);
+        for (int r = 0; r < nRows; ++r) a[(size_t) r * nCols + c] = column[r];
+    }
+}
+
+/**
+ * The spectra of two real grids transformed together as z = a + i*b:
+ * A = (Z[k] + conj(Z[-k])) / 2 and B = (Z[k] - conj(Z[-k])) / 2i.
+ */
+static inline void unpack(const std::vector<Complex>& z, size_t k, size_t minusK, Complex& a, Complex& b)
+{
+    const Complex zk = z[k];
+    const Complex zn = std::conj(z[minusK]);
+    a = 0.5 * (zk + zn);
+    b = Complex(0.0, -0.5) * (zk - zn);
+}
+
+static int nextPow2(int n)
+{
+    int p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+///Weighted mean of an image; 0 if nothing has weight.
+static double weightedMean(const ArealImage& image)
+{
+    double sum = 0.0, weight = 0.0;
+    for (int i = 0; i < image.height; ++i) {
+        for (int j = 0; j < image.width; ++j) {
+            const double w = image.weight(i, j);
+            if (w <= 0.0) continue;
+            sum += w * image.values[(size_t) i * image.width + j];
+            weight += w;
+        }
+    }
+    return (weight > 0.0) ? sum / weight : 0.0;
+}
+
+/**
+ * The first best placement in (row, col) order of what was offered.
+ */
+struct ArealBest {
+    ArealMatch match;
+
+    inline void offer(double cor, int row, int col)
+    {
+        if (!(cor >= match.cor)) return;
+        if (cor > match.cor || !match.found() || row < match.row || (row == match.row && col < match.col)) {
+            match.cor = cor;
+            match.row = row;
+            match.col = col;
+        }
+    }
+};
+
+ArealImage extrudedTrace(const float* trace, const unsigned char* valid, int length, int bandWidth)
+{
+    ArealImage band(bandWidth, length);
+    if (valid) band.weights.assign((size_t) bandWidth * length, 0.0f);
+    for (int i = 0; i < length; ++i) {
+        for (int j = 0; j < bandWidth; ++j) {
+            band.values[(size_t) i * bandWidth + j] = trace[i];
+            if (valid) band.weights[(size_t) i * bandWidth + j] = valid[i] ? 1.0f : 0.0f;
+        }
+    }
+    return band;
+}
+
+ArealMatch arealCorrelation(const ArealImage& mark,
+                            const ArealImage& region,
+                            int numThreads,
+                            double minWeightFraction,
+                            SurfaceSink* sink,
+                            int tileSize)
+{
+    if (mark.width <= 0 || mark.height <= 0 || mark.width > region.width || mark.height > region.height) {
+        std::ostringstream what;
+        what << "arealCorrelation: a " << mark.width << " x " << mark.height
+             << " mark does not fit in a " << region.width << " x " << region.height << " region";
+        throw std::out_of_range(what.str());
+    }
+    if (tileSize <= 0) tileSize = 128;
+
+    const int rows = region.height - mark.height + 1;
+    const int cols = region.width - mark.width + 1;
+
+    //FFT tiles: each covers stepRows x stepCols placements. The row step
+    //is kept to whole sink tiles so that a band can be handed on as is.
+    const int nRows = nextPow2(mark.height + std::min(rows, std::max(mark.height, tileSize)) - 1);
+    int stepRows = std::min(rows, nRows - mark.height + 1);
+    if (stepRows < rows) stepRows = stepRows / tileSize * tileSize;
+    const int nCols = nextPow2(mark.width + std::min(cols, std::max(mark.width, 64)) - 1);
+    const int stepCols = std::min(cols, nCols - mark.width + 1);
+    const int tilesPerBand = (cols + stepCols - 1) / stepCols;
+    const size_t gridSize = (size_t) nRows * nCols;
+    const double scale = 1.0 / gridSize;
+
+    const FftPlan rowPlan(nCols);
+    const FftPlan colPlan(nRows);
+
+    //Both are centred on their weighted means first; that does not
+    //change r, and keeps the sums of squares from cancelling. Depths of
+    //weight 0 are never read, so masked points may hold anything.
+    const double markMean = weightedMean(mark);
+    const double regionMean = weightedMean(region);
+
+    //Spectra of the mark's weights M, weighted depths T and T^2, conjugated.
+    std::vector<Complex> markM(gridSize), markT(gridSize), markT2(gridSize);
+    double markWeight = 0.0;
+    {
+        std::vector<Complex> z(gridSize), column;
+        for (int i = 0; i < mark.height; ++i) {
+            for (int j = 0; j < mark.width; ++j) {
+                const double w = mark.weight(i, j);
+                const double v = (w > 0.0) ? mark.values[(size_t) i * mark.width + j] - markMean : 0.0;
+                z[(size_t) i * nCols + j] = Complex(w, w * v);
+                markT2[(size_t) i * nCols + j] = Complex(w * v * v, 0.0);
+                markWeight += w;
+            }
+        }
+        fft2D(z, rowPlan, colPlan, false, mark.height, column);
+        fft2D(markT2, rowPlan, colPlan, false, mark.height, column);
+        for (int r = 0; r < nRows; ++r) {
+            for (int c = 0; c < nCols; ++c) {
+                const size_t k = (size_t) r * nCols + c;
+                const size_t minusK = (size_t) ((nRows - r) & (nRows - 1)) * nCols + ((nCols - c) & (nCols - 1));
+                Complex m, t;
+                unpack(z, k, minusK, m, t);
+                markM[k] = std::conj(m);
+                markT[k] = std::conj(t);
+                markT2[k] = std::conj(markT2[k]);
+            }
+        }
+    }
+    //At least two full samples, and never a placement that rounds to nothing.
+    const double minWeight = std::max(minWeightFraction * markWeight, 2.0 - 1e-6);
+
+    const int threads = resolveNumThreads(numThreads);
+    std::vector<ArealBest> tileBest(tilesPerBand);
+    std::vector<float> band;
+    if (sink) {
+        band.resize((size_t) stepRows * cols);
+        sink->begin(rows, cols, tileSize);
+    }
+
+    ArealBest best;
+    for (int row0 = 0; row0 < rows; row0 += stepRows) {
+        const int bandRows = std::min(stepRows, rows - row0);
+        const int usedRows = std::min(nRows, region.height - row0);
+
+        parallelFor(tilesPerBand, threads, [&](int t) {
+            const int col0 = t * stepCols;
+            const int tileCols = std::min(stepCols, cols - col0);
+            const int usedCols = std::min(nCols, region.width - col0);
+
+            //z = M + i*I and I2, I the weighted centred depths of the region.
+            std::vector<Complex> z(gridSize), i2(gridSize), column;
+            for (int i = 0; i < usedRows; ++i) {
+                for (int j = 0; j < usedCols; ++j) {
+                    const double w = region.weight(row0 + i, col0 + j);
+                    const double v = (w > 0.0) ? region.values[(size_t) (row0 + i) * region.width + col0 + j] - regionMean : 0.0;
+                    z[(size_t) i * nCols + j] = Complex(w, w * v);
+                    i2[(size_t) i * nCols + j] = Complex(w * v * v, 0.0);
+                }
+            }
+            fft2D(z, rowPlan, colPlan, false, usedRows, column);
+            fft2D(i2, rowPlan, colPlan, false, usedRows, column);
+
+            //The six correlations, two to a transform:
+            //(n, sumT), (sumT2, sumI) and (sumI2, sumTI).
+            std::vector<Complex> p1(gridSize), p2(gridSize);
+            const Complex i1(0.0, 1.0);
+            for (int r = 0; r < nRows; ++r) {
+                for (int c = 0; c < nCols; ++c) {
+                    const size_t k = (size_t) r * nCols + c;
+                    const size_t minusK = (size_t) ((nRows - r) & (nRows - 1)) * nCols + ((nCols - c) & (nCols - 1));
+                    Complex m, v;
+                    unpack(z, k, minusK, m, v);
+                    p1[k] = markM[k] * m + i1 * (markT[k] * m);
+                    p2[k] = markT2[k] * m + i1 * (markM[k] * v);
+                    i2[k] = markM[k] * i2[k] + i1 * (markT[k] * v);
+                }
+            }
+            fft2D(p1, rowPlan, colPlan, true, nRows, column);
+            fft2D(p2, rowPlan, colPlan, true, nRows, column);
+            fft2D(i2, rowPlan, colPlan, true, nRows, column);
+
+            ArealBest& b = tileBest[t];
+            b = ArealBest();
+            for (int i = 0; i < bandRows; ++i) {
+                float* out = sink ? &band[(size_t) i * cols + col0] : 0;
+                for (int j = 0; j < tileCols; ++j) {
+                    const size_t k = (size_t) i * nCols + j;
+                    const double n = p1[k].real() * scale;
+                    double r = std::numeric_limits<double>::quiet_NaN();
+                    if (n >= minWeight) {
+                        const double sumT = p1[k].imag() * scale;
+                        const double sumT2 = p2[k].real() * scale;
+                        const double sumI = p2[k].imag() * scale;
+                        const double sumI2 = i2[k].real() * scale;
+                        const double sumTI = i2[k].imag() * scale;
+                        const double varT = sumT2 - sumT * sumT / n;
+                        const double varI = sumI2 - sumI * sumI / n;
+                        //What is left of a constant after the FFTs is rounding.
+                        if (varT > 1e-9 * sumT2 && varI > 1e-9 * sumI2) {
+                            r = (sumTI - sumT * sumI / n) / std::sqrt(varT * varI);
+                            r = std::max(-1.0, std::min(1.0, r));
+                            b.offer(r, row0 + i, col0 + j);
+                        }
+                    }
+                    if (out) out[j] = (float) r;
+                }
+            }
+        });
+
+        for (int t = 0; t < tilesPerBand; ++t) {
+            if (tileBest[t].match.found())
+                best.offer(tileBest[t].match.cor, tileBest[t].match.row, tileBest[t].match.col);
+        }
+
+        if (sink) {
+            for (int i = 0; i < bandRows; i += tileSize) {
+                for (int j = 0; j < cols; j += tileSize) {
+                    SurfaceTile tile;
+                    tile.row0 = row0 + i;
+                    tile.col0 = j;
+                    tile.rows = std::min(tileSize, bandRows - i);
+                    tile.cols = std::min(tileSize, cols - j);
+                    tile.stride = cols;
+                    tile.values = &band[(size_t) i * cols + j];
+                    sink->tile(tile);
+                }
+            }
+        }
+    }
+
+    if (sink) sink->end();
+    return best.match;
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#ifndef __AREALCORRELATION_H__
+#define __AREALCORRELATION_H__
+
+#include <cstddef>
+#include <vector>
+
+class SurfaceSink;
+
+/**
+ * A rectangle of depths with a weight per sample, row-major.
+ * A weight of 0 leaves the sample out (a masked point); 1 is a full
+ * sample, and anything in between counts for that much.
+ */
+struct ArealImage {
+    int width;
+    int height;
+    std::vector<float> values;  ///< height x width.
+    std::vector<float> weights; ///< height x width, or empty if every sample weighs 1.
+
+    ArealImage() : width(0), height(0) {}
+    ArealImage(int width, int height) :
+        width(width), height(height), values((size_t) width * height, 0.0f) {}
+
+    float weight(int row, int col) const { return weights.empty() ? 1.0f : weights[(size_t) row * width + col]; }
+};
+
+/**
+ * A trace made into a band bandWidth columns wide: every column of the
+ * band is the trace, down the rows. A striated mark looks like this
+ * with the striations running across; valid (nonzero where valid, may
+ * be null) becomes the weights.
+ */
+ArealImage extrudedTrace(const float* trace, const unsigned char* valid, int length, int bandWidth);
+
+/**
+ * Where arealCorrelation() placed the mark best: its top left corner
+ * at (row, col) of the region, with correlation cor.
+ */
+struct ArealMatch {
+    double cor;
+    int row;
+    int col;
+
+    ArealMatch() : cor(-1000000.0), row(-1), col(-1) {}
+    bool found() const { return row >= 0; }
+};
+
+/**
+ * Normalized cross-correlation of mark with every placement of it
+ * inside region, with the weights of both as weights: at each
+ * placement, r is the weighted correlation of the overlapping samples,
+ * each pair weighing the product of its two weights. A placement
+ * counts only if those products add up to at least minWeightFraction
+ * of the mark's own weight (and to 2 at least); r is NaN elsewhere.
+ *
+ * The sums for all placements come from FFTs, by the overlap-save
+ * method: region is cut into tiles whose placements share one FFT size,
+ * a bit over the mark's, and the tiles of a band are spread over
+ * numThreads threads (1 = serial, <= 0 = all cores). The result does
+ * not depend on the thread count. It matches a direct weighted
+ * correlation up to floating point rounding.
+ *
+ * sink, if not null, gets r for every placement, rows =
+ * region.height - mark.height + 1 by cols = region.width - mark.width + 1,
+ * in tileSize x tileSize tiles (see SurfaceSink); row0 and col0 are
+ * the corner of the mark in region.
+ *
+ * Returns the first best placement in (row, col) order; found() is
+ * false if no placement counts. Throws std::out_of_range if mark does
+ * not fit inside region.
+ */
+ArealMatch arealCorrelation(const ArealImage& mark,
+                            const ArealImage& region,
+                            int numThreads = 1,
+                            double minWeightFraction = 0.0,
+                            SurfaceSink* sink = 0,
+                            int tileSize = 128);
+
+#endif
@@ -0,0 +1,211 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#include "calibration.h"
+#include "../io/labeled.h"
+#include <algorithm>
+#include <cmath>
+#include <istream>
+#include <limits>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+///The finite values of v, sorted.
+static std::vector<double> finiteSorted(const std::vector<double>& v)
+{
+    std::vector<double> ret;
+    for (size_t i = 0; i < v.size(); ++i) {
+        if (v[i] == v[i] && std::fabs(v[i]) <= std::numeric_limits<double>::max()) ret.push_back(v[i]);
+    }
+    std::sort(ret.begin(), ret.end());
+    return ret;
+}
+
+///Silverman's rule of thumb for the bandwidth of a Gaussian KDE of sorted x.
+static double silverman(const std::vector<double>& x)
+{
+    const double n = x.size();
+    double mean = 0.0, var = 0.0;
+    for (size_t i = 0; i < x.size(); ++i) mean += x[i];
+    mean /= n;
+    for (size_t i = 0; i < x.size(); ++i) var += (x[i] - mean) * (x[i] - mean);
+    const double sd = std::sqrt(var / (n - 1));
+    const double iqr = x[(size_t) (0.75 * (n - 1))] - x[(size_t) (0.25 * (n - 1))];
+    double h = 0.9 * ((iqr > 0.0) ? std::min(sd, iqr / 1.34) : sd) * std::pow(n, -0.2);
+    //All the Ts alike: any narrow kernel will do.
+    if (!(h > 0.0)) h = 1e-3 * std::max(1.0, std::fabs(mean));
+    return h;
+}
+
+///Kernel density estimate of sorted x at every point of the grid.
+static std::vector<double> kde(const std::vector<double>& x, double h, double low, double step, int numPoints)
+{
+    const double pi = std::acos(-1.0);
+    const double norm = 1.0 / (x.size() * h * std::sqrt(2.0 * pi));
+    std::vector<double> f(numPoints, 0.0);
+    for (int p = 0; p < numPoints; ++p) {
+        const double t = low + p * step;
+        //Only the Ts within 8 bandwidths add anything.
+        std::vector<double>::const_iterator i = std::lower_bound(x.begin(), x.end(), t - 8.0 * h);
+        const std::vector<double>::const_iterator end = std::upper_bound(i, x.end(), t + 8.0 * h);
+        double sum = 0.0;
+        for (; i != end; ++i) {
+            const double z = (*i - t) / h;
+            sum += std::exp(-0.5 * z * z);
+        }
+        f[p] = sum * norm;
+    }
+    return f;
+}
+
+///Density of sorted x in each of numBins bins of width step from low.
+static std::vector<double> histogram(const std::vector<double>& x, double low, double step, int numBins)
+{
+    std::vector<double> f(numBins, 0.0);
+    for (size_t i = 0; i < x.size(); ++i) {
+        const int bin = std::min(numBins - 1, std::max(0, (int) std::floor((x[i] - low) / step)));
+        f[bin] += 1.0;
+    }
+    for (int b = 0; b < numBins; ++b) f[b] /= x.size() * step;
+    return f;
+}
+
+ScoreCalibration::ScoreCalibration() :
+    _method(Kde),
+    _low(0.0),
+    _step(1.0),
+    _numMatches(0),
+    _numNonMatches(0)
+{
+}
+
+ScoreCalibration::ScoreCalibration(const std::vector<double>& matches,
+                                   const std::vector<double>& nonMatches,
+                                   Method method,
+                                   int numPoints,
+                                   double bandwidth) :
+    _method(method)
+{
+    const std::vector<double> m = finiteSorted(matches);
+    const std::vector<double> nm = finiteSorted(nonMatches);
+    if (m.size() < 2 || nm.size() < 2) {
+        std::ostringstream what;
+        what << "need at least 2 Ts of each class: [matches=" << m.size()
+             << ", nonMatches=" << nm.size() << "]";
+        throw std::invalid_argument(what.str());
+    }
+    _numMatches = (int) m.size();
+    _numNonMatches = (int) nm.size();
+    numPoints = std::max(numPoints, 2);
+
+    const double hMatch = (bandwidth > 0.0) ? bandwidth : silverman(m);
+    const double hNonMatch = (bandwidth > 0.0) ? bandwidth : silverman(nm);
+    //Just the Ts seen: past them, the LR stays what it is at the last one.
+    double low = std::min(m.front(), nm.front());
+    double high = std::max(m.back(), nm.back());
+    if (!(high > low)) {
+        const double pad = 1e-6 * std::max(1.0, std::fabs(low));
+        low -= pad;
+        high += pad;
+    }
+    _low = low;
+
+    if (Kde == method) {
+        _step = (high - low) / (numPoints - 1);
+        _match = kde(m, hMatch, low, _step, numPoints);
+        _nonMatch = kde(nm, hNonMatch, low, _step, numPoints);
+    }
+    else {
+        _step = (high - low) / numPoints;
+        _match = histogram(m, low, _step, numPoints);
+        _nonMatch = histogram(nm, low, _step, numPoints);
+    }
+
+    const double floorMatch = 0.5 / (_numMatches * (high - low));
+    const double floorNonMatch = 0.5 / (_numNonMatches * (high - low));
+    for (int p = 0; p < numPoints; ++p) {
+        _match[p] = std::max(_match[p], floorMatch);
+        _nonMatch[p] = std::max(_nonMatch[p], floorNonMatch);
+    }
+}
+
+double ScoreCalibration::high() const
+{
+    return _low + _step * ((Kde == _method) ? numPoints() - 1 : numPoints());
+}
+
+double ScoreCalibration::likelihoodRatio(double t) const
+{
+    if (!calibrated() || t != t) return 0.0;
+    const int last = numPoints() - 1;
+    const double x = std::min(std::max((t - _low) / _step, 0.0), (double) last);
+    if (Binned == _method) {
+        const int bin = std::min((int) x, last);
+        return _match[bin] / _nonMatch[bin];
+    }
+    const int p = std::min((int) x, last - 1);
+    const double f = x - p;
+    return (_match[p] + f * (_match[p + 1] - _match[p])) /
+           (_nonMatch[p] + f * (_nonMatch[p + 1] - _nonMatch[p]));
+}
+
+void ScoreCalibration::write(std::ostream& out) const
+{
+    const std::streamsize precision = out.precision(17);
+    out << "calibration.method: " << ((Kde == _method) ? "kde" : "binned") << '\n';
+    out << "calibration.points: " << numPoints() << '\n';
+    out << "calibration.low: " << _low << '\n';
+    out << "calibration.step: " << _step << '\n';
+    out << "calibration.matches: " << _numMatches << '\n';
+    out << "calibration.nonmatches: " << _numNonMatches << '\n';
+    for (int p = 0; p < numPoints(); ++p)
+        out << _match[p] << " \t " << _nonMatch[p] << '\n';
+    out.precision(precision);
+}
+
+ScoreCalibration ScoreCalibration::read(std::istream& in)
+{
+    ScoreCalibration ret;
+    std::string method;
+    int numPoints = 0;
+    readLabeledValue(in, "calibration.method:", method);
+    readLabeledValue(in, "calibration.points:", numPoints);
+    readLabeledValue(in, "calibration.low:", ret._low);
+    readLabeledValue(in, "calibration.step:", ret._step);
+    readLabeledValue(in, "calibration.matches:", ret._numMatches);
+    readLabeledValue(in, "calibration.nonmatches:", ret._numNonMatches);
+    if ((method != "kde" && method != "binned") || numPoints < 2 || !(ret._step > 0.0))
+        throw std::runtime_error("Not a calibration: bad method, points or step");
+    ret._method = (method == "kde") ? Kde : Binned;
+
+    ret._match.resize(numPoints);
+    ret._nonMatch.resize(numPoints);
+    for (int p = 0; p < numPoints; ++p) {
+        if (!(in >> ret._match[p] >> ret._nonMatch[p]) || !(ret._match[p] > 0.0) || !(ret._nonMatch[p] > 0.0))
+            throw std::runtime_error("Could not read the densities of a calibration");
+    }
+    return ret;
+}
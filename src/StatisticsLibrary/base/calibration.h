@@ -0,0 +1,99 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#ifndef __CALIBRATION_H__
+#define __CALIBRATION_H__
+
+#include <iosfwd>
+#include <vector>
+
+/**
+ * Turns a T value into a likelihood ratio,
+ *   LR(T) = f_match(T) / f_nonmatch(T),
+ * how much likelier a T this size is for a known match than for a
+ * known non-match, from the Ts of a reference run whose ground truth
+ * is known.
+ *
+ * Both densities are tabulated once, on one grid of numPoints points
+ * from the lowest reference T to the highest, so an LR is a lookup
+ * however large the reference run was. Binned keeps a histogram
+ * with a bin per point. Kde keeps a Gaussian kernel density estimate
+ * at each point, interpolated linearly in between.
+ *
+ * Neither density is let below half a reference T spread over the
+ * whole range, so the LR stays finite where one class was never seen.
+ * A T outside the range counts as the nearest end of it, so the LR
+ * of a T above every reference T is that of the highest one.
+ */
+class ScoreCalibration {
+  public:
+    enum Method {
+        Binned = 0,
+        Kde = 1
+    };
+
+    ///Not calibrated: likelihoodRatio() is 0.
+    ScoreCalibration();
+
+    /**
+     * From the Ts of known matches and known non-matches; values that
+     * are not finite are skipped. numPoints is at least 2. bandwidth is
+     * the kernel's standard deviation for Kde; <= 0 picks one for each
+     * class by Silverman's rule. Throws std::invalid_argument if either
+     * class has fewer than 2 Ts.
+     */
+    ScoreCalibration(const std::vector<double>& matches,
+                     const std::vector<double>& nonMatches,
+                     Method method = Kde,
+                     int numPoints = 256,
+                     double bandwidth = 0.0);
+
+    bool calibrated() const { return !_match.empty(); }
+    Method method() const { return _method; }
+    int numPoints() const { return (int) _match.size(); }
+    int numMatches() const { return _numMatches; }
+    int numNonMatches() const { return _numNonMatches; }
+    ///The range of T the tables cover.
+    double low() const { return _low; }
+    double high() const;
+
+    ///LR of t; 0 if not calibrated.
+    double likelihoodRatio(double t) const;
+
+    ///The tables as labeled text, for read().
+    void write(std::ostream& out) const;
+    ///What write() wrote. Throws std::runtime_error if it cannot be read.
+    static ScoreCalibration read(std::istream& in);
+
+  private:
+    Method _method;
+    double _low;
+    double _step;
+    int _numMatches;
+    int _numNonMatches;
+    std::vector<double> _match;    ///< f_match at each point, or of each bin.
+    std::vector<double> _nonMatch; ///< f_nonmatch likewise.
+};
+
+#endif
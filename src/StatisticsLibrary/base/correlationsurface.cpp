@@ -0,0 +1,127 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#include "correlationsurface.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+SurfaceFileWriter::SurfaceFileWriter(const std::string& fileName, bool halfFloat) :
+    _out(fileName.c_str(), std::ios::out | std::ios::binary | std::ios::trunc),
+    _half(halfFloat)
+{
+}
+
+void SurfaceFileWriter::begin(int rows, int cols, int tileSize)
+{
+    const int header[6] = {1, _half ? 2 : 4, rows, cols, tileSize, 0};
+    _out.write("MCORSURF", 8);
+    _out.write((const char*) header, sizeof(header));
+}
+
+void SurfaceFileWriter::tile(const SurfaceTile& t)
+{
+    for (int i = 0; i < t.rows; ++i) {
+        const float* row = t.values + i * t.stride;
+        if (!_half) {
+            _out.write((const char*) row, t.cols * sizeof(float));
+            continue;
+        }
+        _buffer.resize(t.cols);
+        for (int j = 0; j < t.cols; ++j)
+            _buffer[j] = toHalf(row[j]);
+        _out.write((const char*) &_buffer[0], t.cols * sizeof(unsigned short));
+    }
+}
+
+void SurfaceFileWriter::end()
+{
+    _out.flush();
+}
+
+unsigned short SurfaceFileWriter::toHalf(float value)
+{
+    unsigned int bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const unsigned short sign = (bits >> 16) & 0x8000;
+    const int exponent = (bits >> 23) & 0xff;
+    unsigned int mantissa = bits & 0x7fffff;
+
+    //Inf stays inf, NaN stays (quiet) NaN.
+    if (exponent == 0xff)
+        return sign | 0x7c00 | (mantissa ? 0x200 | (mantissa >> 13) : 0);
+
+    const int e = exponent - 127 + 15;
+    if (e >= 31) return sign | 0x7c00;
+    if (e <= 0) {
+        //Subnormal in half, or zero.
+        if (e < -10) return sign;
+        mantissa |= 0x800000;
+        const int shift = 14 - e;
+        unsigned int half = mantissa >> shift;
+        const unsigned int rest = mantissa & ((1u << shift) - 1);
+        const unsigned int halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) ++half;
+        return sign | half;
+    }
+
+    //A carry out of the mantissa rounds up into the exponent, as it should.
+    unsigned int half = (e << 10) | (mantissa >> 13);
+    const unsigned int rest = mantissa & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) ++half;
+    return sign | half;
+}
+
+SurfaceHeatMap::SurfaceHeatMap(int width, int height) :
+    _width(std::max(width, 1)),
+    _height(std::max(height, 1))
+{
+}
+
+void SurfaceHeatMap::begin(int rows, int cols, int tileSize)
+{
+    (void) tileSize;
+    _bins.assign((size_t) _width * _height, std::numeric_limits<float>::quiet_NaN());
+    _rowBin.resize(rows);
+    for (int i = 0; i < rows; ++i)
+        _rowBin[i] = (int) ((long long) i * _height / rows);
+    _colBin.resize(cols);
+    for (int j = 0; j < cols; ++j)
+        _colBin[j] = (int) ((long long) j * _width / cols);
+}
+
+void SurfaceHeatMap::tile(const SurfaceTile& t)
+{
+    for (int i = 0; i < t.rows; ++i) {
+        float* binRow = &_bins[(size_t) _rowBin[t.row0 + i] * _width];
+        const int* colBin = &_colBin[t.col0];
+        for (int j = 0; j < t.cols; ++j) {
+            const float r = t.at(i, j);
+            float& bin = binRow[colBin[j]];
+            //NaN compares false both ways, so undefined r never wins
+            //and an empty bin takes the first defined one.
+            if (r == r && !(bin >= r)) bin = r;
+        }
+    }
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#ifndef __CORRELATIONSURFACE_H__
+#define __CORRELATIONSURFACE_H__
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * A tileSize x tileSize (or smaller, at the edges) piece of the
+ * correlation surface of MaxCorrelationWithFlips::surface(): the
+ * signed correlation r of the window at loc1 in trace 1 and the one at
+ * loc2 in trace 2, for loc1 in [row0, row0 + rows) and loc2 in
+ * [col0, col0 + cols). NaN where r is undefined (a constant window, or
+ * too few valid samples in a masked pair).
+ */
+struct SurfaceTile {
+    int row0;
+    int col0;
+    int rows;
+    int cols;
+    int stride;          ///< Floats from one row to the next.
+    const float* values; ///< Row-major; only valid during SurfaceSink::tile().
+
+    float at(int i, int j) const { return values[i * stride + j]; }
+};
+
+/**
+ * Where MaxCorrelationWithFlips::surface() sends its tiles. The tiles
+ * come in bands of tileSize rows, top to bottom, and left to right in
+ * each band, all on the calling thread. arealCorrelation() sends the
+ * r of its placements the same way.
+ */
+class SurfaceSink {
+  public:
+    virtual ~SurfaceSink() {}
+
+    ///Called once before the first tile.
+    virtual void begin(int rows, int cols, int tileSize) { (void) rows; (void) cols; (void) tileSize; }
+    virtual void tile(const SurfaceTile& t) = 0;
+    ///Called once after the last tile.
+    virtual void end() {}
+};
+
+/**
+ * Writes the surface to a binary file as it comes.
+ *
+ * The file starts with a 32 byte header: the 8 characters "MCORSURF",
+ * then 6 ints of the machine's byte order: format version (1), bytes
+ * per value (4 for float32, 2 for IEEE float16), rows, cols, tileSize,
+ * and 0. The tiles follow in the order they were computed, each one
+ * rows x cols values row-major with no padding, so the tile at band b
+ * and column c starts after every full band above it and the c tiles
+ * to its left.
+ */
+class SurfaceFileWriter : public SurfaceSink {
+  public:
+    ///Opens fileName for writing; ok() says whether that worked.
+    explicit SurfaceFileWriter(const std::string& fileName, bool halfFloat = false);
+
+    bool ok() const { return _out.good(); }
+
+    virtual void begin(int rows, int cols, int tileSize);
+    virtual void tile(const SurfaceTile& t);
+    virtual void end();
+
+    ///value as an IEEE half, rounded to nearest even.
+    static unsigned short toHalf(float value);
+
+  private:
+    std::ofstream _out;
+    bool _half;
+    std::vector<unsigned short> _buffer;
+};
+
+/**
+ * Shrinks the surface to width x height bins on the fly, keeping the
+ * largest r that falls in each bin so that narrow peaks still show.
+ * Bins nothing defined fell in are NaN.
+ */
+class SurfaceHeatMap : public SurfaceSink {
+  public:
+    SurfaceHeatMap(int width, int height);
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+    ///height x width, row-major; row i covers loc1 of about i * rows / height.
+    const std::vector<float>& bins() const { return _bins; }
+
+    virtual void begin(int rows, int cols, int tileSize);
+    virtual void tile(const SurfaceTile& t);
+
+  private:
+    int _width;
+    int _height;
+    std::vector<int> _rowBin;
+    std::vector<int> _colBin;
+    std::vector<float> _bins;
+};
+
+#endif
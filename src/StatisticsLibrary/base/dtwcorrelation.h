@@ -0,0 +1,500 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#ifndef __DTWCORRELATION_H__
+#define __DTWCORRELATION_H__
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+#include "FlippableCorLoc.h"
+#include "parallel.h"
+#include "sampletraits.h"
+#include "simd.h"
+
+/**
+ * Elastic alternative to the rigid search of MaxCorrelationWithFlips,
+ * for marks that are a little stretched or compressed along the trace.
+ *
+ * A window pair is scored by dynamic time warping: both windows are
+ * standardized (mean 0, variance 1), and D is the smallest sum of
+ * squared differences along a monotone path from their first samples
+ * to their last ones that stays within band samples of the diagonal
+ * (a Sakoe-Chiba band). The score is
+ *   r = 1 - D / (2 * window),
+ * which is exactly the correlation of the windows for band 0 (the
+ * squared distance of two standardized windows is 2 * window * (1 - r)),
+ * and at least that for any band, as the straight path is one of those
+ * allowed. It is at most 1.
+ *
+ * The search is not exhaustive: every window of trace 2 the leash
+ * allows is scored against the windows of trace 1 every stride samples
+ * (a quarter of the window by default), and the best few are then
+ * refined at every loc1 within a stride, following the same diagonal
+ * within the band. Flips are not looked at.
+ *
+ * In masked traces (see TraceView) each masked sample is bridged by
+ * the straight line between the valid samples around it, so it adds
+ * no shape of its own, and a window counts only if it has minValid
+ * valid samples (at least 2), as in MaxCorrelationWithFlips.
+ *
+ * D is computed one anti-diagonal (i + j constant) at a time. The cells
+ * of an anti-diagonal do not depend on each other, only on the two
+ * before, so antiDiagonal() fills 4 (AVX) or 2 (SSE2) of them per
+ * instruction, picked by simdLevel() as for ShiftKernel. Window b is
+ * kept back to front so both windows are read forward. Only three
+ * anti-diagonals of at most band + 1 cells are kept. A pair is dropped
+ * as soon as the smallest D on two consecutive anti-diagonals, a lower
+ * bound of the final one, can no longer beat the best so far. The
+ * vector and scalar versions give the same D, bit for bit.
+ */
+template <typename RandomAccessIter>
+class DtwCorrelation {
+  private:
+    typedef typename std::iterator_traits<RandomAccessIter>::value_type Sample;
+
+  public:
+    /**
+     * band -- how far the path may stray from the diagonal, in samples.
+     * numThreads -- 1 = serial, <= 0 = all cores.
+     * stride -- loc1 step of the first pass; 0 for a quarter window.
+     * minValid -- for masked traces, as for MaxCorrelationWithFlips.
+     */
+    explicit DtwCorrelation(int band = 8, int numThreads = 1, int stride = 0, int minValid = 0) :
+        _band(std::max(band, 0)),
+        _numThreads(numThreads),
+        _stride(stride),
+        _minValid(minValid)
+    {
+    }
+
+    ///The best window pair found; cor() is r above.
+    FlippableCorLoc operator()(RandomAccessIter y1,
+                               RandomAccessIter y2,
+                               int length1,
+                               int length2,
+                               int window,
+                               float maxShiftPercentage) const
+    {
+        return peaks(y1, y2, length1, length2, window, maxShiftPercentage, 1)[0];
+    }
+
+    /**
+     * The best k distinct window pairs, best first, as
+     * PyramidCorrelation::peaks() gives them. At least one; throws
+     * std::range_error if no window pair counts.
+     */
+    std::vector<FlippableCorLoc> peaks(RandomAccessIter y1,
+                                       RandomAccessIter y2,
+                                       int length1,
+                                       int length2,
+                                       int window,
+                                       float maxShiftPercentage,
+                                       int k) const
+    {
+        return search(y1, 0, length1, y2, 0, length2, window, maxShiftPercentage, k);
+    }
+
+    ///As above, for traces that may be masked.
+    std::vector<FlippableCorLoc> peaks(const TraceView<Sample>& y1,
+                                       const TraceView<Sample>& y2,
+                                       int window,
+                                       float maxShiftPercentage,
+                                       int k) const
+    {
+        return search(y1.begin(), y1.valid(), (int) y1.size(),
+                      y2.begin(), y2.valid(), (int) y2.size(), window, maxShiftPercentage, k);
+    }
+
+    /**
+     * D of the standardized windows a and b of length window, with b
+     * given back to front (bReversed[j] is b[window - 1 - j]). Gives
+     * up and returns infinity once D is sure to be at least limit.
+     * prev2, prev1 and cur need band + 3 doubles each.
+     */
+    static double distance(const double* a, const double* bReversed, int window, int band, double limit,
+                           double* prev2, double* prev1, double* cur)
+    {
+        const double inf = std::numeric_limits<double>::infinity();
+        const SimdLevel level = simdLevel();
+        std::fill(prev2, prev2 + band + 3, inf);
+        std::fill(prev1, prev1 + band + 3, inf);
+        //Anti-diagonal k holds the cells i in [lo, hi], j = k - i, at
+        //cur[i - lo + 1]; cur[0] and cur[hi - lo + 2] are infinity.
+        int lo1 = 0, lo2 = 0; //lo of the last two anti-diagonals
+        double rowMin1 = inf;
+        const int last = 2 * (window - 1);
+        for (int k = 0; k <= last; ++k) {
+            const int lo = std::max(std::max(0, k - (window - 1)), (k - band + 1) / 2);
+            const int hi = std::min(std::min(window - 1, k), (k + band) / 2);
+            const int count = hi - lo + 1;
+            double rowMin;
+            if (k == 0) {
+                const double d = a[0] - bReversed[window - 1];
+                cur[1] = d * d;
+                rowMin = cur[1];
+            }
+            else {
+                //(i - 1, j) and (i, j - 1) on k - 1, (i - 1, j - 1) on k - 2;
+                //b[k - i] for i = lo, lo + 1, ... is read forward.
+                rowMin = antiDiagonal(level, a + lo, bReversed + (window - 1 - k + lo),
+                                      prev1 + (lo - lo1), prev2 + (lo - lo2), cur + 1, count);
+            }
+            cur[0] = inf;
+            cur[count + 1] = inf;
+
+            //Every path crosses k - 1 or k.
+            if (std::min(rowMin, rowMin1) >= limit) return inf;
+            rowMin1 = rowMin;
+
+            double* t = prev2;
+            prev2 = prev1;
+            prev1 = cur;
+            cur = t;
+            lo2 = lo1;
+            lo1 = lo;
+        }
+        return prev1[1];
+    }
+
+  private:
+    /**
+     * out[p] = (a[p] - b[p])^2 + min(diag[p], up[p], up[p + 1]) for p in
+     * [0, count); returns the smallest out[p].
+     */
+    static double antiDiagonal(SimdLevel level, const double* a, const double* b,
+                               const double* up, const double* diag, double* out, int count)
+    {
+        switch (level) {
+#if defined(SIMD_AVX2)
+          case Simd_Avx2:
+            return antiDiagonalAvx(a, b, up, diag, out, count);
+#endif
+#if defined(SIMD_SSE41)
+          case Simd_Sse41:
+            return antiDiagonalSse2(a, b, up, diag, out, count);
+#endif
+          default:
+            return antiDiagonalScalar(a, b, up, diag, out, 0, count,
+                                      std::numeric_limits<double>::infinity());
+        }
+    }
+
+    ///antiDiagonal() for p in [begin, count), min taken with rowMin.
+    static double antiDiagonalScalar(const double* a, const double* b, const double* up,
+                                     const double* diag, double* out, int begin, int count,
+                                     double rowMin)
+    {
+        for (int p = begin; p < count; ++p) {
+            const double d = a[p] - b[p];
+            const double m1 = (up[p] < up[p + 1]) ? up[p] : up[p + 1];
+            const double m = (diag[p] < m1) ? diag[p] : m1;
+            out[p] = d * d + m;
+            rowMin = (out[p] < rowMin) ? out[p] : rowMin;
+        }
+        return rowMin;
+    }
+
+    //min_pd(x, y) is (x < y) ? x : y, as in the scalar version.
+#if defined(SIMD_AVX2)
+    SIMD_TARGET("avx")
+    static double antiDiagonalAvx(const double* a, const double* b, const double* up,
+                                  const double* diag, double* out, int count)
+    {
+        __m256d rowMin = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+        int p = 0;
+        for (; p + 4 <= count; p += 4) {
+            const __m256d d = _mm256_sub_pd(_mm256_loadu_pd(a + p), _mm256_loadu_pd(b + p));
+            const __m256d m1 = _mm256_min_pd(_mm256_loadu_pd(up + p), _mm256_loadu_pd(up + p + 1));
+            const __m256d m = _mm256_min_pd(_mm256_loadu_pd(diag + p), m1);
+            const __m256d cell = _mm256_add_pd(_mm256_mul_pd(d, d), m);
+            _mm256_storeu_pd(out + p, cell);
+            rowMin = _mm256_min_pd(cell, rowMin);
+        }
+        const __m128d half = _mm_min_pd(_mm256_castpd256_pd128(rowMin), _mm256_extractf128_pd(rowMin, 1));
+        const __m128d both = _mm_min_sd(half, _mm_unpackhi_pd(half, half));
+        return antiDiagonalScalar(a, b, up, diag, out, p, count, _mm_cvtsd_f64(both));
+    }
+#endif
+
+#if defined(SIMD_SSE41)
+    SIMD_TARGET("sse2")
+    static double antiDiagonalSse2(const double* a, const double* b, const double* up,
+                                   const double* diag, double* out, int count)
+    {
+        __m128d rowMin = _mm_set1_pd(std::numeric_limits<double>::infinity());
+        int p = 0;
+        for (; p + 2 <= count; p += 2) {
+            const __m128d d = _mm_sub_pd(_mm_loadu_pd(a + p), _mm_loadu_pd(b + p));
+            const __m128d m1 = _mm_min_pd(_mm_loadu_pd(up + p), _mm_loadu_pd(up + p + 1));
+            const __m128d m = _mm_min_pd(_mm_loadu_pd(diag + p), m1);
+            const __m128d cell = _mm_add_pd(_mm_mul_pd(d, d), m);
+            _mm_storeu_pd(out + p, cell);
+            rowMin = _mm_min_pd(cell, rowMin);
+        }
+        const __m128d both = _mm_min_sd(rowMin, _mm_unpackhi_pd(rowMin, rowMin));
+        return antiDiagonalScalar(a, b, up, diag, out, p, count, _mm_cvtsd_f64(both));
+    }
+#endif
+
+    template <typename Iter>
+    std::vector<FlippableCorLoc> search(Iter y1,
+                                        const unsigned char* v1,
+                                        int length1,
+                                        Iter y2,
+                                        const unsigned char* v2,
+                                        int length2,
+                                        int window,
+                                        float maxShiftPercentage,
+                                        int k) const
+    {
+        if (length1 < 0 || length2 < 0 || window <= 0 || window > length1 || window > length2) {
+            std::ostringstream what;
+            what << "window not in [1, length1] and [1, length2]: [window=" << window
+                 << ", length1=" << length1 << ", length2=" << length2 << "]";
+            throw std::out_of_range(what.str());
+        }
+
+        const int minValid = std::max(_minValid, 2);
+        const Windows w1(y1, v1, length1, window, minValid);
+        const Windows w2(y2, v2, length2, window, minValid);
+        const int band = std::min(_band, window - 1);
+        const int stride = (_stride > 0) ? _stride : std::max(1, window / 4);
+        //As in maxCorVaryingSecond(), for either trace shifted right.
+        const int maxShift2 = maxShiftPercentage * (length2 - window);
+        const int maxShift1 = maxShiftPercentage * (length1 - window);
+
+        //First pass: the best loc2 for every stride-th loc1, and the last one.
+        std::vector<int> rows;
+        for (int loc1 = 0; loc1 <= length1 - window; loc1 += stride) rows.push_back(loc1);
+        if (rows.back() != length1 - window) rows.push_back(length1 - window);
+        std::vector<Loc> rowBest(rows.size());
+        parallelFor((int) rows.size(), _numThreads, [&](int r) {
+            Scratch s(window, band);
+            Loc& best = rowBest[r];
+            best.loc1 = rows[r];
+            if (w1.skipped(rows[r])) return;
+            const int begin2 = std::max(0, rows[r] - maxShift1);
+            const int end2 = std::min(length2 - window, rows[r] + maxShift2);
+            w1.standardized(rows[r], s.a);
+            for (int loc2 = begin2; loc2 <= end2; ++loc2)
+                offer(best, w2, rows[r], loc2, window, band, s);
+        });
+
+        //Follow the best rows down to every loc1 around them.
+        std::vector<Loc> order;
+        for (size_t r = 0; r < rowBest.size(); ++r) {
+            if (rowBest[r].loc2 < 0) continue;
+            size_t pos = 0;
+            while (pos < order.size() && !(rowBest[r].distance < order[pos].distance)) ++pos;
+            order.insert(order.begin() + pos, rowBest[r]);
+        }
+        const int numFollowed = std::min((int) order.size(), std::max(k, 4));
+        std::vector<Loc> refined(numFollowed);
+        parallelFor(numFollowed, _numThreads, [&](int c) {
+            Scratch s(window, band);
+            Loc best = order[c];
+            for (int loc1 = std::max(0, order[c].loc1 - stride + 1);
+                 loc1 <= std::min(length1 - window, order[c].loc1 + stride - 1); ++loc1) {
+                if (loc1 == order[c].loc1 || w1.skipped(loc1)) continue;
+                w1.standardized(loc1, s.a);
+                const int center2 = order[c].loc2 + (loc1 - order[c].loc1);
+                for (int loc2 = std::max(0, center2 - band); loc2 <= std::min(length2 - window, center2 + band); ++loc2) {
+                    const int shift = loc2 - loc1;
+                    if (shift >= 0 ? shift > maxShift2 : -shift > maxShift1) continue;
+                    offer(best, w2, loc1, loc2, window, band, s);
+                }
+            }
+            refined[c] = best;
+        });
+
+        //Stable: equal values keep the order of the rows.
+        std::vector<Loc> found;
+        for (size_t i = 0; i < refined.size(); ++i) {
+            bool seen = false;
+            for (size_t j = 0; j < found.size(); ++j) {
+                if (found[j].loc1 == refined[i].loc1 && found[j].loc2 == refined[i].loc2) seen = true;
+            }
+            if (seen) continue;
+            size_t pos = 0;
+            while (pos < found.size() && !(refined[i].distance < found[pos].distance)) ++pos;
+            found.insert(found.begin() + pos, refined[i]);
+        }
+
+        if (found.empty()) {
+            std::ostringstream what;
+            what << "no window pair of the elastic search has " << minValid
+                 << " valid samples and some variance in both traces: [window=" << window << "]";
+            throw std::range_error(what.str());
+        }
+
+        std::vector<FlippableCorLoc> ret;
+        for (size_t i = 0; i < found.size() && (int) i < std::max(k, 1); ++i)
+            ret.push_back(FlippableCorLoc(1.0 - found[i].distance / (2.0 * window), found[i].loc1, found[i].loc2, false));
+        return ret;
+    }
+
+    ///A window pair and its D.
+    struct Loc {
+        int loc1;
+        int loc2;
+        double distance;
+
+        Loc() : loc1(-1), loc2(-1), distance(std::numeric_limits<double>::infinity()) {}
+    };
+
+    ///The standardized windows (b back to front) and anti-diagonals of one thread.
+    struct Scratch {
+        std::vector<double> a;
+        std::vector<double> b;
+        std::vector<double> diagonals;
+
+        Scratch(int window, int band) : a(window), b(window), diagonals(3 * (band + 3)) {}
+    };
+
+    /**
+     * A trace with its masked samples bridged (see above), and the
+     * mean and 1 / standard deviation of every window of it.
+     */
+    class Windows {
+      public:
+        template <typename Iter>
+        Windows(Iter y, const unsigned char* valid, int length, int window, int minValid) :
+            _y(y, y + length),
+            _window(window)
+        {
+            std::vector<int> numValid(length + 1, 0);
+            if (valid) {
+                //Each run of masked samples between valid ones at before
+                //and i; a run at either end takes the one valid neighbour.
+                int before = -1;
+                for (int i = 0; i <= length; ++i) {
+                    if (i < length && !valid[i]) continue;
+                    for (int j = before + 1; j < i; ++j) {
+                        if (before >= 0 && i < length)
+                            _y[j] = _y[before] + (_y[i] - _y[before]) * (j - before) / (i - before);
+                        else if (before >= 0)
+                            _y[j] = _y[before];
+                        else if (i < length)
+                            _y[j] = _y[i];
+                    }
+                    before = i;
+                }
+                for (int i = 0; i < length; ++i) numValid[i + 1] = numValid[i] + (valid[i] ? 1 : 0);
+            }
+
+            std::vector<double> sum(length + 1, 0.0), sqSum(length + 1, 0.0);
+            for (int i = 0; i < length; ++i) {
+                const double v = _y[i];
+                sum[i + 1] = sum[i] + v;
+                sqSum[i + 1] = sqSum[i] + v * v;
+            }
+            const int numWindows = length - window + 1;
+            _mean.resize(numWindows);
+            _scale.resize(numWindows);
+            for (int l = 0; l < numWindows; ++l) {
+                const double mean = (sum[l + window] - sum[l]) / window;
+                const double var = (sqSum[l + window] - sqSum[l]) / window - mean * mean;
+                _mean[l] = mean;
+                //A constant window has no shape to match, and one with too
+                //few valid samples no shape to trust; both are skipped.
+                const bool enough = !valid || numValid[l + window] - numValid[l] >= minValid;
+                _scale[l] = (enough && var > 1e-12 * (mean * mean + 1.0)) ? 1.0 / std::sqrt(var) : 0.0;
+            }
+        }
+
+        bool skipped(int loc) const { return _scale[loc] == 0.0; }
+
+        ///The window at loc with mean 0 and variance 1, into out.
+        void standardized(int loc, std::vector<double>& out) const
+        {
+            for (int j = 0; j < _window; ++j)
+                out[j] = (_y[loc + j] - _mean[loc]) * _scale[loc];
+        }
+
+        ///As standardized(), back to front.
+        void standardizedReversed(int loc, std::vector<double>& out) const
+        {
+            for (int j = 0; j < _window; ++j)
+                out[_window - 1 - j] = (_y[loc + j] - _mean[loc]) * _scale[loc];
+        }
+
+      private:
+        std::vector<double> _y;
+        int _window;
+        std::vector<double> _mean;
+        std::vector<double> _scale;
+    };
+
+    ///Scores (loc1, loc2) against best, s.a already holding window loc1.
+    static void offer(Loc& best, const Windows& w2, int loc1, int loc2, int window, int band, Scratch& s)
+    {
+        if (w2.skipped(loc2)) return;
+        w2.standardizedReversed(loc2, s.b);
+        double* d = s.diagonals.data();
+        const int size = band + 3;
+        const double D = distance(s.a.data(), s.b.data(), window, band, best.distance,
+                                  d, d + size, d + 2 * size);
+        if (D < best.distance) {
+            best.loc1 = loc1;
+            best.loc2 = loc2;
+            best.distance = D;
+        }
+    }
+
+    int _band;
+    int _numThreads;
+    int _stride;
+    int _minValid;
+};
+
+/**
+ * Convenience function for DtwCorrelation::peaks().
+ */
+template<typename RandomAccessIter>
+std::vector<FlippableCorLoc> maxCorDtwPeaks(RandomAccessIter y1, RandomAccessIter y2,
+    int length1, int length2, int window, float maxShiftPercentage, int k,
+    int band = 8, int numThreads = 1)
+{
+    return DtwCorrelation<RandomAccessIter>(band, numThreads).peaks(
+        y1, y2, length1, length2, window, maxShiftPercentage, k);
+}
+
+/**
+ * maxCorDtwPeaks() on two traces left where they are. If they are
+ * masked, minValid is as for MaxCorrelationWithFlips().
+ */
+template<typename Sample>
+std::vector<FlippableCorLoc> maxCorDtwPeaks(const TraceView<Sample>& y1, const TraceView<Sample>& y2,
+    int window, float maxShiftPercentage, int k, int band = 8, int numThreads = 1, int minValid = 0)
+{
+    return DtwCorrelation<const Sample*>(band, numThreads, 0, minValid).peaks(
+        y1, y2, window, maxShiftPercentage, k);
+}
+
+#endif
@@ -0,0 +1,377 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#ifndef __FFTCORRELATION_H__
+#define __FFTCORRELATION_H__
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <complex>
+#include <cstdlib>
+#include <vector>
+#include "corloc.h"
+#include "parallel.h"
+
+/**
+ * Fast engine for maxCorrelation() and leveledMaxCorrelation()
+ * from intcorrelation.h.
+ *
+ * Every pair (loc1, loc2) lies on a diagonal d = loc2 - loc1. The first
+ * window dot product of every diagonal comes out of one frequency-domain
+ * cross-correlation per direction, and the rest of the diagonal slides
+ * in O(1) per pair. Window sums, squared sums and the j-weighted sums the
+ * leveled version needs come from prefix sums. That is O(n^2) for all
+ * pairs instead of O(n^2 * window).
+ *
+ * The results keep the CorLoc semantics of the originals: the signed
+ * correlation of the first maximum in (loc1, loc2) order.
+ * fftMaxCorrelation() works in integers (the FFT outputs are rounded back
+ * to exact integers, or computed directly if the traces are too large for
+ * that to be safe) and gives exactly the same CorLoc as maxCorrelation().
+ * fftLeveledMaxCorrelation() uses closed-form sums for the line fits, so
+ * it matches leveledMaxCorrelation() up to floating point rounding.
+ */
+
+//=======================================================================
+//=======================================================================
+///In-place iterative radix-2 FFT; a.size() must be a power of 2.
+inline void fftRadix2(std::vector<std::complex<double> >& a, bool inverse)
+{
+    const size_t n = a.size();
+    for (size_t i = 1, j = 0; i < n; ++i) {
+        size_t bit = n >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) std::swap(a[i], a[j]);
+    }
+
+    const double pi = std::acos(-1.0);
+    for (size_t len = 2; len <= n; len <<= 1) {
+        const size_t half = len / 2;
+        const double angle = (inverse ? 2.0 : -2.0) * pi / len;
+        for (size_t k = 0; k < half; ++k) {
+            const std::complex<double> w = std::polar(1.0, angle * k);
+            for (size_t i = k; i < n; i += len) {
+                const std::complex<double> u = a[i];
+                const std::complex<double> v = a[i + half] * w;
+                a[i] = u + v;
+                a[i + half] = u - v;
+            }
+        }
+    }
+
+    if (inverse) {
+        for (size_t i = 0; i < n; ++i) a[i] /= (double) n;
+    }
+}
+
+//=======================================================================
+//=======================================================================
+/**
+ * c[d] = Sum(j=0,window-1) a[j] * b[d + j] for d in [0, lengthB - window],
+ * computed in the frequency domain.
+ */
+inline std::vector<double> fftCrossCorrelate(const int* a, const int* b, int window, int lengthB)
+{
+    size_t n = 1;
+    while (n < (size_t) (lengthB + window - 1)) n <<= 1;
+
+    //Both real inputs in one complex transform: z = a + i*b.
+    std::vector<std::complex<double> > z(n);
+    for (int j = 0; j < window; ++j) z[j] = std::complex<double>(a[j], 0.0);
+    for (int j = 0; j < lengthB; ++j) z[j] += std::complex<double>(0.0, b[j]);
+    fftRadix2(z, false);
+
+    //Separate A and B, then C = conj(A) * B.
+    std::vector<std::complex<double> > c(n);
+    for (size_t k = 0; k < n; ++k) {
+        const std::complex<double> zk = z[k];
+        const std::complex<double> zn = std::conj(z[(n - k) & (n - 1)]);
+        const std::complex<double> ak = 0.5 * (zk + zn);
+        const std::complex<double> bk = std::complex<double>(0.0, -0.5) * (zk - zn);
+        c[k] = std::conj(ak) * bk;
+    }
+    fftRadix2(c, true);
+
+    std::vector<double> ret(lengthB - window + 1);
+    for (size_t d = 0; d < ret.size(); ++d) ret[d] = c[d].real();
+    return ret;
+}
+
+/**
+ * Per-window sums of a trace, all exact integers.
+ */
+struct FftWindowSums {
+    std::vector<long long> sum;   ///< Sum(y)
+    std::vector<long long> sqSum; ///< Sum(y^2)
+    std::vector<long long> jSum;  ///< Sum(j * y), j the index within the window
+
+    FftWindowSums(const std::vector<int>& y, int window)
+    {
+        const int numWindows = (int) y.size() - window + 1;
+        std::vector<long long> p0(y.size() + 1, 0), p1(y.size() + 1, 0), p2(y.size() + 1, 0);
+        for (size_t i = 0; i < y.size(); ++i) {
+            const long long v = y[i];
+            p0[i + 1] = p0[i] + v;
+            p1[i + 1] = p1[i] + v * (long long) i;
+            p2[i + 1] = p2[i] + v * v;
+        }
+        sum.resize(numWindows);
+        sqSum.resize(numWindows);
+        jSum.resize(numWindows);
+        for (int l = 0; l < numWindows; ++l) {
+            sum[l] = p0[l + window] - p0[l];
+            sqSum[l] = p2[l + window] - p2[l];
+            jSum[l] = (p1[l + window] - p1[l]) - (long long) l * sum[l];
+        }
+    }
+};
+
+/**
+ * Best (first in (loc1, loc2) order) signed squared correlation.
+ */
+struct FftBest {
+    double sqCor;
+    std::size_t loc1;
+    std::size_t loc2;
+
+    FftBest(double initial) : sqCor(initial), loc1(1000000), loc2(1000000) {}
+
+    inline void offer(double value, std::size_t l1, std::size_t l2)
+    {
+        if (value > sqCor || (value == sqCor && (l1 < loc1 || (l1 == loc1 && l2 < loc2)))) {
+            sqCor = value;
+            loc1 = l1;
+            loc2 = l2;
+        }
+    }
+};
+
+/**
+ * Calls score(l1, l2, dot) for every window pair, diagonal by diagonal,
+ * where dot is the exact dot product of the windows of x at l1 and y at
+ * l2, and keeps the best returned signed squared correlation. The
+ * diagonals are spread over numThreads threads (1 = serial, <= 0 = all
+ * cores); the result does not depend on the thread count.
+ */
+template <typename Score>
+FftBest fftSearchDiagonals(const std::vector<int>& x,
+                           const std::vector<int>& y,
+                           int window,
+                           double initial,
+                           int numThreads,
+                           Score score)
+{
+    const int lengthX = (int) x.size();
+    const int lengthY = (int) y.size();
+    const int numWindowsX = lengthX - window + 1;
+    const int numWindowsY = lengthY - window + 1;
+
+    //First dot product of every diagonal. The FFT is exact after rounding
+    //as long as its error stays well below 0.5; otherwise do it directly.
+    long long maxX = 0, maxY = 0;
+    for (int i = 0; i < lengthX; ++i) maxX = std::max(maxX, std::llabs(x[i]));
+    for (int i = 0; i < lengthY; ++i) maxY = std::max(maxY, std::llabs(y[i]));
+    const double logN = std::log((double) (lengthX + lengthY)) / std::log(2.0) + 1.0;
+    const bool useFft = (double) window * maxX * maxY * logN < 1099511627776.0; // 2^40
+
+    std::vector<long long> startXY(numWindowsY); //d >= 0: x[0..] against y[d..]
+    std::vector<long long> startYX(numWindowsX); //d <= 0: y[0..] against x[-d..]
+    if (useFft) {
+        std::vector<double> cXY = fftCrossCorrelate(&x[0], &y[0], window, lengthY);
+        std::vector<double> cYX = fftCrossCorrelate(&y[0], &x[0], window, lengthX);
+        for (int d = 0; d < numWindowsY; ++d) startXY[d] = (long long) std::floor(cXY[d] + 0.5);
+        for (int d = 0; d < numWindowsX; ++d) startYX[d] = (long long) std::floor(cYX[d] + 0.5);
+    }
+    else {
+        for (int d = 0; d < numWindowsY; ++d) {
+            long long s = 0;
+            for (int j = 0; j < window; ++j) s += (long long) x[j] * y[d + j];
+            startXY[d] = s;
+        }
+        for (int d = 0; d < numWindowsX; ++d) {
+            long long s = 0;
+            for (int j = 0; j < window; ++j) s += (long long) y[j] * x[d + j];
+            startYX[d] = s;
+        }
+    }
+
+    //Diagonals d = l2 - l1 in [-(numWindowsX - 1), numWindowsY - 1].
+    const int numDiagonals = numWindowsX + numWindowsY - 1;
+    const int threads = resolveNumThreads(numThreads);
+    const int numChunks = std::min(numDiagonals, (threads > 1) ? 4 * threads : 1);
+    std::vector<FftBest> chunkBest(numChunks, FftBest(initial));
+
+    parallelFor(numChunks, threads, [&](int c) {
+        const int begin = (int) ((long long) numDiagonals * c / numChunks);
+        const int end = (int) ((long long) numDiagonals * (c + 1) / numChunks);
+        FftBest& best = chunkBest[c];
+        for (int k = begin; k < end; ++k) {
+            const int d = k - (numWindowsX - 1);
+            int l1 = (d < 0) ? -d : 0;
+            int l2 = (d < 0) ? 0 : d;
+            long long dot = (d < 0) ? startYX[-d] : startXY[d];
+            for (;;) {
+                best.offer(score(l1, l2, dot), l1, l2);
+                if (l1 + 1 >= numWindowsX || l2 + 1 >= numWindowsY) break;
+                dot -= (long long) x[l1] * y[l2];
+                dot += (long long) x[l1 + window] * y[l2 + window];
+                ++l1;
+                ++l2;
+            }
+        }
+    });
+
+    FftBest best(initial);
+    for (int c = 0; c < numChunks; ++c)
+        best.offer(chunkBest[c].sqCor, chunkBest[c].loc1, chunkBest[c].loc2);
+    return best;
+}
+
+//=======================================================================
+//=======================================================================
+/**
+ * Same result as maxCorrelation(x, y, window) in intcorrelation.h.
+ *
+ * numThreads -- 1 = serial, <= 0 = all cores.
+ */
+inline CorLoc fftMaxCorrelation(const std::vector<int>& x,
+                                const std::vector<int>& y,
+                                size_t window,
+                                int numThreads = 1)
+{
+    assert(x.size() == y.size());
+    assert(x.size() >= window);
+
+    const int w = (int) window;
+    const FftWindowSums xs(x, w);
+    const FftWindowSums ys(y, w);
+
+    //Per-window variances, with the same expression as the original.
+    std::vector<double> xVar(xs.sum.size()), yVar(ys.sum.size());
+    for (size_t i = 0; i < xVar.size(); ++i)
+        xVar[i] = w * xs.sqSum[i] - static_cast<double>(xs.sum[i]) * xs.sum[i];
+    for (size_t i = 0; i < yVar.size(); ++i)
+        yVar[i] = w * ys.sqSum[i] - static_cast<double>(ys.sum[i]) * ys.sum[i];
+
+    FftBest best = fftSearchDiagonals(x, y, w, -9.0, numThreads,
+        [&](int l1, int l2, long long dot) -> double {
+            const long long wSumXY = dot * w;
+            //The original computes the first x window in doubles
+            //and the others in integers; keep both.
+            const double top = (l1 == 0)
+                ? wSumXY - static_cast<double>(xs.sum[l1]) * ys.sum[l2]
+                : static_cast<double>(wSumXY - xs.sum[l1] * ys.sum[l2]);
+            if (top > 0) {
+                return static_cast<double>(top) * top / (xVar[l1] * yVar[l2]);
+            }
+            return -static_cast<double>(top) * top / (xVar[l1] * yVar[l2]);
+        });
+
+    if (best.sqCor > 0) {
+        return CorLoc(sqrt(best.sqCor), best.loc1, best.loc2);
+    } else {
+        return CorLoc(-sqrt(-best.sqCor), best.loc1, best.loc2);
+    }
+}
+
+//=======================================================================
+//=======================================================================
+/**
+ * Same result as leveledMaxCorrelation(x, y, window) in intcorrelation.h,
+ * up to floating point rounding.
+ *
+ * The residuals of each window about its least squares line are never
+ * formed: with r_j = v_j - b * j,
+ *   Sum(rx * ry) = Sum(x * y) - bY * Sum(j * x) - bX * Sum(j * y) + bX * bY * Sum(j^2)
+ * and likewise for Sum(r^2).
+ *
+ * numThreads -- 1 = serial, <= 0 = all cores.
+ */
+inline CorLoc fftLeveledMaxCorrelation(const std::vector<int>& x,
+                                       const std::vector<int>& y,
+                                       size_t window,
+                                       int numThreads = 1)
+{
+    assert(x.size() == y.size());
+    assert(x.size() >= window);
+    assert(window > 0);
+
+    const int wi = (int) window;
+    const double w = (double) window;
+    const double meanZ = (window - 1) / 2.0;
+    const double ssZZ = w * ((window - 1) * (2 * window - 1) / 6.0 - meanZ * meanZ);
+    const double sumZZ = (window - 1) * w * (2 * window - 1) / 6.0;
+
+    //Slope, intercept, Sum(r^2) - w*a^2 ("var") of each window.
+    struct Fit {
+        std::vector<double> slope;
+        std::vector<double> intercept;
+        std::vector<double> var;
+        const FftWindowSums* sums;
+    };
+    const FftWindowSums xs(x, wi);
+    const FftWindowSums ys(y, wi);
+    Fit fx, fy;
+    const FftWindowSums* allSums[2] = { &xs, &ys };
+    Fit* fits[2] = { &fx, &fy };
+    for (int t = 0; t < 2; ++t) {
+        const FftWindowSums& s = *allSums[t];
+        Fit& f = *fits[t];
+        const size_t n = s.sum.size();
+        f.sums = &s;
+        f.slope.resize(n);
+        f.intercept.resize(n);
+        f.var.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            const double b = (s.jSum[i] - meanZ * s.sum[i]) / ssZZ;
+            const double a = s.sum[i] / w - b * meanZ;
+            const double rSqSum = s.sqSum[i] - 2.0 * b * s.jSum[i] + b * b * sumZZ;
+            f.slope[i] = b;
+            f.intercept[i] = a;
+            f.var[i] = rSqSum - w * a * a;
+        }
+    }
+
+    FftBest best = fftSearchDiagonals(x, y, wi, -10.0, numThreads,
+        [&](int l1, int l2, long long dot) -> double {
+            const double bx = fx.slope[l1];
+            const double by = fy.slope[l2];
+            const double xrYrSum = dot - by * xs.jSum[l1] - bx * ys.jSum[l2] + bx * by * sumZZ;
+            const double top = xrYrSum - w * fx.intercept[l1] * fy.intercept[l2];
+            const double sqCor = top * top / (fx.var[l1] * fy.var[l2]);
+            //The original picks the sign from Sum(rx * ry), not from top.
+            return (xrYrSum > 0.0) ? sqCor : -sqCor;
+        });
+
+    if (best.sqCor > 0) {
+        return CorLoc(sqrt(best.sqCor), best.loc1, best.loc2);
+    }
+    else {
+        return CorLoc(-sqrt(-best.sqCor), best.loc1, best.loc2);
+    }
+}
+
+#endif
@@ -28,12 +28,21 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstdlib>
+#include "correlationsurface.h"
 #include "FlippableCorLoc.h"
 #include <iterator>
+#include <limits>
 #include <stdexcept>
 #include <sstream>
 #include "mydebug.h"
+#include "parallel.h"
+#include "sampletraits.h"
+#include "shiftbounds.h"
+#include "shiftkernel.h"
 #include <iostream>
+#include <memory>
+#include <vector>
 
 using std::runtime_error;
 using std::cout;
@@ -49,27 +58,56 @@ using std::endl;
  * FlippableCorLoc.cpp.
  */
 
+/**
+ * The samples are whatever RandomAccessIter points to: ints (the
+ * traces scaled by 100, see ConvertTraceToInt) as it always was, or
+ * float or double depths used as they are; see SampleTraits for how
+ * each is summed. Pruning and the SIMD kernel are for ints only and
+ * are skipped for other sample types.
+ *
+ * Traces prepared from a TraceView with valid flags (a Profile mask)
+ * are searched over their valid samples only: each window pair is
+ * correlated over the samples valid in both, and pairs with fewer
+ * than minValid of them are passed over.
+ */
 template <typename RandomAccessIter>
 class MaxCorrelationWithFlips {
    public:
+   typedef typename std::iterator_traits<RandomAccessIter>::value_type Sample;
+   typedef SampleTraits<Sample> Traits;
+   typedef typename Traits::Sum Sum;
+
+   /**
+    * numThreads -- threads to split the shift search across.
+    * 1 runs the original serial search; <= 0 uses one thread per core.
+    * The result is identical either way.
+    * prune -- skip blocks of windows whose correlation is bounded
+    * (see ShiftBounds) below the best found so far. Also exact.
+    * Not done for masked traces.
+    * minValid -- for masked traces, the fewest samples valid in both
+    * windows for a pair to count (at least 2 are needed anyway).
+    */
+   explicit MaxCorrelationWithFlips(int numThreads = 1, bool prune = false, int minValid = 0) :
+       _numThreads(numThreads), _prune(prune), _minValid(minValid) {}
   
    /**
     * Finds the pair of windows with max correlation
     * out of all windows of the given length
     * between y1 and y2 and y1 (by default) and y2 reversed.
     *
-    * y1 -- iterator pointing to a sequence of ints.
-    * y2 -- iterator pointing to a sequence of ints.
+    * y1 -- iterator pointing to a sequence of samples.
+    * y2 -- iterator pointing to a sequence of samples.
     * length1 -- length of the first sequences
     * length2 -- length of the second sequences
     * window -- size of the windows over which to compute correlations.
     * checkFlip -- also compare y1 and y2 reversed.
+    * stats -- if not null, gets what pruning skipped.
     * 
     * this function is changed by Maverick to accommodate 
     * different lengths for the two traces 
     *
-    *  XXX! it does not support flipping any more (by Maverick)  
-    *  
+    * Flipping was dropped by Maverick along with the reversed copies
+    * it used; it is back without them, see FlipScan.
     */
 	//Laura Ekstrand (March 2013) - added maxShiftPercentage as leash for 
 	//Opposite End Problem - see flipcorrelation.h:maxCorVaryingSecond().
@@ -79,10 +117,248 @@ class MaxCorrelationWithFlips {
                               int length2,
                               int window,
 							  float maxShiftPercentage,
-                              bool checkFlip = false) const 
+                              bool checkFlip = false,
+                              PruneStats* stats = 0) const 
+   {
+       checkLengths(length1, length2, window);
+     
+       //Copy the traces and precompute the sum and variance of
+       //each subwindow; see Prepared.
+       const Prepared t1(y1, length1, window);
+       const Prepared t2(y2, length2, window);
+     
+       return (*this)(t1, t2, maxShiftPercentage, stats, checkFlip);
+  }
+
+   class Prepared;
+   struct Workspace;
+
+   /**
+    * As above, with the copies and tables in ws instead of fresh
+    * storage (see Workspace).
+    */
+   FlippableCorLoc operator()(RandomAccessIter y1,
+                              RandomAccessIter y2,
+                              int length1,
+                              int length2,
+                              int window,
+                              float maxShiftPercentage,
+                              Workspace& ws,
+                              PruneStats* stats = 0) const
+   {
+       checkLengths(length1, length2, window);
+       ws.t1.assign(y1, length1, window);
+       ws.t2.assign(y2, length2, window);
+       return (*this)(ws.t1, ws.t2, maxShiftPercentage, stats);
+   }
+
+   /**
+    * As above, for two traces that were already copied and
+    * tabulated with the same window. Use this to compare one
+    * trace against many without redoing that work per pair.
+    * With checkFlip, a flipped pair wins only if strictly better;
+    * its loc2 is then in the coordinates of t2 reversed.
+    */
+   FlippableCorLoc operator()(const Prepared& t1,
+                              const Prepared& t2,
+                              float maxShiftPercentage,
+                              PruneStats* stats = 0,
+                              bool checkFlip = false) const
+   {
+       if (t1.window() != t2.window()) {
+           std::ostringstream what;
+           what << "traces prepared with different windows: " << t1.window() << " != " << t2.window();
+           throw std::invalid_argument(what.str());
+       }
+       const int length1 = t1.length();
+       const int length2 = t2.length();
+       const int window = t1.window();
+
+       //Maverick's version compared y1 with a reversed copy of y2 and
+       //its table in a second search; the flipped pairs are now scored
+       //within the same one (see FlipScan), reading y2 backwards.
+       FlipScan flip(t1, t2);
+
+	   //Ru He comments: -2.0f is small enough since corr is in [-1, 1]
+       if (stats) *stats = PruneStats();
+       SqCorLoc c = maxCorrelation(t1.data(), t2.data(), length1, length2, window, maxShiftPercentage, t1.table(), t2.table(), t1.valid(), t2.valid(), -2.0f, stats,
+                                   checkFlip ? &flip : 0);
+       if (c.loc1() < 0 && (t1.valid() || t2.valid())) {
+           std::ostringstream what;
+           what << "no pair of windows has " << std::max(_minValid, 2) << " valid samples in both traces";
+           throw runtime_error(what.str());
+       }
+	   // cout << "[" << c.loc1() << c.loc2() << "]";
+
+       if (checkFlip && flip.best > c)
+           return FlippableCorLoc(flip.best.cor(), flip.best.loc1(), flip.best.loc2(), true);
+       return FlippableCorLoc(c.cor(), c.loc1(), c.loc2(), false); //added by Maverick 
+  }
+
+   /**
+    * The best pair of t1 and t2 reversed alone (flipped, loc2 in
+    * the coordinates of t2 reversed); see maxCorFlipped(). loc1 and
+    * loc2 are -1 if no pair of masked traces counts.
+    */
+   FlippableCorLoc flipped(const Prepared& t1,
+                           const Prepared& t2,
+                           float maxShiftPercentage) const
    {
-       Q_UNUSED(checkFlip);
+       if (t1.window() != t2.window()) {
+           std::ostringstream what;
+           what << "traces prepared with different windows: " << t1.window() << " != " << t2.window();
+           throw std::invalid_argument(what.str());
+       }
+       const SqCorLoc f = maxCorFlipped(t1, t2, maxShiftPercentage);
+       return FlippableCorLoc(f.cor(), f.loc1(), f.loc2(), true);
+   }
+
+   /**
+    * The k best peaks of the search over t1 and t2, best first.
+    *
+    * Two peaks overlap when their loc1s and their loc2s are both less
+    * than minSeparation apart (minSeparation <= 0 means the window
+    * size); of two overlapping peaks only the better one is kept.
+    *
+    * The peaks are collected in one pass over the shifts, with a list
+    * of at most k peaks per block of PeakBlock shifts, and the blocks'
+    * lists are merged in a fixed order. The result therefore does not
+    * depend on numThreads, and its first entry is what operator()
+    * returns. Fewer than k peaks come back if there are not k
+    * non-overlapping windows with a finite correlation.
+    */
+   std::vector<FlippableCorLoc> peaks(const Prepared& t1,
+                                      const Prepared& t2,
+                                      float maxShiftPercentage,
+                                      int k,
+                                      int minSeparation = 0) const
+   {
+       if (t1.window() != t2.window()) {
+           std::ostringstream what;
+           what << "traces prepared with different windows: " << t1.window() << " != " << t2.window();
+           throw std::invalid_argument(what.str());
+       }
+       const int length1 = t1.length();
+       const int length2 = t2.length();
+       const int window = t1.window();
+       if (minSeparation <= 0) minSeparation = window;
+       if (k <= 0) return std::vector<FlippableCorLoc>();
+
+       //The two passes of maxCorrelation(): trace 2 shifted right of
+       //trace 1 (from shift 0), then trace 1 shifted right of trace 2
+       //(from shift 1), each cut into blocks of shifts.
+       const int maxShift1 = maxShiftPercentage*(length2 - window);
+       const int maxShift2 = maxShiftPercentage*(length1 - window);
+       const int numBlocks1 = std::max(0, (maxShift1 + PeakBlock) / PeakBlock);
+       const int numBlocks2 = std::max(0, (maxShift2 - 1 + PeakBlock) / PeakBlock);
+
+       std::vector<PeakList> blockPeaks(numBlocks1 + numBlocks2, PeakList(k, minSeparation));
+       parallelFor(numBlocks1 + numBlocks2, _numThreads, [&](int b) {
+           if (b < numBlocks1) {
+               const int begin = b * PeakBlock;
+               peakShiftRange(begin, std::min(begin + PeakBlock, maxShift1 + 1),
+                              t1.data(), t2.data(), length1, length2, window,
+                              t1.table(), t2.table(), t1.valid(), t2.valid(), false, blockPeaks[b]);
+           }
+           else {
+               const int begin = 1 + (b - numBlocks1) * PeakBlock;
+               peakShiftRange(begin, std::min(begin + PeakBlock, maxShift2 + 1),
+                              t2.data(), t1.data(), length2, length1, window,
+                              t2.table(), t1.table(), t2.valid(), t1.valid(), true, blockPeaks[b]);
+           }
+       });
+
+       //maxCorrelation() lets the second pass win ties, so its blocks
+       //go in first.
+       PeakList merged(k, minSeparation);
+       for (int n = 0; n < numBlocks1 + numBlocks2; ++n) {
+           const int b = (n < numBlocks2) ? numBlocks1 + n : n - numBlocks2;
+           const std::vector<SqCorLoc>& found = blockPeaks[b].peaks();
+           for (size_t i = 0; i < found.size(); ++i)
+               merged.offer(found[i]);
+       }
+
+       std::vector<FlippableCorLoc> ret;
+       const std::vector<SqCorLoc>& found = merged.peaks();
+       for (size_t i = 0; i < found.size(); ++i)
+           ret.push_back(FlippableCorLoc(found[i].cor(), found[i].loc1(), found[i].loc2(), false));
+       return ret;
+   }
+
+   ///Rows (and columns) per tile in surface().
+   enum { SurfaceTileSize = 128 };
 
+   /**
+    * The signed correlation of every window pair of t1 and t2, sent to
+    * sink in tiles: loc1 of t1 down the rows, loc2 of t2 across the
+    * columns, without the maxShiftPercentage leash. For masked traces
+    * r is over the samples valid in both, and NaN for a pair the search
+    * would pass over.
+    *
+    * The sums slide along each shift from row to row as they do in the
+    * search, so this is one pass over the surface plus a window per
+    * shift. Only one band of tileSize rows is held at a time (tileSize
+    * floats per column) plus a few sums per shift, so a 20000 x 20000
+    * surface needs about 10 MB. The shifts of a band are split across
+    * numThreads; the values do not depend on it.
+    */
+   void surface(const Prepared& t1,
+                const Prepared& t2,
+                SurfaceSink& sink,
+                int tileSize = SurfaceTileSize) const
+   {
+       if (t1.window() != t2.window()) {
+           std::ostringstream what;
+           what << "traces prepared with different windows: " << t1.window() << " != " << t2.window();
+           throw std::invalid_argument(what.str());
+       }
+       if (tileSize <= 0) tileSize = SurfaceTileSize;
+       const int rows = t1.length() - t1.window() + 1;
+       const int cols = t2.length() - t2.window() + 1;
+       const int numTiles = (cols + tileSize - 1) / tileSize;
+       const size_t tileArea = (size_t) tileSize * tileSize;
+
+       //The band is kept tile by tile, so that each tile is contiguous.
+       std::vector<float> band(numTiles * tileArea);
+       //One per shift loc2 - loc1, from 1 - rows to cols - 1.
+       std::vector<Diagonal> diagonals(std::max(0, rows + cols - 1));
+       const int minShift = 1 - rows;
+
+       sink.begin(rows, cols, tileSize);
+       for (int row0 = 0; row0 < rows; row0 += tileSize) {
+           const int row1 = std::min(row0 + tileSize, rows);
+           const int shiftBegin = 1 - row1;
+           const int shiftEnd = cols - row0;
+           const int numShifts = shiftEnd - shiftBegin;
+           const int numChunks = std::min(numShifts, 4 * resolveNumThreads(_numThreads));
+
+           parallelFor(numChunks, _numThreads, [&](int c) {
+               const int begin = shiftBegin + (int) ((long long) numShifts * c / numChunks);
+               const int end = shiftBegin + (int) ((long long) numShifts * (c + 1) / numChunks);
+               for (int loc1 = row0; loc1 < row1; ++loc1) {
+                   float* row = &band[(loc1 - row0) * tileSize];
+                   const int last = std::min(end, cols - loc1);
+                   for (int shift = std::max(begin, -loc1); shift < last; ++shift) {
+                       const int loc2 = loc1 + shift;
+                       row[(loc2 / tileSize) * tileArea + loc2 % tileSize] =
+                           surfaceCor(diagonals[shift - minShift], t1, t2, loc1, loc2);
+                   }
+               }
+           });
+
+           for (int t = 0; t < numTiles; ++t) {
+               const SurfaceTile tile = {row0, t * tileSize, row1 - row0,
+                                         std::min(tileSize, cols - t * tileSize), tileSize,
+                                         &band[t * tileArea]};
+               sink.tile(tile);
+           }
+       }
+       sink.end();
+   }
+  
+   private:
+    static void checkLengths(int length1, int length2, int window)
+      {
        if (length1 < 0 || length2 < 0) {
            std::ostringstream what;
            what << "length1 or length2 < 0: [length1=" << length1 << ", length2=" << length2 << "]" ;
@@ -98,135 +374,8 @@ class MaxCorrelationWithFlips {
            what << "window > length1 or length2: " << window << " > " << "[lenght1=" << length1 << ", length2=" << length2 << "]";
            throw std::out_of_range(what.str());
        }
-     
-       /**
-        * One past the leftmost index of the rightmost
-        * subwindow, ie, the number of subwindows
-        * that will fit within a single sequence.
-        */
-       const int numWindows1 = length1 - window + 1;
-       const int numWindows2 = length2 - window + 1;
-     
-       /* why do we need to make another copy? (Q by Maverick)  
-        * probably for the reversed copy of trace 2 (A by Maverick)
-        */
-       int* y1Copy = new int[length1];
-       std::copy(y1, y1 + length1, y1Copy);
-     
-       int* y2Copy = new int[length2];
-       std::copy(y2, y2 + length2, y2Copy);
-       
-       //XXX! We could make this code more "exception-safe"
-       //by wrapping these in auto_ptrs or at least dropping
-       //extra copies of the pointers into auto_ptrs
-       //and using those to manage the memory.
-       SumVar* y1Table = new SumVar[numWindows1];
-       SumVar* y2Table = new SumVar[numWindows2];
-     
-       //Precompute the sum and variance of each
-       //subwindow. We might combine this with
-       //the first loop of the code to find the
-       //correlations, but separating it thus
-       //allows for more reuse/simpler code.
-       
-       //Initialization:
-       int* y1Old(y1Copy);
-       int* y2Old(y2Copy);
-       long long y1Sum = 0;
-       long long y1SqSum = 0;
-       long long y2Sum = 0;
-       long long y2SqSum = 0;
-       int* y1Next(y1Old);
-       int* y2Next(y2Old);
-       for (int i = 0; i != window; ++i) {
-           const int v1 = *y1Next++;
-           y1Sum += v1;
-           y1SqSum += v1 * v1;
-     
-           const int v2 = *y2Next++;
-           y2Sum += v2;
-           y2SqSum += v2 * v2;
-       }
-       y1Table[0].resetWith(window, y1Sum, y1SqSum);
-     
-       y2Table[0].resetWith(window, y2Sum, y2SqSum);
-     
-	   //Ru He comments:
-	   //The following each-time-update-one strategy is used to reduce the computation costs
-	   //Since 
-       for (int i = 1; ; ++i) {
-            if (i >= numWindows1 && i >= numWindows2)  break; 
-            if (i < numWindows1) { 
-                 const long long old1 = (long long) *y1Old++;
-                 y1Sum -= old1;
-                 y1SqSum -= old1 * old1;
-                 const long long next1 = (long long) *y1Next++;
-                 y1Sum += next1;
-                 y1SqSum += next1 * next1;
-                 y1Table[i].resetWith(window, y1Sum, y1SqSum);
-				// cout << "i=" << i << ", y1sum=" << y1Sum << ", y1sqsum=" << y1SqSum << endl;
-            } 
-            if (i < numWindows2) { 
-                const long long old2 = (long long) *y2Old++;
-                y2Sum -= old2;
-                y2SqSum -= old2 * old2;
-                const long long next2 = (long long) *y2Next++;
-                y2Sum += next2;
-                y2SqSum += next2 * next2;
-                y2Table[i].resetWith(window, y2Sum, y2SqSum);
-		//		cout << "i=" << i << ", y2sum=" << y2Sum << ", y2sqsum=" << y2SqSum << endl;
-            } 
-       }
-       
-	   //Ru He comments: -2.0f is small enough since corr is in [-1, 1]
-       SqCorLoc c = maxCorrelation(y1Copy, y2Copy, length1, length2, window, maxShiftPercentage, y1Table, y2Table, -2.0f);
-	   // cout << "[" << c.loc1() << c.loc2() << "]";
-     
-       /* I suppose the following code is used to compute the correlations 
-        * for the [trace 1] and [the reverse of trace 2]  
-        * comments added by Maverick 
-        *
-        * And for the time being Maverick would comment all of the following 
-        * so that it does not support flip and would not take 
-        * the maximum of [y1 vs y2] and [y1 vs y2 reversed] 
-        */
-       /* 
-       SqCorLoc cReversed(-10,-10,-10);
-       int* y2Reversed = 0;
-       SumVar* y2TableReversed = 0;
-       if (checkFlip) {
-          y2Reversed = new int[length2];
-          std::reverse_copy(y2Copy, y2Copy + length, y2Reversed);
-          
-          y2TableReversed = new SumVar[numWindows];
-          std::reverse_copy(y2Table, y2Table + numWindows, y2TableReversed);
-          
-          cReversed = maxCorrelation(y1Copy, y2Reversed, length1, length2, window, y1Table, y2TableReversed, c.sqCor());
-       }
-       */ // commented out by Maverick 
-     
-       delete[] y1Copy;
-       delete[] y2Copy;
-       delete[] y1Table;
-       delete[] y2Table; 
-
-       /*
-       delete[] y2Reversed;
-       delete[] y2TableReversed;
-       */ // commented out by maverick 
-       /*
-     
-       if (!checkFlip || c > cReversed) {
-         return FlippableCorLoc(c.cor(), c.loc1(), c.loc2(), false);
-       }
-       else {
-         return FlippableCorLoc(cReversed.cor(), cReversed.loc1(), cReversed.loc2(), true);
-       }
-       */ // commented out by Maverick 
-       return FlippableCorLoc(c.cor(), c.loc1(), c.loc2(), false); //added by Maverick 
-  }
-  
-   private:
+      }
+
     /**
      * Nested struct for storing the sum and variance
      * corresponding to a given position.
@@ -234,10 +383,14 @@ class MaxCorrelationWithFlips {
     struct SumVar {
       double sum;
       double var;
+      int count; ///< Valid samples summed; the window size if unmasked.
       /**
        * Sets the fields based off of the given window size, sum, and squared sum.
+       * For a masked trace, window is the number of valid samples.
        */
-      inline void resetWith(int window, long long newSum, long long sqSum) {
+      template <typename S>
+      inline void resetWith(int window, S newSum, S sqSum) {
+        count = window;
         sum = (double) newSum;
         var = 1.0 * window * sqSum - (newSum) * newSum;
         /*
@@ -246,6 +399,154 @@ class MaxCorrelationWithFlips {
          */
       }
     };
+
+   public:
+    /**
+     * A trace, with the sum and variance of every window of the given
+     * size precomputed. It either keeps a copy of the trace or, made
+     * from a TraceView, only points at it and at its valid flags.
+     * For a masked trace the sums are over the valid samples of each
+     * window, and count says how many there are.
+     */
+    class Prepared {
+    public:
+      Prepared() : _length(0), _window(0), _view(0), _valid(0) {}
+      Prepared(RandomAccessIter y, int length, int window) { assign(y, length, window); }
+      ///No copy of y is made; it must outlive this.
+      Prepared(const TraceView<Sample>& y, int window) { assign(y, window); }
+
+      void assign(RandomAccessIter y, int length, int window)
+      {
+        check(length, window);
+        _y.assign(y, y + length);
+        _view = 0;
+        _valid = 0;
+        tabulate(_y.data(), length, window);
+      }
+
+      void assign(const TraceView<Sample>& y, int window)
+      {
+        check((int) y.size(), window);
+        _y.clear();
+        _view = y.data();
+        _valid = y.valid();
+        if (_valid)
+          tabulateMasked(y.data(), (int) y.size(), window);
+        else
+          tabulate(y.data(), (int) y.size(), window);
+      }
+
+      int length() const { return _length; }
+      int window() const { return _window; }
+      const Sample* data() const { return _view ? _view : _y.data(); }
+      const SumVar* table() const { return _table.data(); }
+      ///The valid flags, null if the trace is not masked.
+      const unsigned char* valid() const { return _valid; }
+      ///The copy of the trace; empty if made from a TraceView.
+      const std::vector<Sample>& values() const { return _y; }
+      ///The trace either way.
+      TraceView<Sample> view() const { return TraceView<Sample>(data(), _length, _valid); }
+
+    private:
+      static void check(int length, int window)
+      {
+        if (length < 0 || window < 0 || window > length) {
+          std::ostringstream what;
+          what << "window not in [0, length]: [window=" << window << ", length=" << length << "]";
+          throw std::out_of_range(what.str());
+        }
+      }
+
+      void tabulate(const Sample* y, int length, int window)
+      {
+        _length = length;
+        _window = window;
+
+        /**
+         * One past the leftmost index of the rightmost
+         * subwindow, ie, the number of subwindows
+         * that will fit within the sequence.
+         */
+        const int numWindows = length - window + 1;
+        _table.resize(numWindows);
+
+        //Initialization:
+        const Sample* yOld = y;
+        const Sample* yNext = yOld;
+        Sum ySum = 0;
+        Sum ySqSum = 0;
+        for (int i = 0; i != window; ++i) {
+          const Sample v = *yNext++;
+          ySum += v;
+          ySqSum += Traits::product(v, v);
+        }
+        _table[0].resetWith(window, ySum, ySqSum);
+
+        //Ru He comments:
+        //The following each-time-update-one strategy is used to reduce the computation costs
+        for (int i = 1; i < numWindows; ++i) {
+          const Sum old = (Sum) *yOld++;
+          ySum -= old;
+          ySqSum -= old * old;
+          const Sum next = (Sum) *yNext++;
+          ySum += next;
+          ySqSum += next * next;
+          _table[i].resetWith(window, ySum, ySqSum);
+        }
+      }
+
+      ///tabulate() over the valid samples, counted from prefix sums of _valid.
+      void tabulateMasked(const Sample* y, int length, int window)
+      {
+        _length = length;
+        _window = window;
+
+        std::vector<int> numValid(length + 1, 0);
+        for (int i = 0; i < length; ++i)
+          numValid[i + 1] = numValid[i] + (_valid[i] ? 1 : 0);
+
+        const int numWindows = length - window + 1;
+        _table.resize(numWindows);
+        Sum ySum = 0;
+        Sum ySqSum = 0;
+        for (int i = 0; i < length; ++i) {
+          if (_valid[i]) {
+            const Sample v = y[i];
+            ySum += v;
+            ySqSum += Traits::product(v, v);
+          }
+          const int first = i - window + 1;
+          if (first < 0) continue;
+          _table[first].resetWith(numValid[i + 1] - numValid[first], ySum, ySqSum);
+          if (_valid[first]) {
+            const Sample v = y[first];
+            ySum -= v;
+            ySqSum -= Traits::product(v, v);
+          }
+        }
+      }
+
+      int _length;
+      int _window;
+      std::vector<Sample> _y;
+      const Sample* _view;
+      const unsigned char* _valid;
+      std::vector<SumVar> _table;
+    };
+
+    /**
+     * Scratch for one search at a time: a Prepared per trace, kept
+     * from search to search. assign() reuses their storage, so once
+     * they have grown to the longest traces, preparing a pair does not
+     * allocate. Keep one per thread, e.g. across the comparisons of a
+     * batch.
+     */
+    struct Workspace {
+      Prepared t1;
+      Prepared t2;
+    };
+
+   private:
   
   
     /**
@@ -288,21 +589,45 @@ class MaxCorrelationWithFlips {
       int _loc1;
       int _loc2;
     };
+
+    /**
+     * t1 against t2 reversed, scored along with the search of t1
+     * against t2: each pass of maxCorrelation() also scans the flipped
+     * pairs at every shift it visits (scanShiftFlipped()), in the same
+     * chunks, right after the forward windows of those shifts. best
+     * ends up as maxCorFlipped() would find it, ties included.
+     *
+     * The flipped pairs are neither pruned nor run through ShiftKernel:
+     * the kernel loads y2 forward for adjacent shifts, and ShiftBounds
+     * tabulates y2's segments forward, so both would need y2 reversed,
+     * the copy this avoids.
+     */
+    struct FlipScan {
+      FlipScan(const Prepared& t1, const Prepared& t2) : t1(t1), t2(t2), best(-10.0f, -1, -1) {}
+
+      const Prepared& t1;
+      const Prepared& t2;
+      SqCorLoc best;
+    };
   
 
 	//Ru He comments:
 	//get the max correlation and its corresponding locs for trace 1 and trace 2
 	//Laura Ekstrand (March 2013) - added maxShiftPercentage as leash for 
 	//Opposite End Problem - see flipcorrelation.h:maxCorVaryingSecond().
-    SqCorLoc maxCorrelation(const int* y1,
-                const int* y2,
+    SqCorLoc maxCorrelation(const Sample* y1,
+                const Sample* y2,
                 int length1,
                 int length2,
                 int window,
 				float maxShiftPercentage,
                 const SumVar* y1Table,
                 const SumVar* y2Table,
-                float priorMaxSqCor) const
+                const unsigned char* v1,
+                const unsigned char* v2,
+                float priorMaxSqCor,
+                PruneStats* stats,
+                FlipScan* flip = 0) const
       {
         // a little be confused here: whey we need two by Mav
         // figured it out because maxCorVaryingSecond only find the max of one direction. 
@@ -310,12 +635,18 @@ class MaxCorrelationWithFlips {
 		//Ru He ans: Yes. It will really run (length1 - window) * (length2 - window) iterations
 
 		//  cout << "leng1=" << length1 << "--length2=" << length2 << endl;
-        SqCorLoc c1 = maxCorVaryingSecond(0, y1, y2, length1, length2, window, maxShiftPercentage, y1Table, y2Table, priorMaxSqCor);
+        //With flip, the first pass also scores the flipped shifts 0 up,
+        //the second -1 down, the way maxCorFlipped() visits them.
+        SqCorLoc f1(-10.0f, -1, -1), f2(-10.0f, -1, -1);
+        SqCorLoc c1 = maxCorVaryingSecond(0, y1, y2, length1, length2, window, maxShiftPercentage, y1Table, y2Table, v1, v2, priorMaxSqCor, stats,
+                                          flip, 1, &f1);
 		//cout << c1.loc1() << "+" << c1.loc2() << "[cor=]" << c1.cor() << endl;
 
 		//Ru He comments: 1 vs. 0 in previous function, 1 is set to avoid the min(length1, length2) duplicate comparisons
 
-        SqCorLoc c2 = maxCorVaryingSecond(1, y2, y1, length2, length1, window, maxShiftPercentage, y2Table, y1Table, c1.sqCor());
+        SqCorLoc c2 = maxCorVaryingSecond(1, y2, y1, length2, length1, window, maxShiftPercentage, y2Table, y1Table, v2, v1, c1.sqCor(), stats,
+                                          flip, -1, &f2);
+        if (flip) flip->best = (f1 > f2) ? f1 : f2;
 
 		//cout << c2.loc1() << "+---+" << c2.loc2() << "<cor>=" << c2.cor() <<  endl;
 
@@ -352,22 +683,22 @@ class MaxCorrelationWithFlips {
 	 //maxShift = length2 - window is multiplied by 
 	 //to avoid the Opposite End Problem.
     SqCorLoc maxCorVaryingSecond(int minShift,
-                     const int* y1,
-                     const int* y2,
+                     const Sample* y1,
+                     const Sample* y2,
                      int length1,
                      int length2,
                      int window,
 					 float maxShiftPercentage,
                      const SumVar* y1Table,
                      const SumVar* y2Table,
-                     double priorMaxSqCor) const
+                     const unsigned char* v1,
+                     const unsigned char* v2,
+                     double priorMaxSqCor,
+                     PruneStats* stats,
+                     const FlipScan* flip = 0,
+                     int flipSign = 1,
+                     SqCorLoc* flipped = 0) const
       {
-        bool maxGreaterThan0 = priorMaxSqCor > 0.0f;
-        //cout << "yalenght1=" << length1 << "--->yalength2=" << length2 << endl;
-        double currMax = -10.0f;
-        int loc1 = -1;
-        int loc2 = -1;
-  
         //shift = leftmost index of the window in the 2nd sequence
         //minus the leftmost index of the window in the 1st sequence
         //Ie, shift = loc2 - loc1
@@ -376,39 +707,233 @@ class MaxCorrelationWithFlips {
         const int maxShift = maxShiftPercentage*(length2 - window);
 
 		//cout << "maxshift=" << maxShift << endl;
+
+        //Neither the bounds nor the kernel know about masks.
+        const bool masked = v1 || v2;
+        std::unique_ptr<ShiftBounds> bounds;
+        if (_prune && !masked && ShiftBounds::usable(window))
+            bounds.reset(newBounds(y1, y2, length1, length2, window, y1Table, y2Table));
+
+        //The SIMD kernel is used only where it is bit-identical.
+        std::unique_ptr<ShiftKernel> kernel;
+        if (!masked && ShiftKernel::vectorized() && maxShift - minShift + 1 >= ShiftKernel::Lanes) {
+            kernel.reset(newKernel(y1, y2, length1, length2, window, y1Table, y2Table));
+            if (kernel.get() && !kernel->exact()) kernel.reset();
+        }
+
+        const int numShifts = maxShift - minShift + 1;
+        const int numThreads = resolveNumThreads(_numThreads);
+        if (numThreads <= 1 || numShifts < 2 * numThreads) {
+            return searchShifts(minShift, maxShift + 1, y1, y2, length1, length2,
+                                window, y1Table, y2Table, v1, v2, priorMaxSqCor, kernel.get(),
+                                bounds.get(), stats, -10.0, flip, flipSign, flipped);
+        }
+
+        //Split the shifts into contiguous chunks, a few per thread since
+        //large shifts have fewer windows to visit. Every chunk starts from
+        //the same prior as the serial search would, so each one returns the
+        //first maximum of its own shifts. Keeping the first chunk that is
+        //strictly greater, in shift order, then gives exactly the serial
+        //(loc1, loc2) including ties.
+        const int numChunks = std::min(4 * numThreads, numShifts);
+        std::vector<SqCorLoc> chunkMax(numChunks, SqCorLoc(-10.0f, -1, -1));
+        std::vector<SqCorLoc> chunkFlipped(numChunks, SqCorLoc(-10.0f, -1, -1));
+        std::vector<PruneStats> chunkStats(numChunks);
+        parallelFor(numChunks, numThreads, [&](int c) {
+            const int begin = minShift + (int) ((long long) numShifts * c / numChunks);
+            const int end = minShift + (int) ((long long) numShifts * (c + 1) / numChunks);
+            chunkMax[c] = searchShifts(begin, end, y1, y2, length1, length2,
+                                       window, y1Table, y2Table, v1, v2, priorMaxSqCor, kernel.get(),
+                                       bounds.get(), &chunkStats[c], -10.0, flip, flipSign, &chunkFlipped[c]);
+        });
+
+        SqCorLoc best = chunkMax[0];
+        for (int c = 1; c < numChunks; ++c) {
+            if (chunkMax[c] > best) best = chunkMax[c];
+        }
+        if (flipped) {
+            *flipped = chunkFlipped[0];
+            for (int c = 1; c < numChunks; ++c) {
+                if (chunkFlipped[c] > *flipped) *flipped = chunkFlipped[c];
+            }
+        }
+        if (stats) {
+            for (int c = 0; c < numChunks; ++c) *stats += chunkStats[c];
+        }
+        return best;
+      }
+
+    /**
+     * ShiftBounds and ShiftKernel work on ints; for other samples
+     * these give none and the plain search is used.
+     */
+    static ShiftBounds* newBounds(const int* y1, const int* y2, int length1, int length2,
+                                  int window, const SumVar* y1Table, const SumVar* y2Table)
+      {
+        return new ShiftBounds(y1, y2, length1, length2, window, y1Table, y2Table);
+      }
+
+    template <typename T>
+    static ShiftBounds* newBounds(const T*, const T*, int, int, int, const SumVar*, const SumVar*)
+      {
+        return 0;
+      }
+
+    static ShiftKernel* newKernel(const int* y1, const int* y2, int length1, int length2,
+                                  int window, const SumVar* y1Table, const SumVar* y2Table)
+      {
+        return new ShiftKernel(y1, y2, length1, length2, window, y1Table, y2Table);
+      }
+
+    template <typename T>
+    static ShiftKernel* newKernel(const T*, const T*, int, int, int, const SumVar*, const SumVar*)
+      {
+        return 0;
+      }
+
+    /**
+     * Searches shifts [shiftBegin, shiftEnd), Lanes at a time with
+     * kernel if there is one, the rest with maxCorShiftRange().
+     * With bounds, kernel groups that cannot matter are skipped and
+     * the rest is left to maxCorShiftRangePruned(); beat is the best
+     * found before shiftBegin, as for that.
+     * Same result as maxCorShiftRange() over the whole range.
+     * Masked traces go to maxCorShiftRangeMasked() instead.
+     *
+     * With flip, the flipped pairs at shift flipSign * s are scanned
+     * right after the forward ones of each group of Lanes shifts s, and
+     * their first max goes to flipped (see FlipScan).
+     */
+    SqCorLoc searchShifts(int shiftBegin,
+                     int shiftEnd,
+                     const Sample* y1,
+                     const Sample* y2,
+                     int length1,
+                     int length2,
+                     int window,
+                     const SumVar* y1Table,
+                     const SumVar* y2Table,
+                     const unsigned char* v1,
+                     const unsigned char* v2,
+                     double priorMaxSqCor,
+                     const ShiftKernel* kernel,
+                     const ShiftBounds* bounds,
+                     PruneStats* stats,
+                     double beat = -10.0,
+                     const FlipScan* flip = 0,
+                     int flipSign = 1,
+                     SqCorLoc* flipped = 0) const
+      {
+        if (flip) {
+            SqCorLoc best(-10.0f, -1, -1);
+            SqCorLoc flippedBest(-10.0f, -1, -1);
+            for (int shift = shiftBegin; shift < shiftEnd; shift += ShiftKernel::Lanes) {
+                const int groupEnd = std::min(shift + (int) ShiftKernel::Lanes, shiftEnd);
+                const SqCorLoc c = searchShifts(shift, groupEnd, y1, y2, length1, length2, window,
+                                                y1Table, y2Table, v1, v2, priorMaxSqCor, kernel, bounds,
+                                                stats, std::max(beat, best.sqCor()));
+                if (c > best) best = c;
+                flippedShiftRange(shift, groupEnd, *flip, flipSign, flippedBest);
+            }
+            if (flipped) *flipped = flippedBest;
+            return best;
+        }
+        if (v1 || v2) {
+            return maxCorShiftRangeMasked(shiftBegin, shiftEnd, y1, y2, length1, length2,
+                                          window, y1Table, y2Table, v1, v2, priorMaxSqCor);
+        }
+        if (bounds && !kernel) {
+            return maxCorShiftRangePruned(shiftBegin, shiftEnd, y1, y2, length1, length2,
+                                          window, y1Table, y2Table, priorMaxSqCor, beat,
+                                          *bounds, stats);
+        }
+        if (!kernel) {
+            return maxCorShiftRange(shiftBegin, shiftEnd, y1, y2, length1, length2,
+                                    window, y1Table, y2Table, priorMaxSqCor);
+        }
+
+        SqCorLoc best(-10.0f, -1, -1);
+        int shift = shiftBegin;
+        for (; shift + ShiftKernel::Lanes <= shiftEnd; shift += ShiftKernel::Lanes) {
+            if (bounds) {
+                PruneStats counts;
+                const bool skip = shiftsPrunable(shift, ShiftKernel::Lanes, length1, length2, window,
+                                                 priorMaxSqCor, std::max(beat, best.sqCor()), *bounds, counts);
+                if (skip) counts.prunedWindows = counts.windows;
+                if (stats) *stats += counts;
+                if (skip) continue;
+            }
+            double sqCor;
+            int loc1, loc2;
+            kernel->search(shift, priorMaxSqCor <= 0.0f, sqCor, loc1, loc2);
+            SqCorLoc c(sqCor, loc1, loc2);
+            if (c > best) best = c;
+        }
+        if (shift < shiftEnd) {
+            SqCorLoc c = bounds ?
+                maxCorShiftRangePruned(shift, shiftEnd, y1, y2, length1, length2, window,
+                                       y1Table, y2Table, priorMaxSqCor, std::max(beat, best.sqCor()),
+                                       *bounds, stats) :
+                maxCorShiftRange(shift, shiftEnd, y1, y2, length1, length2,
+                                 window, y1Table, y2Table, priorMaxSqCor);
+            if (c > best) best = c;
+        }
+        return best;
+      }
+
+    /**
+     * The serial search of maxCorVaryingSecond() over the
+     * shifts in [shiftBegin, shiftEnd).
+     */
+    SqCorLoc maxCorShiftRange(int shiftBegin,
+                     int shiftEnd,
+                     const Sample* y1,
+                     const Sample* y2,
+                     int length1,
+                     int length2,
+                     int window,
+                     const SumVar* y1Table,
+                     const SumVar* y2Table,
+                     double priorMaxSqCor) const
+      {
+        bool maxGreaterThan0 = priorMaxSqCor > 0.0f;
+        //cout << "yalenght1=" << length1 << "--->yalength2=" << length2 << endl;
+        double currMax = -10.0f;
+        int loc1 = -1;
+        int loc2 = -1;
 		
         // this is the only change by Maverick inside this function 
 		//Ru He comments: here only set the move range of the second search window
-        for (int shift = minShift; shift <= maxShift; ++shift) {
+        for (int shift = shiftBegin; shift < shiftEnd; ++shift) {
 			
           //Initialization
-          const int* y1Old(y1);
-          const int* y2Old(y2 + shift);
+          const Sample* y1Old(y1);
+          const Sample* y2Old(y2 + shift);
 
 
-          const int* y1Next(y1Old);
-          const int* y2Next(y2Old);
-          const int* y2NextEnd = y2 + length2;
-          const int* y1NextEnd = y1 + length1;
+          const Sample* y1Next(y1Old);
+          const Sample* y2Next(y2Old);
+          const Sample* y2NextEnd = y2 + length2;
+          const Sample* y1NextEnd = y1 + length1;
       
           const SumVar* y1TableIter = y1Table;
           const SumVar* y2TableIter = y2Table + shift;
-          long long prodSum = 0;
-		  long long s1, s2, s1q, s2q;
+          Sum prodSum = 0;
+		  Sum s1, s2, s1q, s2q;
 		  s1=0; s2=0; s1q=0; s2q=0;
       
 		  //Ru He comments:
 		  //Before loop of while (y2Next != y2NextEnd && y1Next != y1NextEnd) 
           for (int j = 0; j != window; ++j) {
-            const int v1 = *y1Next++;
-            const int v2 = *y2Next++;
+            const Sample v1 = *y1Next++;
+            const Sample v2 = *y2Next++;
 			//Ru He question: why still need the following 4 lines
 			s1 += v1;
 			s2 += v2;		
-			s1q += v1*v1;
-			s2q += v2*v2;
+			s1q += Traits::product(v1, v1);
+			s2q += Traits::product(v2, v2);
 			//
-            prodSum += v1 * v2;
+            prodSum += Traits::product(v1, v2);
   
           }
 		  //cout << s1 << "|" << s2 << "|" << s1q << "|" << s2q << endl;
@@ -443,13 +968,13 @@ class MaxCorrelationWithFlips {
           //Update sums
 		  //Ru He comments: y2Next != y2NextEnd && y1Next != y1NextEnd safeguard the end of each trace
           while (y2Next != y2NextEnd && y1Next != y1NextEnd) {
-            const int old1 = *y1Old++;
-            const int old2 = *y2Old++;
-            prodSum -= old1 * old2;
+            const Sample old1 = *y1Old++;
+            const Sample old2 = *y2Old++;
+            prodSum -= Traits::product(old1, old2);
         
-            const int next1 = *y1Next++;
-            const int next2 = *y2Next++;
-            prodSum += next1 * next2;
+            const Sample next1 = *y1Next++;
+            const Sample next2 = *y2Next++;
+            prodSum += Traits::product(next1, next2);
   
             ++y1TableIter;
             ++y2TableIter;
@@ -487,7 +1012,608 @@ class MaxCorrelationWithFlips {
 
 		//cout << "CURR=" << currMax << endl;
         return SqCorLoc(currMax, loc1, loc2);
-      }////SqCorLoc maxCorVaryingSecond()
+      }////SqCorLoc maxCorShiftRange()
+
+    /**
+     * Calls visit(loc1, sqCor) for every window pair at the given shift
+     * with at least _minValid (and 2) samples valid in both traces and
+     * neither window constant over them, in loc1 order. The signed
+     * squared correlation is over those samples only; the sums slide
+     * along the shift as in maxCorShiftRange().
+     */
+    template <typename Visit>
+    void scanShiftMasked(int shift,
+                     const Sample* y1,
+                     const Sample* y2,
+                     int length1,
+                     int length2,
+                     int window,
+                     const SumVar* y1Table,
+                     const SumVar* y2Table,
+                     const unsigned char* v1,
+                     const unsigned char* v2,
+                     Visit visit) const
+      {
+        const int numWindows = std::min(length1, length2 - shift) - window + 1;
+        if (numWindows <= 0) return;
+        const int minValid = std::max(_minValid, 2);
+
+        int n = 0;
+        Sum s1 = 0, s2 = 0, s11 = 0, s22 = 0, s12 = 0;
+        for (int j = 0; j < numWindows + window - 1; ++j) {
+          //Sample j comes in, sample j - window goes out.
+          if ((!v1 || v1[j]) && (!v2 || v2[j + shift])) {
+            const Sample a = y1[j];
+            const Sample b = y2[j + shift];
+            ++n;
+            s1 += a;
+            s2 += b;
+            s11 += Traits::product(a, a);
+            s22 += Traits::product(b, b);
+            s12 += Traits::product(a, b);
+          }
+          const int l1 = j - window;
+          if (l1 >= 0 && (!v1 || v1[l1]) && (!v2 || v2[l1 + shift])) {
+            const Sample a = y1[l1];
+            const Sample b = y2[l1 + shift];
+            --n;
+            s1 -= a;
+            s2 -= b;
+            s11 -= Traits::product(a, a);
+            s22 -= Traits::product(b, b);
+            s12 -= Traits::product(a, b);
+          }
+          if (l1 + 1 < 0) continue;
+
+          //Windows that do not have enough on their own are passed
+          //over without looking at the pair.
+          if (y1Table[l1 + 1].count < minValid || y2Table[l1 + 1 + shift].count < minValid
+              || n < minValid) continue;
+          const double top = n * (double) s12 - (double) s1 * (double) s2;
+          const double var1 = n * (double) s11 - (double) s1 * (double) s1;
+          const double var2 = n * (double) s22 - (double) s2 * (double) s2;
+          if (!(var1 > 0.0) || !(var2 > 0.0)) continue;
+          const double sqCor = top * top / (var1 * var2);
+          visit(l1 + 1, (top > 0.0f) ? sqCor : -sqCor);
+        }
+      }
+
+    /**
+     * maxCorShiftRange() for masked traces, see scanShiftMasked().
+     * Pairs that do not have enough valid samples are never the max;
+     * loc1 and loc2 stay -1 if no pair has.
+     */
+    SqCorLoc maxCorShiftRangeMasked(int shiftBegin,
+                     int shiftEnd,
+                     const Sample* y1,
+                     const Sample* y2,
+                     int length1,
+                     int length2,
+                     int window,
+                     const SumVar* y1Table,
+                     const SumVar* y2Table,
+                     const unsigned char* v1,
+                     const unsigned char* v2,
+                     double priorMaxSqCor) const
+      {
+        bool maxGreaterThan0 = priorMaxSqCor > 0.0f;
+        double currMax = -10.0f;
+        int loc1 = -1;
+        int loc2 = -1;
+        for (int shift = shiftBegin; shift < shiftEnd; ++shift) {
+          scanShiftMasked(shift, y1, y2, length1, length2, window, y1Table, y2Table, v1, v2,
+                          [&](int l1, double sqCor) {
+            if (sqCor > 0.0f) {
+              if (sqCor > currMax) {
+                currMax = sqCor;
+                loc1 = l1;
+                loc2 = l1 + shift;
+                maxGreaterThan0 = true;
+              }
+            }
+            else if (maxGreaterThan0) {}
+            else if (sqCor > currMax) {
+              currMax = sqCor;
+              loc1 = l1;
+              loc2 = l1 + shift;
+            }
+          });
+        }
+        return SqCorLoc(currMax, loc1, loc2);
+      }
+
+    /**
+     * Calls visit(loc1, sqCor) for every pair of the window at loc1 in
+     * t1 and the one at loc1 + shift in t2 reversed, in loc1 order;
+     * shift may be negative. Nothing is reversed: the window at loc2 of
+     * the reversed trace is the one at length2 - window - loc2 of t2,
+     * with the same sum and var, read backwards. Masked pairs are
+     * summed and passed over as in scanShiftMasked().
+     */
+    template <typename Visit>
+    void scanShiftFlipped(int shift, const Prepared& t1, const Prepared& t2, Visit visit) const
+      {
+        const Sample* y1 = t1.data();
+        const Sample* y2 = t2.data();
+        const unsigned char* v1 = t1.valid();
+        const unsigned char* v2 = t2.valid();
+        const int length2 = t2.length();
+        const int window = t1.window();
+        const int first = std::max(0, -shift);
+        const int end = std::min(t1.length(), length2 - shift) - window + 1;
+        if (end <= first) return;
+        const bool masked = v1 || v2;
+        const int minValid = std::max(_minValid, 2);
+
+        //y2 reversed at k is y2 at last - k.
+        const int last = length2 - 1 - shift;
+        int n = 0;
+        Sum s1 = 0, s2 = 0, s11 = 0, s22 = 0, s12 = 0;
+        for (int j = first; j < end + window - 1; ++j) {
+          if (!masked) {
+            s12 += Traits::product(y1[j], y2[last - j]);
+            if (j - window >= first)
+              s12 -= Traits::product(y1[j - window], y2[last - j + window]);
+          }
+          else {
+            if ((!v1 || v1[j]) && (!v2 || v2[last - j])) {
+              const Sample a = y1[j];
+              const Sample b = y2[last - j];
+              ++n;
+              s1 += a;
+              s2 += b;
+              s11 += Traits::product(a, a);
+              s22 += Traits::product(b, b);
+              s12 += Traits::product(a, b);
+            }
+            const int out = j - window;
+            if (out >= first && (!v1 || v1[out]) && (!v2 || v2[last - out])) {
+              const Sample a = y1[out];
+              const Sample b = y2[last - out];
+              --n;
+              s1 -= a;
+              s2 -= b;
+              s11 -= Traits::product(a, a);
+              s22 -= Traits::product(b, b);
+              s12 -= Traits::product(a, b);
+            }
+          }
+          const int l1 = j - window + 1;
+          if (l1 < first) continue;
+
+          const SumVar& w1 = t1.table()[l1];
+          const SumVar& w2 = t2.table()[length2 - window - (l1 + shift)];
+          double top, var1, var2;
+          if (!masked) {
+            top = window * s12 - w1.sum * w2.sum;
+            var1 = w1.var;
+            var2 = w2.var;
+          }
+          else {
+            if (w1.count < minValid || w2.count < minValid || n < minValid) continue;
+            top = n * (double) s12 - (double) s1 * (double) s2;
+            var1 = n * (double) s11 - (double) s1 * (double) s1;
+            var2 = n * (double) s22 - (double) s2 * (double) s2;
+          }
+          if (!(var1 > 0.0) || !(var2 > 0.0)) continue;
+          const double sqCor = top * top / (var1 * var2);
+          visit(l1, (top > 0.0f) ? sqCor : -sqCor);
+        }
+      }
+
+    /**
+     * Offers the pairs of flip.t1 and flip.t2 reversed at the shifts
+     * sign * s, s in [begin, end), to best, in that order; best keeps
+     * the first max.
+     */
+    void flippedShiftRange(int begin, int end, const FlipScan& flip, int sign, SqCorLoc& best) const
+      {
+        for (int s = begin; s < end; ++s) {
+            const int shift = sign * s;
+            scanShiftFlipped(shift, flip.t1, flip.t2, [&](int l1, double sqCor) {
+                if (sqCor > best.sqCor()) best = SqCorLoc(sqCor, l1, l1 + shift);
+            });
+        }
+      }
+
+    /**
+     * The best pair of t1 and t2 reversed alone, loc2 in reversed
+     * coordinates, over the shifts the leash allows either way as in
+     * maxCorrelation(). Both orientations share the traces and their
+     * tables; nothing is copied.
+     *
+     * The shifts are visited the way maxCorrelation() visits them: 0
+     * up to the largest, then -1 down to the smallest, each in loc1
+     * order. The first max of each half is kept, and the negative
+     * half's wins a tie between the two, so ties go the way they would
+     * in maxCorrelation() on a reversed copy of t2. The shifts are
+     * split across numThreads in that order, so the result does not
+     * depend on it. loc1 and loc2 are -1 if no pair counts.
+     *
+     * operator() gets the same result from FlipScan, within the search
+     * of t1 against t2; this is for flipped() alone.
+     */
+    SqCorLoc maxCorFlipped(const Prepared& t1, const Prepared& t2, float maxShiftPercentage) const
+      {
+        const int window = t1.window();
+        const int minShift = -(int) (maxShiftPercentage * (t1.length() - window));
+        const int maxShift = maxShiftPercentage * (t2.length() - window);
+        const int numShifts = maxShift - minShift + 1;
+        if (numShifts <= 0) return SqCorLoc(-10.0f, -1, -1);
+        const int numChunks = std::min(4 * resolveNumThreads(_numThreads), numShifts);
+
+        //Shift i of the visiting order; a chunk may hold both halves.
+        std::vector<SqCorLoc> chunkMax(2 * numChunks, SqCorLoc(-10.0f, -1, -1));
+        parallelFor(numChunks, _numThreads, [&](int c) {
+            const int begin = (int) ((long long) numShifts * c / numChunks);
+            const int end = (int) ((long long) numShifts * (c + 1) / numChunks);
+            if (begin <= maxShift)
+                flippedShiftRange(begin, std::min(end, maxShift + 1), FlipScan(t1, t2), 1, chunkMax[2 * c]);
+            if (end > maxShift + 1)
+                flippedShiftRange(std::max(begin, maxShift + 1) - maxShift, end - maxShift,
+                                  FlipScan(t1, t2), -1, chunkMax[2 * c + 1]);
+        });
+
+        SqCorLoc nonNegative = chunkMax[0];
+        SqCorLoc negative = chunkMax[1];
+        for (int c = 1; c < numChunks; ++c) {
+            if (chunkMax[2 * c] > nonNegative) nonNegative = chunkMax[2 * c];
+            if (chunkMax[2 * c + 1] > negative) negative = chunkMax[2 * c + 1];
+        }
+        return (nonNegative > negative) ? nonNegative : negative;
+      }
+
+    /**
+     * Can a block of windows with correlation bound ub be skipped,
+     * once a positive correlation has been seen or given as the prior?
+     * Negative correlations no longer count then, and neither do
+     * those that cannot beat beat (found earlier) or reach the prior.
+     */
+    static bool prunable(double ub, double priorMaxSqCor, double beat)
+      {
+        return ub <= 0.0 || (beat > 0.0 && ub * ub <= beat) || ub * ub < priorMaxSqCor;
+      }
+
+    /**
+     * True if no block of shifts [shift, shift + count) can matter,
+     * see prunable(). Fills in the shift and window counts.
+     */
+    bool shiftsPrunable(int shift,
+                     int count,
+                     int length1,
+                     int length2,
+                     int window,
+                     double priorMaxSqCor,
+                     double beat,
+                     const ShiftBounds& bounds,
+                     PruneStats& counts) const
+      {
+        bool ret = priorMaxSqCor > 0.0f || beat > 0.0;
+        const int block = bounds.block();
+        for (int s = shift; s < shift + count; ++s) {
+          const int numWindows = std::min(length1, length2 - s) - window + 1;
+          ++counts.shifts;
+          counts.windows += std::max(0, numWindows);
+          if (!ret) continue;
+          ShiftBounds::Cursor cursor(bounds, s);
+          for (int begin = 0; ret && begin < numWindows; begin += block) {
+            const int n = std::min(block, numWindows - begin);
+            ret = prunable(cursor.bound(begin, n), priorMaxSqCor, beat);
+          }
+        }
+        if (ret) counts.prunedShifts += count;
+        return ret;
+      }
+
+    /**
+     * maxCorShiftRange() a block of bounds.block() windows at a time,
+     * skipping the blocks that cannot matter (see prunable(); beat is
+     * the best found before shiftBegin, or -10). The windows that are
+     * visited get exactly the same arithmetic as before, so the result
+     * is the same as far as the caller can tell.
+     */
+    SqCorLoc maxCorShiftRangePruned(int shiftBegin,
+                     int shiftEnd,
+                     const Sample* y1,
+                     const Sample* y2,
+                     int length1,
+                     int length2,
+                     int window,
+                     const SumVar* y1Table,
+                     const SumVar* y2Table,
+                     double priorMaxSqCor,
+                     double beat,
+                     const ShiftBounds& bounds,
+                     PruneStats* stats) const
+      {
+        bool maxGreaterThan0 = priorMaxSqCor > 0.0f;
+        double currMax = -10.0f;
+        int loc1 = -1;
+        int loc2 = -1;
+        const int block = bounds.block();
+        PruneStats counts;
+
+        //Where the bounds keep failing (unrelated traces often do) they
+        //cost more than they save, so they are tried less and less often.
+        int backoff = 0;
+        int wait = 0;
+
+        for (int shift = shiftBegin; shift < shiftEnd; ++shift) {
+          const int numWindows = std::min(length1, length2 - shift) - window + 1;
+          if (numWindows <= 0) continue;
+
+          ShiftBounds::Cursor cursor(bounds, shift);
+          Sum prodSum = 0;
+          int sumAt = -1; //window prodSum is for, -1 if none yet
+          int searched = 0;
+
+          for (int begin = 0; begin < numWindows; begin += block) {
+            const int count = std::min(block, numWindows - begin);
+            if (!(maxGreaterThan0 || beat > 0.0)) {}
+            else if (wait > 0) --wait;
+            else if (prunable(cursor.bound(begin, count), priorMaxSqCor, std::max(beat, currMax))) {
+              counts.prunedWindows += count;
+              backoff = 0;
+              continue;
+            }
+            else {
+              backoff = std::min(2 * backoff + 1, 31);
+              wait = backoff;
+            }
+            searched += count;
+
+            //Bring prodSum up to the block, sliding over the skipped
+            //windows unless starting over is cheaper.
+            if (sumAt < 0 || begin - sumAt >= window) {
+              prodSum = 0;
+              for (int j = 0; j != window; ++j) {
+                const Sample v1 = y1[begin + j];
+                const Sample v2 = y2[begin + shift + j];
+                prodSum += Traits::product(v1, v2);
+              }
+            }
+            else {
+              for (int l1 = sumAt; l1 < begin; ++l1) {
+                const Sample old1 = y1[l1];
+                const Sample old2 = y2[l1 + shift];
+                prodSum -= Traits::product(old1, old2);
+                const Sample next1 = y1[l1 + window];
+                const Sample next2 = y2[l1 + shift + window];
+                prodSum += Traits::product(next1, next2);
+              }
+            }
+
+            const int end = begin + count;
+            for (int l1 = begin; ; ++l1) {
+              const SumVar& s1 = y1Table[l1];
+              const SumVar& s2 = y2Table[l1 + shift];
+              const double top = window * prodSum - s1.sum * s2.sum;
+              if (top > 0.0f) {
+                const double sqCor = top * top / (s1.var * s2.var);
+                if (sqCor > currMax) {
+                  currMax = sqCor;
+                  loc1 = l1;
+                  loc2 = loc1 + shift;
+                  maxGreaterThan0 = true;
+                }
+              }
+              else if (maxGreaterThan0) {}
+              else {
+                const double sqCor = -top * top / (s1.var * s2.var);
+                if (sqCor > currMax) {
+                  currMax = sqCor;
+                  loc1 = l1;
+                  loc2 = loc1 + shift;
+                }
+              }
+
+              if (l1 + 1 == end) break;
+              const Sample old1 = y1[l1];
+              const Sample old2 = y2[l1 + shift];
+              prodSum -= Traits::product(old1, old2);
+              const Sample next1 = y1[l1 + window];
+              const Sample next2 = y2[l1 + shift + window];
+              prodSum += Traits::product(next1, next2);
+            }
+            sumAt = end - 1;
+          }
+
+          ++counts.shifts;
+          counts.windows += numWindows;
+          if (searched == 0) ++counts.prunedShifts;
+        }
+
+        if (stats) *stats += counts;
+        return SqCorLoc(currMax, loc1, loc2);
+      }
+
+    /**
+     * The sums of one shift in surface(), for the pair at loc1 (-1
+     * before the first pair is summed). Unmasked, only s12 is kept; the table has the
+     * rest. Masked, they are over the samples valid in both windows.
+     */
+    struct Diagonal {
+      Diagonal() : loc1(-1), n(0), s1(0), s2(0), s11(0), s22(0), s12(0) {}
+      int loc1;
+      int n;
+      Sum s1, s2, s11, s22, s12;
+    };
+
+    ///Adds (sign 1) or takes out (sign -1) samples i1 and i2 of the traces.
+    static void addPair(Diagonal& d, const Prepared& t1, const Prepared& t2,
+                        int i1, int i2, int sign)
+      {
+        const Sample a = t1.data()[i1];
+        const Sample b = t2.data()[i2];
+        if (!t1.valid() && !t2.valid()) {
+          d.s12 += sign * Traits::product(a, b);
+          return;
+        }
+        if ((t1.valid() && !t1.valid()[i1]) || (t2.valid() && !t2.valid()[i2])) return;
+        d.n += sign;
+        d.s1 += sign * a;
+        d.s2 += sign * b;
+        d.s11 += sign * Traits::product(a, a);
+        d.s22 += sign * Traits::product(b, b);
+        d.s12 += sign * Traits::product(a, b);
+      }
+
+    /**
+     * r of the windows at loc1 and loc2, sliding d there from the pair
+     * before it on the same shift (or summing it afresh), with the
+     * arithmetic of maxCorShiftRange() and scanShiftMasked().
+     */
+    float surfaceCor(Diagonal& d, const Prepared& t1, const Prepared& t2,
+                     int loc1, int loc2) const
+      {
+        const int window = t1.window();
+        if (loc1 > 0 && d.loc1 == loc1 - 1) {
+          addPair(d, t1, t2, loc1 - 1, loc2 - 1, -1);
+          addPair(d, t1, t2, loc1 - 1 + window, loc2 - 1 + window, 1);
+        }
+        else {
+          d = Diagonal();
+          for (int j = 0; j != window; ++j)
+            addPair(d, t1, t2, loc1 + j, loc2 + j, 1);
+        }
+        d.loc1 = loc1;
+
+        const float undefined = std::numeric_limits<float>::quiet_NaN();
+        const SumVar& w1 = t1.table()[loc1];
+        const SumVar& w2 = t2.table()[loc2];
+        if (!t1.valid() && !t2.valid()) {
+          if (!(w1.var > 0.0) || !(w2.var > 0.0)) return undefined;
+          const double top = window * d.s12 - w1.sum * w2.sum;
+          return (float) (top / std::sqrt(w1.var * w2.var));
+        }
+
+        const int minValid = std::max(_minValid, 2);
+        if (w1.count < minValid || w2.count < minValid || d.n < minValid) return undefined;
+        const double top = d.n * (double) d.s12 - (double) d.s1 * (double) d.s2;
+        const double var1 = d.n * (double) d.s11 - (double) d.s1 * (double) d.s1;
+        const double var2 = d.n * (double) d.s22 - (double) d.s2 * (double) d.s2;
+        if (!(var1 > 0.0) || !(var2 > 0.0)) return undefined;
+        return (float) (top / std::sqrt(var1 * var2));
+      }
+
+    ///Shifts per block in peaks().
+    enum { PeakBlock = 32 };
+
+    /**
+     * The best non-overlapping peaks seen so far, at most k of them,
+     * best first. A peak replaces the ones it overlaps only if it is
+     * strictly better than all of them, and equal peaks keep the order
+     * they were offered in, as the strict > of the search does.
+     */
+    class PeakList {
+    public:
+      PeakList(int k, int minSeparation) : _k(k), _minSeparation(minSeparation) {}
+
+      ///Could a peak of this value get in?
+      bool accepts(double sqCor) const {
+        if (sqCor != sqCor) return false; //NaN is never a peak.
+        return (int) _peaks.size() < _k || sqCor > _peaks.back().sqCor();
+      }
+
+      void offer(const SqCorLoc& c) {
+        if (!accepts(c.sqCor())) return;
+
+        for (size_t i = 0; i < _peaks.size(); ++i) {
+          if (overlaps(c, _peaks[i]) && !(c > _peaks[i])) return;
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < _peaks.size(); ++i) {
+          if (!overlaps(c, _peaks[i])) _peaks[kept++] = _peaks[i];
+        }
+        _peaks.resize(kept, c);
+
+        size_t pos = 0;
+        while (pos < _peaks.size() && !(c > _peaks[pos])) ++pos;
+        _peaks.insert(_peaks.begin() + pos, c);
+        if ((int) _peaks.size() > _k) _peaks.pop_back();
+      }
+
+      const std::vector<SqCorLoc>& peaks() const { return _peaks; }
+
+    private:
+      bool overlaps(const SqCorLoc& a, const SqCorLoc& b) const {
+        return std::abs(a.loc1() - b.loc1()) < _minSeparation
+            && std::abs(a.loc2() - b.loc2()) < _minSeparation;
+      }
+
+      int _k;
+      int _minSeparation;
+      std::vector<SqCorLoc> _peaks;
+    };
+
+    /**
+     * The scan of maxCorShiftRange() over [shiftBegin, shiftEnd),
+     * offering every window to peaks instead of keeping the max.
+     * swapped -- y1 is the second trace; the locations are swapped
+     * back before they are offered. Masked traces are scanned with
+     * scanShiftMasked().
+     */
+    void peakShiftRange(int shiftBegin,
+                     int shiftEnd,
+                     const Sample* y1,
+                     const Sample* y2,
+                     int length1,
+                     int length2,
+                     int window,
+                     const SumVar* y1Table,
+                     const SumVar* y2Table,
+                     const unsigned char* v1,
+                     const unsigned char* v2,
+                     bool swapped,
+                     PeakList& peaks) const
+      {
+        if (v1 || v2) {
+          for (int shift = shiftBegin; shift < shiftEnd; ++shift) {
+            scanShiftMasked(shift, y1, y2, length1, length2, window, y1Table, y2Table, v1, v2,
+                            [&](int l1, double sqCor) {
+              if (!peaks.accepts(sqCor)) return;
+              if (swapped) peaks.offer(SqCorLoc(sqCor, l1 + shift, l1));
+              else peaks.offer(SqCorLoc(sqCor, l1, l1 + shift));
+            });
+          }
+          return;
+        }
+        for (int shift = shiftBegin; shift < shiftEnd; ++shift) {
+          const int numWindows = std::min(length1, length2 - shift) - window + 1;
+          if (numWindows <= 0) continue;
+
+          Sum prodSum = 0;
+          for (int j = 0; j != window; ++j) {
+            const Sample v1 = y1[j];
+            const Sample v2 = y2[shift + j];
+            prodSum += Traits::product(v1, v2);
+          }
+
+          for (int l1 = 0; ; ++l1) {
+            const SumVar& s1 = y1Table[l1];
+            const SumVar& s2 = y2Table[l1 + shift];
+            const double top = window * prodSum - s1.sum * s2.sum;
+            const double sqCor = (top > 0.0f) ? top * top / (s1.var * s2.var)
+                                              : -top * top / (s1.var * s2.var);
+            if (peaks.accepts(sqCor)) {
+              if (swapped) peaks.offer(SqCorLoc(sqCor, l1 + shift, l1));
+              else peaks.offer(SqCorLoc(sqCor, l1, l1 + shift));
+            }
+
+            if (l1 + 1 >= numWindows) break;
+            const Sample old1 = y1[l1];
+            const Sample old2 = y2[l1 + shift];
+            prodSum -= Traits::product(old1, old2);
+            const Sample next1 = y1[l1 + window];
+            const Sample next2 = y2[l1 + shift + window];
+            prodSum += Traits::product(next1, next2);
+          }
+        }
+      }
+
+    int _numThreads;
+    bool _prune;
+    int _minValid;
 
 
 
@@ -602,13 +1728,15 @@ class MaxCorrelationWithFlips {
  */
 //Laura Ekstrand (March 2013) - added maxShiftPercentage as leash for 
 //Opposite End Problem - see flipcorrelation.h:maxCorVaryingSecond().
+//numThreads, prune -- see MaxCorrelationWithFlips(); 1 and false are the
+//serial search. stats -- if not null, gets what pruning skipped.
 template<typename RandomAccessIter>
 FlippableCorLoc maxCorWithFlips(RandomAccessIter y1, RandomAccessIter y2, int length1, int length2, int window, float
-	maxShiftPercentage, bool checkFlip = true)
+	maxShiftPercentage, bool checkFlip = false, int numThreads = 1, bool prune = false, PruneStats* stats = 0)
 {
-    MaxCorrelationWithFlips<RandomAccessIter> f;
+    MaxCorrelationWithFlips<RandomAccessIter> f(numThreads, prune);
     try {
-         return f(y1, y2, length1, length2, window, maxShiftPercentage, checkFlip);
+         return f(y1, y2, length1, length2, window, maxShiftPercentage, checkFlip, stats);
     } catch (runtime_error err) { 
 #ifdef MYDEBUG
 		cout << "I am going to throw an error.\n"; 
@@ -618,4 +1746,60 @@ FlippableCorLoc maxCorWithFlips(RandomAccessIter y1, RandomAccessIter y2, int le
 	}
 }
 
+/**
+ * Convenience function for MaxCorrelationWithFlips::peaks().
+ */
+template<typename RandomAccessIter>
+std::vector<FlippableCorLoc> maxCorPeaks(RandomAccessIter y1, RandomAccessIter y2, int length1, int length2,
+    int window, float maxShiftPercentage, int k, int minSeparation = 0, int numThreads = 1)
+{
+    typedef MaxCorrelationWithFlips<RandomAccessIter> Search;
+    const typename Search::Prepared t1(y1, length1, window);
+    const typename Search::Prepared t2(y2, length2, window);
+    return Search(numThreads).peaks(t1, t2, maxShiftPercentage, k, minSeparation);
+}
+
+/**
+ * maxCorWithFlips() on two traces left where they are, without the
+ * flip check (see MaxCorrelationWithFlips::flipped() for that). If
+ * they are masked, minValid is as for MaxCorrelationWithFlips().
+ */
+template<typename Sample>
+FlippableCorLoc maxCorWithFlips(const TraceView<Sample>& y1, const TraceView<Sample>& y2, int window,
+    float maxShiftPercentage, int numThreads = 1, bool prune = false, PruneStats* stats = 0,
+    int minValid = 0)
+{
+    typedef MaxCorrelationWithFlips<const Sample*> Search;
+    const typename Search::Prepared t1(y1, window);
+    const typename Search::Prepared t2(y2, window);
+    return Search(numThreads, prune, minValid)(t1, t2, maxShiftPercentage, stats);
+}
+
+/**
+ * maxCorPeaks() on two traces left where they are.
+ */
+template<typename Sample>
+std::vector<FlippableCorLoc> maxCorPeaks(const TraceView<Sample>& y1, const TraceView<Sample>& y2,
+    int window, float maxShiftPercentage, int k, int minSeparation = 0, int numThreads = 1,
+    int minValid = 0)
+{
+    typedef MaxCorrelationWithFlips<const Sample*> Search;
+    const typename Search::Prepared t1(y1, window);
+    const typename Search::Prepared t2(y2, window);
+    return Search(numThreads, false, minValid).peaks(t1, t2, maxShiftPercentage, k, minSeparation);
+}
+
+/**
+ * MaxCorrelationWithFlips::surface() on two traces left where they are.
+ */
+template<typename Sample>
+void corSurface(const TraceView<Sample>& y1, const TraceView<Sample>& y2, int window,
+    SurfaceSink& sink, int numThreads = 1, int minValid = 0)
+{
+    typedef MaxCorrelationWithFlips<const Sample*> Search;
+    const typename Search::Prepared t1(y1, window);
+    const typename Search::Prepared t2(y2, window);
+    Search(numThreads, false, minValid).surface(t1, t2, sink);
+}
+
 #endif
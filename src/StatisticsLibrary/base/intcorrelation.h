@@ -29,6 +29,8 @@
 #include <cassert>
 #include "corloc.h"
 #include <cmath>
+#include <iterator>
+#include "sampletraits.h"
 #include <vector>
 using namespace std;
 
@@ -36,26 +38,30 @@ template<typename ForwardIter1, typename ForwardIter2>
 
 //Ru He comments:
 //return the squred corrlation with its sign
+//The samples are those of y1 (ints, or float or double depths); see
+//SampleTraits for how they are summed.
 double intCompCorr(ForwardIter1 y1, ForwardIter2 y2, int window)
 {
-    long long s1 = 0;
-    long long s2 = 0;
-    long long s11 = 0;
-    long long s22 = 0;
-    long long s12 = 0;
+    typedef typename std::iterator_traits<ForwardIter1>::value_type Sample;
+    typedef SampleTraits<Sample> Traits;
+    typename Traits::Sum s1 = 0;
+    typename Traits::Sum s2 = 0;
+    typename Traits::Sum s11 = 0;
+    typename Traits::Sum s22 = 0;
+    typename Traits::Sum s12 = 0;
   
     ForwardIter1 end = y1 + window;
     while (y1 != end) {
-        const int v1 = *y1++;
-        const int v2 = *y2++;
+        const Sample v1 = *y1++;
+        const Sample v2 = *y2++;
         
         s1 += v1;
-        s11 += v1 * v1;
+        s11 += Traits::product(v1, v1);
     
         s2 += v2;
-        s22 += v2 * v2;
+        s22 += Traits::product(v2, v2);
     
-        s12 += v1 * v2;
+        s12 += Traits::product(v1, v2);
     }
   
     double cs11 = double(window) * s11 - s1 * s1;
@@ -64,6 +70,51 @@ double intCompCorr(ForwardIter1 y1, ForwardIter2 y2, int window)
     return cs12 * fabs(cs12) / (cs11 * cs22);
 }
 
+/**
+ * intCompCorr() over just the samples valid in both windows.
+ * valid1, valid2 -- nonzero where y1, y2 are valid, from the start of
+ * the windows; null if all are.
+ * Returns false, leaving sqCor alone, if fewer than minValid (and 2)
+ * samples are valid in both or either window is constant over them.
+ */
+template<typename ForwardIter1, typename ForwardIter2>
+bool maskedCompCorr(ForwardIter1 y1, const unsigned char* valid1,
+                    ForwardIter2 y2, const unsigned char* valid2,
+                    int window, int minValid, double& sqCor)
+{
+    typedef typename std::iterator_traits<ForwardIter1>::value_type Sample;
+    typedef SampleTraits<Sample> Traits;
+    typename Traits::Sum s1 = 0;
+    typename Traits::Sum s2 = 0;
+    typename Traits::Sum s11 = 0;
+    typename Traits::Sum s22 = 0;
+    typename Traits::Sum s12 = 0;
+    int n = 0;
+
+    for (int i = 0; i < window; ++i, ++y1, ++y2) {
+        if ((valid1 && !valid1[i]) || (valid2 && !valid2[i])) continue;
+        const Sample v1 = *y1;
+        const Sample v2 = *y2;
+        ++n;
+
+        s1 += v1;
+        s11 += Traits::product(v1, v1);
+
+        s2 += v2;
+        s22 += Traits::product(v2, v2);
+
+        s12 += Traits::product(v1, v2);
+    }
+    if (n < minValid || n < 2) return false;
+
+    double cs11 = double(n) * s11 - s1 * s1;
+    double cs22 = double(n) * s22 - s2 * s2;
+    double cs12 = double(n) * s12 - s1 * s2;
+    if (!(cs11 > 0.0) || !(cs22 > 0.0)) return false;
+    sqCor = cs12 * fabs(cs12) / (cs11 * cs22);
+    return true;
+}
+
 //XXX! We could probably do a little template trickery
 //using numeric_limits<T>::is_integer to generalize
 //this method to deal with more int types, falling
@@ -76,6 +127,9 @@ double intCompCorr(ForwardIter1 y1, ForwardIter2 y2, int window)
  *
  * Requires: x.size() == y.size()
  *           x.size() >= window
+ *
+ * O(n^2 * window); fftMaxCorrelation() in fftcorrelation.h
+ * gives the same CorLoc in O(n^2).
  */
 CorLoc maxCorrelation(const vector<int>& x,
                       const vector<int>& y,
@@ -226,6 +280,8 @@ CorLoc maxCorrelation(const vector<int>& x,
 /**
  * Return the location and correlation of the pair of windows
  * of the given size with the maximum Pearson correlation coefficient.
+ *
+ * See also fftLeveledMaxCorrelation() in fftcorrelation.h.
  */
 CorLoc leveledMaxCorrelation(const vector<int>& x,
                              const vector<int>& y,
@@ -44,6 +44,21 @@ public:
 	       const std::vector<int>& y2,
 	       size_t pairs,
 	       size_t window)
+    {
+      GlobalRandom rng;
+      return (*this)(y1, y2, pairs, window, rng);
+    }
+
+  /**
+   * As above, drawing from rng (a RandomStream or GlobalRandom).
+   */
+  template<typename Rng>
+  std::auto_ptr<std::vector<double> >
+    operator()(const std::vector<int>& y1,
+	       const std::vector<int>& y2,
+	       size_t pairs,
+	       size_t window,
+	       Rng& rng)
     {
       std::auto_ptr<std::vector<double> >
 	result(new std::vector<double>(pairs));
@@ -51,12 +66,12 @@ public:
       
       for (size_t j = 0; j < pairs; ++j) {
 	std::vector<int>::const_iterator y1Begin =
-	  y1.begin() + static_cast<size_t>(r*random01());
+	  y1.begin() + static_cast<size_t>(r*rng.random01());
 	
 	//An offset into y2.
-	size_t i2 = static_cast<size_t>(r*random01());
+	size_t i2 = static_cast<size_t>(r*rng.random01());
 	
-	if (random01() < 0.5) {
+	if (rng.random01() < 0.5) {
 	  (*result)[j] = intCompCorr(y1Begin, y2.begin() + i2, window);
 	}
 	else {
@@ -75,6 +90,14 @@ public:
 
 class IntRigidCorSampExcludeSearch {
  public:
+  /**
+   * minValid -- for masked traces (a TraceView with valid flags), the
+   * fewest samples valid in both windows for a pair to count. Pairs
+   * with fewer are drawn again, up to MaxDraws times pairs in all,
+   * so fewer than pairs correlations may come back.
+   */
+  explicit IntRigidCorSampExcludeSearch(int minValid = 0) : _minValid(minValid) {}
+
   /**
    * Returns at most pairs correlations at rigid shifts about
    * the indices given in loc in y1 and y2. window is the length
@@ -92,8 +115,48 @@ class IntRigidCorSampExcludeSearch {
 	       size_t pairs,
 	       size_t window)
     {
-      std::auto_ptr<std::vector<double> >
-	  result(new std::vector<double>(pairs));
+      GlobalRandom rng;
+      return (*this)(y1, y2, l1, l2, searchWindow, pairs, window, rng);
+    }
+
+  /**
+   * As above, drawing from rng (a RandomStream or GlobalRandom).
+   * Trace1 and Trace2 are std::vectors or TraceViews (or a
+   * MirroredTraceView for a flipped trace), of ints, floats or doubles.
+   */
+  template<typename Trace1, typename Trace2, typename Rng>
+  std::auto_ptr<std::vector<double> >
+    operator()(const Trace1& y1,
+	       const Trace2& y2,
+	       int l1,
+	       int l2,
+	       size_t searchWindow,
+	       size_t pairs,
+	       size_t window,
+	       Rng& rng)
+    {
+      std::auto_ptr<std::vector<double> > result(new std::vector<double>);
+      (*this)(y1, y2, l1, l2, searchWindow, pairs, window, rng, *result);
+      return result;
+    }
+
+  /**
+   * As above, into result, which is resized to what comes back. Its
+   * storage is reused, so a result kept from sample to sample stops
+   * allocating once it has grown to pairs.
+   */
+  template<typename Trace1, typename Trace2, typename Rng>
+  void operator()(const Trace1& y1,
+	       const Trace2& y2,
+	       int l1,
+	       int l2,
+	       size_t searchWindow,
+	       size_t pairs,
+	       size_t window,
+	       Rng& rng,
+	       std::vector<double>& result)
+    {
+      result.resize(pairs);
       size_t nn1 = y1.size();
 	  size_t nn2 = y2.size();
       
@@ -121,8 +184,8 @@ class IntRigidCorSampExcludeSearch {
 	  //in order to get the rigid window on the left side of both search window, ilower <= -w, i.e., -ilower >= w
 	  //in order to get the rigid window on the right side of both search window, iupper >= sw
       if (ilower > -w && iupper < sw) {
-	     (*result).resize(0);
-	     return result;
+	     result.resize(0);
+	     return;
       }
     
 	  // somehow we do not want to get a rigid pair in the windows where 
@@ -131,15 +194,34 @@ class IntRigidCorSampExcludeSearch {
 	  // added by maverick
       RandomInSplitRange splitRand(ilower, -w, sw, iupper);
 
-      std::vector<int>::const_iterator y1Begin = y1.begin();
-      std::vector<int>::const_iterator y2Begin = y2.begin();
+      typename Trace1::const_iterator y1Begin = y1.begin();
+      typename Trace2::const_iterator y2Begin = y2.begin();
+      const unsigned char* valid1 = traceValid(y1);
+      const unsigned char* valid2 = traceValid(y2);
+      if (valid1 || valid2) {
+        size_t found = 0;
+        for (size_t draws = 0; found < pairs && draws < MaxDraws * pairs; ++draws) {
+          int i = splitRand(rng);
+          double c;
+          if (maskedCompCorr(y1Begin + l1 + i, validFrom(valid1, l1 + i),
+                             y2Begin + l2 + i, validFrom(valid2, l2 + i), w, _minValid, c))
+            result[found++] = c;
+        }
+        result.resize(found);
+        return;
+      }
       for (size_t j = 0; j < pairs; ++j) {
 		//Ru He comments: i will take range from [ilower, -w] U [sw, iupper]
-     	int i = splitRand();
-    	(*result)[j] = intCompCorr(y1Begin + l1 + i, y2Begin + l2 + i, window);
+     	int i = splitRand(rng);
+    	result[j] = intCompCorr(y1Begin + l1 + i, y2Begin + l2 + i, window);
       }
-      return result;
     }
+
+  ///Draws per pair asked for before giving up on masked traces.
+  enum { MaxDraws = 10 };
+
+ private:
+  int _minValid;
 };
 
 
@@ -148,6 +230,9 @@ class IntRigidCorSampExcludeSearch {
 //Replace the original code to do the random-window-pair comparisons to avoid the possible overlap of search window and random window
 class IntRandomCorSampExcludeSearch {
  public:
+  ///minValid -- as for IntRigidCorSampExcludeSearch.
+  explicit IntRandomCorSampExcludeSearch(int minValid = 0) : _minValid(minValid) {}
+
   /**
    * Returns at most pairs correlations at random shifts about
    * the indices given in loc in y1 and y2. randomWindow is the length
@@ -166,8 +251,46 @@ class IntRandomCorSampExcludeSearch {
 	       size_t pairs,
 	       size_t randomWindow)
     {
-      std::auto_ptr<std::vector<double> >
-	  result(new std::vector<double>(pairs));
+      GlobalRandom rng;
+      return (*this)(y1, y2, l1, l2, searchWindow, pairs, randomWindow, rng);
+    }
+
+  /**
+   * As above, drawing from rng (a RandomStream or GlobalRandom).
+   * Trace1 and Trace2 are std::vectors or TraceViews (or a
+   * MirroredTraceView for a flipped trace), of ints, floats or doubles.
+   */
+  template<typename Trace1, typename Trace2, typename Rng>
+  std::auto_ptr<std::vector<double> >
+    operator()
+	      (const Trace1& y1,
+	       const Trace2& y2,
+	       int l1,
+	       int l2,
+	       size_t searchWindow,
+	       size_t pairs,
+	       size_t randomWindow,
+	       Rng& rng)
+    {
+      std::auto_ptr<std::vector<double> > result(new std::vector<double>);
+      (*this)(y1, y2, l1, l2, searchWindow, pairs, randomWindow, rng, *result);
+      return result;
+    }
+
+  ///As above, into result; see IntRigidCorSampExcludeSearch.
+  template<typename Trace1, typename Trace2, typename Rng>
+  void operator()
+	      (const Trace1& y1,
+	       const Trace2& y2,
+	       int l1,
+	       int l2,
+	       size_t searchWindow,
+	       size_t pairs,
+	       size_t randomWindow,
+	       Rng& rng,
+	       std::vector<double>& result)
+    {
+      result.resize(pairs);
       size_t nn1 = y1.size();
 	  size_t nn2 = y2.size();
 
@@ -200,30 +323,50 @@ class IntRandomCorSampExcludeSearch {
 	  //if random window can not be sampled from Trace 1 or random window can not be sampled from Trace 2, then return empty vector
 	  if((leftShiftLBTrace1 > leftShiftUB && rightShiftLB > rightShiftUBTrace1) 
 		  || (leftShiftLBTrace2 > leftShiftUB && rightShiftLB > rightShiftUBTrace2 )){
-	     (*result).resize(0);
-	     return result;
+	     result.resize(0);
+	     return;
       }
 
       RandomInSplitRange splitRandTrace1(leftShiftLBTrace1, leftShiftUB, rightShiftLB, rightShiftUBTrace1);
 	  RandomInSplitRange splitRandTrace2(leftShiftLBTrace2, leftShiftUB, rightShiftLB, rightShiftUBTrace2);
 
-      std::vector<int>::const_iterator y1Begin = y1.begin();
-      std::vector<int>::const_iterator y2Begin = y2.begin();
+      typename Trace1::const_iterator y1Begin = y1.begin();
+      typename Trace2::const_iterator y2Begin = y2.begin();
 	        
 	  //Ru He comments:
       //shift1 is a random offset from l1, location of trace1.
 	  //shift2 is a random offset from l2, location of trace2.
 	  int shift1, shift2;
+      const unsigned char* valid1 = traceValid(y1);
+      const unsigned char* valid2 = traceValid(y2);
+      if (valid1 || valid2) {
+        size_t found = 0;
+        for (size_t draws = 0; found < pairs && draws < MaxDraws * pairs; ++draws) {
+          shift1 = splitRandTrace1(rng);
+          shift2 = splitRandTrace2(rng);
+          double c;
+          if (maskedCompCorr(y1Begin + l1 + shift1, validFrom(valid1, l1 + shift1),
+                             y2Begin + l2 + shift2, validFrom(valid2, l2 + shift2), w, _minValid, c))
+            result[found++] = c;
+        }
+        result.resize(found);
+        return;
+      }
       for (size_t j = 0; j < pairs; ++j) {
 		//Ru He comments: 
 		//shift1 will take range from [leftShiftLBTrace1, leftShiftUB] U [rightShiftLB, rightShiftUBTrace1]
 		//shift2 will take range from [leftShiftLBTrace2, leftShiftUB] U [rightShiftLB, rightShiftUBTrace2]
-     	shift1 = splitRandTrace1();
-		shift2 = splitRandTrace2();
-    	(*result)[j] = intCompCorr(y1Begin + l1 + shift1, y2Begin + l2 + shift2, randomWindow);
+     	shift1 = splitRandTrace1(rng);
+		shift2 = splitRandTrace2(rng);
+    	result[j] = intCompCorr(y1Begin + l1 + shift1, y2Begin + l2 + shift2, randomWindow);
       }
-      return result;
     }
+
+  ///Draws per pair asked for before giving up on masked traces.
+  enum { MaxDraws = 10 };
+
+ private:
+  int _minValid;
 };//class IntRandomCorSampExcludeSearch 
 
 
@@ -0,0 +1,110 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Minimal threading helpers for the statistics package.
+ *
+ * The package is plain C++ (it is also built outside of Qt as the
+ * stand-alone comparison app), so this uses std::thread rather than
+ * QtConcurrent.
+ */
+
+/**
+ * Resolves a requested thread count.
+ * numThreads <= 0 means "one per hardware thread".
+ * Always returns at least 1.
+ */
+inline int resolveNumThreads(int numThreads)
+{
+    if (numThreads <= 0)
+        numThreads = (int) std::thread::hardware_concurrency();
+    return (numThreads > 0) ? numThreads : 1;
+}
+
+/**
+ * Calls task(i) for every i in [0, numTasks) using up to numThreads
+ * threads, the calling thread included.
+ *
+ * Tasks are handed out in increasing order through a shared counter,
+ * so a task must not depend on which thread runs it; write results
+ * into a slot indexed by i and combine them afterwards in index order
+ * to keep the outcome deterministic.
+ *
+ * If a task throws, the remaining tasks are skipped and the first
+ * exception is rethrown on the calling thread once all threads have
+ * finished.
+ */
+template <typename Task>
+void parallelFor(int numTasks, int numThreads, Task task)
+{
+    numThreads = resolveNumThreads(numThreads);
+    if (numThreads > numTasks) numThreads = numTasks;
+    if (numThreads <= 1)
+    {
+        for (int i = 0; i < numTasks; ++i)
+            task(i);
+        return;
+    }
+
+    std::atomic<int> next(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    auto worker = [&]() {
+        for (;;)
+        {
+            const int i = next++;
+            if (i >= numTasks || failed) return;
+            try {
+                task(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(errorMutex);
+                if (!error) error = std::current_exception();
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads - 1);
+    for (int t = 1; t < numThreads; ++t)
+        threads.push_back(std::thread(worker));
+    worker();
+    for (size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+
+    if (error) std::rethrow_exception(error);
+}
+
+#endif
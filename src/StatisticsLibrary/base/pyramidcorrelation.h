@@ -0,0 +1,387 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#ifndef __PYRAMIDCORRELATION_H__
+#define __PYRAMIDCORRELATION_H__
+
+#include <algorithm>
+#include <cmath>
+#include "flipcorrelation.h"
+#include <iterator>
+#include <limits>
+#include "FlippableCorLoc.h"
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+/**
+ * Coarse-to-fine search for the max correlation of
+ * MaxCorrelationWithFlips, for long traces.
+ *
+ * Both traces are averaged down by 2 per level (each sample is the
+ * mean of the two below it, rounded for int samples), along with the window, for up to
+ * numLevels levels (2x, 4x, 8x by default) while the window stays at
+ * least MinWindow long. The exhaustive search runs on the coarsest
+ * level only and keeps its best few non-overlapping peaks; each one is
+ * then followed down the levels, looking only at the locations within
+ * radius of twice its position on the level above. The same leash
+ * (maxShiftPercentage) applies on every level.
+ *
+ * Masked traces (see TraceView) are searched as MaxCorrelationWithFlips
+ * searches them: a coarse sample is the mean of the valid ones below
+ * it, and is masked if neither is; a window pair counts only if both
+ * windows and their valid pairs have minValid samples (at least 2),
+ * minValid halved with the window on each level.
+ *
+ * This is not exact: a peak that does not show among the coarse
+ * candidates is missed. The result is always a window pair of the full
+ * traces, and its correlation is computed the way the exhaustive search
+ * does, so when the two agree on the locations they agree on r exactly.
+ */
+template <typename RandomAccessIter>
+class PyramidCorrelation {
+  private:
+    typedef typename std::iterator_traits<RandomAccessIter>::value_type Sample;
+
+  public:
+    ///The coarsest window is kept at least this long.
+    enum { MinWindow = 16 };
+
+    /**
+     * numLevels -- how many times to halve the traces at most.
+     * numCandidates -- coarse peaks to follow down.
+     * radius -- how far around a coarse peak to look on the next level.
+     * numThreads -- for the coarse search, see MaxCorrelationWithFlips.
+     * minValid -- for masked traces, as for MaxCorrelationWithFlips.
+     */
+    explicit PyramidCorrelation(int numLevels = 3,
+                                int numCandidates = 4,
+                                int radius = 2,
+                                int numThreads = 1,
+                                int minValid = 0) :
+        _numLevels(numLevels),
+        _numCandidates(numCandidates),
+        _radius(radius),
+        _numThreads(numThreads),
+        _minValid(minValid)
+    {
+    }
+
+    ///The best window pair found; see MaxCorrelationWithFlips::operator().
+    FlippableCorLoc operator()(RandomAccessIter y1,
+                               RandomAccessIter y2,
+                               int length1,
+                               int length2,
+                               int window,
+                               float maxShiftPercentage) const
+    {
+        return peaks(y1, y2, length1, length2, window, maxShiftPercentage, 1)[0];
+    }
+
+    /**
+     * The best k distinct window pairs the refined candidates ended
+     * up at, best first. At least one, fewer than k if fewer coarse
+     * candidates were found (at least max(k, numCandidates) are
+     * followed). Throws std::range_error if no window pair counts.
+     */
+    std::vector<FlippableCorLoc> peaks(RandomAccessIter y1,
+                                       RandomAccessIter y2,
+                                       int length1,
+                                       int length2,
+                                       int window,
+                                       float maxShiftPercentage,
+                                       int k) const
+    {
+        return search(y1, 0, length1, y2, 0, length2, window, maxShiftPercentage, k);
+    }
+
+    ///As above, for traces that may be masked.
+    std::vector<FlippableCorLoc> peaks(const TraceView<Sample>& y1,
+                                       const TraceView<Sample>& y2,
+                                       int window,
+                                       float maxShiftPercentage,
+                                       int k) const
+    {
+        return search(y1.begin(), y1.valid(), (int) y1.size(),
+                      y2.begin(), y2.valid(), (int) y2.size(), window, maxShiftPercentage, k);
+    }
+
+  private:
+    typedef SampleTraits<Sample> Traits;
+    typedef std::vector<Sample> Trace;
+
+    ///One level of a trace; valid is empty if every sample is valid.
+    struct Level {
+        Trace y;
+        std::vector<unsigned char> valid;
+
+        TraceView<Sample> view() const
+        {
+            return TraceView<Sample>(y.data(), y.size(), valid.empty() ? 0 : valid.data());
+        }
+    };
+
+    ///A window pair and its signed squared correlation; loc1 is -1 for none.
+    struct Loc {
+        int loc1;
+        int loc2;
+        double sqCor;
+    };
+
+    template <typename Iter>
+    std::vector<FlippableCorLoc> search(Iter y1,
+                                        const unsigned char* v1,
+                                        int length1,
+                                        Iter y2,
+                                        const unsigned char* v2,
+                                        int length2,
+                                        int window,
+                                        float maxShiftPercentage,
+                                        int k) const
+    {
+        if (length1 < 0 || length2 < 0 || window < 0 || window > length1 || window > length2) {
+            std::ostringstream what;
+            what << "window not in [0, length1] and [0, length2]: [window=" << window
+                 << ", length1=" << length1 << ", length2=" << length2 << "]";
+            throw std::out_of_range(what.str());
+        }
+
+        //levels[0] is the full trace, levels[i] is halved i times.
+        std::vector<Level> levels1(1), levels2(1);
+        std::vector<int> windows(1, window);
+        levels1[0].y.assign(y1, y1 + length1);
+        levels2[0].y.assign(y2, y2 + length2);
+        if (v1) levels1[0].valid.assign(v1, v1 + length1);
+        if (v2) levels2[0].valid.assign(v2, v2 + length2);
+        while ((int) windows.size() <= _numLevels && windows.back() / 2 >= MinWindow) {
+            levels1.push_back(halve(levels1.back()));
+            levels2.push_back(halve(levels2.back()));
+            windows.push_back(windows.back() / 2);
+        }
+        const int top = (int) windows.size() - 1;
+
+        typedef MaxCorrelationWithFlips<const Sample*> Search;
+        const typename Search::Prepared coarse1(levels1[top].view(), windows[top]);
+        const typename Search::Prepared coarse2(levels2[top].view(), windows[top]);
+        const std::vector<FlippableCorLoc> coarse = Search(_numThreads, false, minValidAt(top)).peaks(
+            coarse1, coarse2, maxShiftPercentage, std::max(k, _numCandidates));
+
+        std::vector<Loc> found;
+        for (size_t i = 0; i < coarse.size(); ++i) {
+            Loc c = {coarse[i].loc1(), coarse[i].loc2(), 0.0};
+            for (int level = top - 1; level >= 0 && c.loc1 >= 0; --level) {
+                c = refine(levels1[level], levels2[level], windows[level], minValidAt(level),
+                           maxShiftPercentage, 2 * c.loc1, 2 * c.loc2);
+            }
+            if (top == 0 && !sqCor(levels1[0], levels2[0], c.loc1, c.loc2, window, minValidAt(0), c.sqCor))
+                c.loc1 = -1;
+            //Nothing within radius of this candidate counts.
+            if (c.loc1 < 0) continue;
+
+            //Stable: equal values keep the order of the coarse peaks.
+            bool seen = false;
+            for (size_t j = 0; j < found.size(); ++j) {
+                if (found[j].loc1 == c.loc1 && found[j].loc2 == c.loc2) seen = true;
+            }
+            if (seen) continue;
+            size_t pos = 0;
+            while (pos < found.size() && !(c.sqCor > found[pos].sqCor)) ++pos;
+            found.insert(found.begin() + pos, c);
+        }
+        if (found.empty()) {
+            std::ostringstream what;
+            what << "no window pair of the pyramid search has a correlation: [window=" << window
+                 << ", minValid=" << minValidAt(0) << "]";
+            throw std::range_error(what.str());
+        }
+
+        std::vector<FlippableCorLoc> ret;
+        for (size_t i = 0; i < found.size() && (int) i < std::max(k, 1); ++i) {
+            const double sq = found[i].sqCor;
+            const double cor = (sq >= 0.0f) ? std::sqrt(sq) : -std::sqrt(-sq);
+            ret.push_back(FlippableCorLoc(cor, found[i].loc1, found[i].loc2, false));
+        }
+        return ret;
+    }
+
+    ///minValid for the window halved level times; at least 2.
+    int minValidAt(int level) const
+    {
+        return std::max((std::max(_minValid, 0) + (1 << level) - 1) >> level, 2);
+    }
+
+    /**
+     * Averages pairs of samples; an odd last sample is dropped. Of a
+     * pair with one valid sample, that sample is kept.
+     */
+    static Level halve(const Level& in)
+    {
+        const bool integer = std::numeric_limits<Sample>::is_integer;
+        const bool masked = !in.valid.empty();
+        Level ret;
+        ret.y.resize(in.y.size() / 2);
+        if (masked) ret.valid.resize(ret.y.size());
+        for (size_t i = 0; i < ret.y.size(); ++i) {
+            const bool ok1 = !masked || in.valid[2 * i];
+            const bool ok2 = !masked || in.valid[2 * i + 1];
+            double mean;
+            if (ok1 == ok2) mean = (in.y[2 * i] + (double) in.y[2 * i + 1]) / 2.0;
+            else mean = ok1 ? in.y[2 * i] : in.y[2 * i + 1];
+            ret.y[i] = (Sample) (integer ? std::floor(mean + 0.5) : mean);
+            if (masked) ret.valid[i] = (ok1 || ok2) ? 1 : 0;
+        }
+        return ret;
+    }
+
+    /**
+     * Signed squared correlation of the windows at loc1 and loc2,
+     * with the arithmetic of MaxCorrelationWithFlips, into s. False if
+     * the pair does not count there (masked traces only).
+     */
+    static bool sqCor(const Level& y1, const Level& y2, int loc1, int loc2, int window,
+                      int minValid, double& s)
+    {
+        const unsigned char* v1 = y1.valid.empty() ? 0 : &y1.valid[loc1];
+        const unsigned char* v2 = y2.valid.empty() ? 0 : &y2.valid[loc2];
+        const Sample* d1 = &y1.y[loc1];
+        const Sample* d2 = &y2.y[loc2];
+        typename Traits::Sum sum1 = 0, sum2 = 0, sqSum1 = 0, sqSum2 = 0, prodSum = 0;
+        if (!v1 && !v2) {
+            for (int j = 0; j != window; ++j) {
+                sum1 += d1[j];
+                sum2 += d2[j];
+                sqSum1 += Traits::product(d1[j], d1[j]);
+                sqSum2 += Traits::product(d2[j], d2[j]);
+                prodSum += Traits::product(d1[j], d2[j]);
+            }
+            const double var1 = 1.0 * window * sqSum1 - sum1 * sum1;
+            const double var2 = 1.0 * window * sqSum2 - sum2 * sum2;
+            const double top = window * prodSum - (double) sum1 * (double) sum2;
+            s = (top > 0.0f) ? top * top / (var1 * var2) : -top * top / (var1 * var2);
+            return true;
+        }
+
+        int n = 0, n1 = 0, n2 = 0;
+        for (int j = 0; j != window; ++j) {
+            const bool ok1 = !v1 || v1[j];
+            const bool ok2 = !v2 || v2[j];
+            n1 += ok1;
+            n2 += ok2;
+            if (!ok1 || !ok2) continue;
+            ++n;
+            sum1 += d1[j];
+            sum2 += d2[j];
+            sqSum1 += Traits::product(d1[j], d1[j]);
+            sqSum2 += Traits::product(d2[j], d2[j]);
+            prodSum += Traits::product(d1[j], d2[j]);
+        }
+        if (n1 < minValid || n2 < minValid || n < minValid) return false;
+        const double top = n * (double) prodSum - (double) sum1 * (double) sum2;
+        const double var1 = n * (double) sqSum1 - (double) sum1 * (double) sum1;
+        const double var2 = n * (double) sqSum2 - (double) sum2 * (double) sum2;
+        if (!(var1 > 0.0) || !(var2 > 0.0)) return false;
+        s = (top > 0.0f) ? top * top / (var1 * var2) : -top * top / (var1 * var2);
+        return true;
+    }
+
+    /**
+     * Best window pair within _radius of (center1, center2) that the
+     * leash allows and that counts; the first one in (loc1, loc2)
+     * order on ties. loc1 is -1 if there is none.
+     */
+    Loc refine(const Level& y1, const Level& y2, int window, int minValid,
+               float maxShiftPercentage, int center1, int center2) const
+    {
+        const int length1 = y1.y.size();
+        const int length2 = y2.y.size();
+        //As in maxCorVaryingSecond(), for either trace shifted right.
+        const int maxShift2 = maxShiftPercentage * (length2 - window);
+        const int maxShift1 = maxShiftPercentage * (length1 - window);
+
+        const int begin1 = std::max(0, center1 - _radius);
+        const int end1 = std::min(length1 - window, center1 + _radius);
+        const int begin2 = std::max(0, center2 - _radius);
+        const int end2 = std::min(length2 - window, center2 + _radius);
+
+        Loc best = {-1, -1, -10.0};
+        for (int loc1 = begin1; loc1 <= end1; ++loc1) {
+            for (int loc2 = begin2; loc2 <= end2; ++loc2) {
+                const int shift = loc2 - loc1;
+                if (shift >= 0 ? shift > maxShift2 : -shift > maxShift1) continue;
+                double s;
+                if (!sqCor(y1, y2, loc1, loc2, window, minValid, s)) continue;
+                if (best.loc1 < 0 || s > best.sqCor) {
+                    best.loc1 = loc1;
+                    best.loc2 = loc2;
+                    best.sqCor = s;
+                }
+            }
+        }
+        return best;
+    }
+
+    int _numLevels;
+    int _numCandidates;
+    int _radius;
+    int _numThreads;
+    int _minValid;
+};
+
+/**
+ * Convenience function for PyramidCorrelation::operator().
+ */
+template<typename RandomAccessIter>
+FlippableCorLoc maxCorPyramid(RandomAccessIter y1, RandomAccessIter y2, int length1, int length2,
+    int window, float maxShiftPercentage, int numLevels = 3, int numThreads = 1)
+{
+    return PyramidCorrelation<RandomAccessIter>(numLevels, 4, 2, numThreads)(
+        y1, y2, length1, length2, window, maxShiftPercentage);
+}
+
+/**
+ * Convenience function for PyramidCorrelation::peaks().
+ */
+template<typename RandomAccessIter>
+std::vector<FlippableCorLoc> maxCorPyramidPeaks(RandomAccessIter y1, RandomAccessIter y2,
+    int length1, int length2, int window, float maxShiftPercentage, int k,
+    int numLevels = 3, int numThreads = 1)
+{
+    return PyramidCorrelation<RandomAccessIter>(numLevels, std::max(4, k), 2, numThreads).peaks(
+        y1, y2, length1, length2, window, maxShiftPercentage, k);
+}
+
+/**
+ * maxCorPyramidPeaks() on two traces left where they are. If they are
+ * masked, minValid is as for MaxCorrelationWithFlips().
+ */
+template<typename Sample>
+std::vector<FlippableCorLoc> maxCorPyramidPeaks(const TraceView<Sample>& y1, const TraceView<Sample>& y2,
+    int window, float maxShiftPercentage, int k, int numLevels = 3, int numThreads = 1,
+    int minValid = 0)
+{
+    return PyramidCorrelation<const Sample*>(numLevels, std::max(4, k), 2, numThreads, minValid).peaks(
+        y1, y2, window, maxShiftPercentage, k);
+}
+
+#endif
@@ -72,6 +72,22 @@ class RandomInSplitRange {
    */
   int operator()();
 
+  /**
+   * Returns the next int from the range, drawn from rng
+   * (a RandomStream or GlobalRandom).
+   */
+  template<typename Rng>
+  int operator()(Rng& rng)
+  {
+    std::size_t i = rng.randomInRange(0, lenMinus1);
+    if (i < ablen) {
+      return a + static_cast<int>(i);
+    }
+    else {
+      return c + static_cast<int>(i - ablen);
+    }
+  }
+
  private:
   int a;
   int c;
@@ -96,19 +112,107 @@ class RandomUpTo {
 int randomUpTo(int n);
 
 /**
- * SAMPLE WITHOUT REPLACEMENT:
- * Sets the range [result, result + sampleSize) equal
- * to sampleSize pseudorandom draws without replacement from
- * the integers (size_t) in [0, n), each integer
- * having an equal chance of getting drawn.
- *
- * For repeatable results, call setSeed(.) prior
- * to calling this method.
+ * The global generator used by the free functions above,
+ * wrapped to look like a RandomStream. Code that is templated
+ * on its generator gets the old behavior with this one.
+ */
+class GlobalRandom {
+ public:
+  double random01() { return ::random01(); }
+  std::size_t randomInRange(std::size_t lower, std::size_t upper)
+    { return ::randomInRange(lower, upper); }
+};
+
+/**
+ * A counter-based pseudorandom stream (SplitMix64), so that
+ * separate threads can each draw from their own stream without
+ * touching the global generator.
  *
- * Returns result + sampleSize.
+ * A stream is keyed by (seed, comparison id, sample id) and the
+ * n-th draw is a pure function of the key and n, so a stream is
+ * just two integers: it is cheap to make one per task, and the
+ * same key always gives the same sequence no matter which thread
+ * or in what order the tasks run. Different keys give unrelated
+ * sequences.
  */
-template<typename OutputIterator>
-inline OutputIterator randomSample(std::size_t n, std::size_t sampleSize, OutputIterator result)
+class RandomStream {
+ public:
+  RandomStream(unsigned long seed,
+               unsigned long long comparison,
+               unsigned long long sample)
+    : _key(mix(mix(mix(seed) + comparison) + sample)), _counter(0) {}
+
+  /**
+   * Returns the next 64 random bits.
+   */
+  unsigned long long next() { return at(_key, ++_counter); }
+
+  /**
+   * Returns draw number n (n >= 1) of the stream with the given key,
+   * without any state.
+   */
+  static unsigned long long at(unsigned long long key, unsigned long long n)
+  {
+    return finalize(key + n * 0x9E3779B97F4A7C15ULL);
+  }
+
+  /**
+   * Returns a draw from U[0,1) (53 random bits).
+   */
+  double random01()
+  {
+    return (next() >> 11) * (1.0 / 9007199254740992.0);
+  }
+
+  /**
+   * Returns an integer in [lower, upper], each with equal probability.
+   */
+  std::size_t randomInRange(std::size_t lower, std::size_t upper)
+  {
+    const std::size_t range = upper - lower + 1;
+    return static_cast<std::size_t>(range * random01()) + lower;
+  }
+
+  /**
+   * Returns an integer in [0, n-1]. Undefined for n <= 0.
+   */
+  int randomUpTo(int n) { return static_cast<int>(n * random01()); }
+
+  /**
+   * Returns an integer in [0, n), like RandomUpTo.
+   */
+  std::size_t operator()(std::size_t n)
+  {
+    return static_cast<std::size_t>(n * random01());
+  }
+
+  unsigned long long key() const { return _key; }
+  unsigned long long counter() const { return _counter; }
+
+ private:
+  static unsigned long long finalize(unsigned long long z)
+  {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+  static unsigned long long mix(unsigned long long x)
+  {
+    return finalize(x + 0x9E3779B97F4A7C15ULL);
+  }
+
+  unsigned long long _key;
+  unsigned long long _counter;
+};
+
+/**
+ * SAMPLE WITHOUT REPLACEMENT, drawing from rng
+ * (a RandomStream or GlobalRandom); see below.
+ */
+template<typename OutputIterator, typename Rng>
+inline OutputIterator randomSample(std::size_t n, std::size_t sampleSize, OutputIterator result,
+                                   Rng& rng)
 {
   //I looked at the following code while implementing this:
   //http://www.swarm.org/pipermail/support/1996-August/000620.html, which 
@@ -168,7 +272,7 @@ void Select(int n, int N, int* result) {
   std::size_t t = 0;
   std::size_t m = 0;
   while (m < sampleSize) {
-    double u = random01();
+    double u = rng.random01();
     if ((n - t) * u < (sampleSize - m)) {
       *result = t;
       ++result;
@@ -179,6 +283,25 @@ void Select(int n, int N, int* result) {
   return result;
 }
 
+/**
+ * SAMPLE WITHOUT REPLACEMENT:
+ * Sets the range [result, result + sampleSize) equal
+ * to sampleSize pseudorandom draws without replacement from
+ * the integers (size_t) in [0, n), each integer
+ * having an equal chance of getting drawn.
+ *
+ * For repeatable results, call setSeed(.) prior
+ * to calling this method.
+ *
+ * Returns result + sampleSize.
+ */
+template<typename OutputIterator>
+inline OutputIterator randomSample(std::size_t n, std::size_t sampleSize, OutputIterator result)
+{
+  GlobalRandom rng;
+  return randomSample(n, sampleSize, result, rng);
+}
+
 /**
  * Returns an integer in the union of the ranges
  * [a,b] U [c,d]. Requires that a <= b <= c <= d.
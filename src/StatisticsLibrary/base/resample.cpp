@@ -0,0 +1,141 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#include "resample.h"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+///A grid point closer than this to a sample, in samples, falls on it.
+static const double OnSample = 1e-9;
+
+/**
+ * The Linear kernel without valid flags: the same numbers as the loop
+ * in operator(), without its special cases. Snapping onto a sample is
+ * arithmetic, and the last sample pairs with itself.
+ */
+static void linearUnmasked(const float* y, int length, double step, float* out, int numOut)
+{
+    for (int j = 0; j < numOut; ++j) {
+        const double t = j * step;
+        const int up = (t - (int) t) > 1.0 - OnSample;
+        const int i = std::min((int) t + up, length - 1);
+        const int next = std::min(i + 1, length - 1);
+        const double d = t - i;
+        const double f = (d < OnSample) ? 0.0 : d;
+        out[j] = (float) (y[i] + f * (y[next] - y[i]));
+    }
+}
+
+TraceResampler::TraceResampler(Kernel kernel, int lobes) :
+    _kernel(kernel),
+    _lobes(std::max(lobes, 1))
+{
+}
+
+int TraceResampler::resampledLength(int length, double fromPixel, double toPixel)
+{
+    if (length <= 0) return 0;
+    return (int) std::floor((length - 1) * fromPixel / toPixel + OnSample) + 1;
+}
+
+void TraceResampler::operator()(const float* y,
+                                const unsigned char* valid,
+                                int length,
+                                double fromPixel,
+                                double toPixel,
+                                std::vector<float>& out,
+                                std::vector<unsigned char>* outValid) const
+{
+    if (!(fromPixel > 0.0) || !(toPixel > 0.0)) {
+        std::ostringstream what;
+        what << "pixel sizes must be > 0: [fromPixel=" << fromPixel << ", toPixel=" << toPixel << "]";
+        throw std::invalid_argument(what.str());
+    }
+
+    const int numOut = resampledLength(length, fromPixel, toPixel);
+    const double step = toPixel / fromPixel; //in input samples
+    out.resize(numOut);
+    if (outValid) outValid->resize(numOut);
+
+    if (Linear == _kernel && !valid) {
+        linearUnmasked(y, length, step, out.data(), numOut);
+        if (outValid) std::fill(outValid->begin(), outValid->end(), 1);
+        return;
+    }
+
+    //Lanczos: the kernel is L(scale * d) at d samples from the grid
+    //point, and reaches out radius samples either way.
+    const double pi = std::acos(-1.0);
+    const double scale = std::min(1.0, 1.0 / step);
+    const double radius = _lobes / scale;
+    const double dTheta = pi * scale;
+    const double cosD = std::cos(dTheta), sinD = std::sin(dTheta);
+    const double cosDa = std::cos(dTheta / _lobes), sinDa = std::sin(dTheta / _lobes);
+
+    for (int j = 0; j < numOut; ++j) {
+        const double t = std::min(j * step, (double) (length - 1));
+        int i = (int) std::floor(t);
+        double f = t - i;
+        if (f > 1.0 - OnSample) {
+            ++i;
+            f = 0.0;
+        }
+        const bool onSample = f < OnSample || i == length - 1;
+        const float linear = onSample ? y[i] : (float) (y[i] + f * (y[i + 1] - y[i]));
+        const bool ok = !valid || (onSample ? valid[i] != 0 : valid[i] && valid[i + 1]);
+        out[j] = linear;
+        if (outValid) (*outValid)[j] = ok ? 1 : 0;
+        if (Linear == _kernel || (onSample && 1.0 == scale) || !ok) continue;
+
+        //Windowed sinc over the valid taps, by rotating sin(pi x) and
+        //sin(pi x / lobes) from one tap to the next.
+        const int first = std::max(0, (int) std::ceil(t - radius));
+        const int last = std::min(length - 1, (int) std::floor(t + radius));
+        const double x0 = (first - t) * scale;
+        double s = std::sin(pi * x0), c = std::cos(pi * x0);
+        double sa = std::sin(pi * x0 / _lobes), ca = std::cos(pi * x0 / _lobes);
+        double sum = 0.0, weightSum = 0.0;
+        for (int k = first; k <= last; ++k) {
+            const double x = (k - t) * scale;
+            if (!valid || valid[k]) {
+                const double w = (std::fabs(x) < OnSample)
+                    ? 1.0
+                    : (std::fabs(x) >= _lobes) ? 0.0 : _lobes * s * sa / (pi * pi * x * x);
+                sum += w * y[k];
+                weightSum += w;
+            }
+            const double s1 = s * cosD + c * sinD;
+            c = c * cosD - s * sinD;
+            s = s1;
+            const double sa1 = sa * cosDa + ca * sinDa;
+            ca = ca * cosDa - sa * sinDa;
+            sa = sa1;
+        }
+        //Too little of the kernel left to trust; keep the linear value.
+        if (weightSum > 0.5)
+            out[j] = (float) (sum / weightSum);
+    }
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#ifndef __RESAMPLE_H__
+#define __RESAMPLE_H__
+
+#include <vector>
+
+/**
+ * Puts a trace sampled every fromPixel um onto a grid every toPixel
+ * um, both starting at its first sample, so that traces taken at
+ * different resolutions can be compared sample for sample.
+ *
+ * Linear interpolates between the two samples around each grid point.
+ * Lanczos is a windowed sinc with lobes lobes on each side; going to a
+ * coarser grid, the kernel is widened by toPixel / fromPixel so that
+ * detail the new grid cannot hold is filtered out rather than aliased.
+ *
+ * With valid flags (nonzero = valid), masked samples take no part:
+ * the weights of the valid taps are renormalized to add up to 1, and a
+ * grid point is valid only if the samples on either side of it are
+ * (the sample itself, if it falls on one). Without them every sample
+ * is used.
+ */
+class TraceResampler {
+  public:
+    enum Kernel {
+        Linear = 0,
+        Lanczos = 1
+    };
+
+    explicit TraceResampler(Kernel kernel = Linear, int lobes = 3);
+
+    ///The number of grid points within a trace of length samples.
+    static int resampledLength(int length, double fromPixel, double toPixel);
+
+    /**
+     * Resamples y (length samples, valid may be null) into out, and
+     * its valid flags into outValid if that is not null. Grid points
+     * that come out invalid hold the linear interpolation anyway.
+     * Throws std::invalid_argument unless both pixel sizes are > 0.
+     */
+    void operator()(const float* y,
+                    const unsigned char* valid,
+                    int length,
+                    double fromPixel,
+                    double toPixel,
+                    std::vector<float>& out,
+                    std::vector<unsigned char>* outValid = 0) const;
+
+  private:
+    Kernel _kernel;
+    int _lobes;
+};
+
+#endif
@@ -0,0 +1,129 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#ifndef __SAMPLETRAITS_H__
+#define __SAMPLETRAITS_H__
+
+#include <cstddef>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+/**
+ * How the correlation code accumulates samples of type T.
+ *
+ * Integer samples (the traces scaled by 100 and rounded, see
+ * ConvertTraceToInt) are summed exactly in long long, with the
+ * products taken in T as the original int code did. Floating samples
+ * (float or double depths) are summed in double.
+ */
+template <typename T, bool Integer = std::numeric_limits<T>::is_integer>
+struct SampleTraits {
+    typedef long long Sum;
+
+    static Sum product(T a, T b) { return a * b; }
+};
+
+template <typename T>
+struct SampleTraits<T, false> {
+    typedef double Sum;
+
+    static Sum product(T a, T b) { return (double) a * b; }
+};
+
+/**
+ * A trace that lives somewhere else: a pointer and a length, and
+ * optionally which samples are valid (nonzero where valid, as a
+ * Profile mask has it; null if all are). Nothing is copied, so the
+ * data must outlive the view.
+ *
+ * It has the parts of std::vector the correlation code uses, so the
+ * validation functors take either.
+ */
+template <typename T>
+class TraceView {
+  public:
+    typedef T value_type;
+    typedef const T* const_iterator;
+
+    TraceView() : _data(0), _size(0), _valid(0) {}
+    TraceView(const T* data, size_t size, const unsigned char* valid = 0) :
+        _data(data), _size(size), _valid(valid) {}
+
+    const T* data() const { return _data; }
+    const_iterator begin() const { return _data; }
+    const_iterator end() const { return _data + _size; }
+    size_t size() const { return _size; }
+    const T& operator[](size_t i) const { return _data[i]; }
+    ///The valid flags, or null if every sample is valid.
+    const unsigned char* valid() const { return _valid; }
+
+  private:
+    const T* _data;
+    size_t _size;
+    const unsigned char* _valid;
+};
+
+/**
+ * A trace read back to front without copying it: sample i is sample
+ * size() - 1 - i of the TraceView it is made from. Its valid flags, if
+ * any, must be given in that order (the flags of a flipped Profile).
+ */
+template <typename T>
+class MirroredTraceView {
+  public:
+    typedef T value_type;
+    typedef std::reverse_iterator<const T*> const_iterator;
+
+    MirroredTraceView(const TraceView<T>& y, const unsigned char* valid = 0) :
+        _y(y), _valid(valid) {}
+
+    const_iterator begin() const { return const_iterator(_y.end()); }
+    const_iterator end() const { return const_iterator(_y.begin()); }
+    size_t size() const { return _y.size(); }
+    const T& operator[](size_t i) const { return _y[_y.size() - 1 - i]; }
+    const unsigned char* valid() const { return _valid; }
+
+  private:
+    TraceView<T> _y;
+    const unsigned char* _valid;
+};
+
+///The valid flags of a trace; a std::vector has none (all valid).
+template <typename T>
+const unsigned char* traceValid(const std::vector<T>&) { return 0; }
+
+template <typename T>
+const unsigned char* traceValid(const TraceView<T>& y) { return y.valid(); }
+
+template <typename T>
+const unsigned char* traceValid(const MirroredTraceView<T>& y) { return y.valid(); }
+
+///The flags from sample i on, or null if there are none.
+inline const unsigned char* validFrom(const unsigned char* valid, int i)
+{
+    return valid ? valid + i : 0;
+}
+
+#endif
@@ -0,0 +1,341 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#ifndef __SHIFTBOUNDS_H__
+#define __SHIFTBOUNDS_H__
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/**
+ * What the pruned search in MaxCorrelationWithFlips visited and skipped.
+ */
+struct PruneStats {
+    PruneStats() : shifts(0), prunedShifts(0), windows(0), prunedWindows(0) {}
+
+    PruneStats& operator+=(const PruneStats& s)
+    {
+        shifts += s.shifts;
+        prunedShifts += s.prunedShifts;
+        windows += s.windows;
+        prunedWindows += s.prunedWindows;
+        return *this;
+    }
+
+    long long shifts;        ///< Shifts searched.
+    long long prunedShifts;  ///< Shifts none of whose windows were visited.
+    long long windows;       ///< Windows over all shifts.
+    long long prunedWindows; ///< Windows skipped.
+};
+
+/**
+ * Upper bounds on the correlation of a block of windows at one shift,
+ * for the pruned search in MaxCorrelationWithFlips.
+ *
+ * A block is the windows starting at loc1 in [begin, begin + block())
+ * in the first trace and loc1 + shift in the second. All of them
+ * contain the same run of block()-long segments, starting block() after
+ * begin; what is left of each window is two edges inside a fixed pair
+ * of regions. Writing C = sum (x - xbar)(y - ybar) over the window:
+ *
+ *  - on a segment, C splits into the deviations from the segment means,
+ *    bounded by Cauchy-Schwarz, plus block() times the product of the
+ *    segment means less the window means;
+ *  - on the edges, C is bounded by Cauchy-Schwarz over the regions.
+ *
+ * The window means only enter through their range over the block, so
+ * the bound holds for every window of the block at once. It needs the
+ * segment sums and spreads of each trace (computed once here) and one
+ * sum of products of segment values per block, which slides from block
+ * to block along a shift like the window dot products do.
+ *
+ * The bound is on the correlation itself, with a small margin for the
+ * rounding of both it and the exact search, so a block can be skipped
+ * when it cannot beat a given squared correlation.
+ */
+class ShiftBounds {
+  public:
+    /**
+     * Table is MaxCorrelationWithFlips::SumVar (anything with sum and var).
+     */
+    template <typename Table>
+    ShiftBounds(const int* y1,
+                const int* y2,
+                int length1,
+                int length2,
+                int window,
+                const Table* y1Table,
+                const Table* y2Table) :
+        _window(window),
+        _block(std::max(2, std::min(64, window / 8))),
+        _numSegments(window / _block - 1),
+        _t1(y1, length1, window, _block, y1Table),
+        _t2(y2, length2, window, _block, y2Table)
+    {
+    }
+
+    ///Windows per block.
+    int block() const { return _block; }
+
+    ///False if the window is too short for the bounds to pay off.
+    static bool usable(int window) { return window >= 64; }
+
+    /**
+     * Walks the blocks of one shift. bound() is meant to be called for
+     * increasing begin; consecutive blocks reuse the previous sum.
+     */
+    class Cursor {
+      public:
+        Cursor(const ShiftBounds& b, int shift) :
+            _b(b), _shift(shift), _next(-1), _steps(0), _prodSum(0.0), _prodSize(0.0) {}
+
+        /**
+         * Upper bound on the correlation of the count (<= block())
+         * windows starting at begin, plus margin.
+         */
+        double bound(int begin, int count)
+        {
+            const ShiftBounds& b = _b;
+            const int B = b._block;
+            const int K = b._numSegments;
+            const int p1 = begin + B;
+            const int p2 = p1 + _shift;
+
+            //Sum of spread products and mean products over the segments.
+            //Recomputed now and then so that the sliding sum cannot drift.
+            if (begin != _next || ++_steps == 64) {
+                _prodSum = 0.0;
+                _prodSize = 0.0;
+                for (int k = 0; k < K; ++k) {
+                    const double v = segmentProduct(p1 + k * B, p2 + k * B);
+                    _prodSum += v;
+                    _prodSize += std::fabs(v);
+                }
+                _steps = 0;
+            }
+            else {
+                const double in = segmentProduct(p1 + (K - 1) * B, p2 + (K - 1) * B);
+                const double out = segmentProduct(p1 - B, p2 - B);
+                _prodSum += in - out;
+                _prodSize += std::fabs(in) - std::fabs(out);
+            }
+            _next = begin + B;
+
+            //Ranges of the window means over the block.
+            double lo1, hi1, lo2, hi2, minVar1, minVar2;
+            b._t1.windowRange(begin, count, lo1, hi1, minVar1);
+            b._t2.windowRange(begin + _shift, count, lo2, hi2, minVar2);
+            if (!(minVar1 > 0.0) || !(minVar2 > 0.0)) return HUGE_VAL;
+
+            //Segments: a bilinear function of the two means, so its
+            //max over the box is at a corner.
+            const double sum1 = b._t1.regionSum(p1, p1 + K * B);
+            const double sum2 = b._t2.regionSum(p2, p2 + K * B);
+            const double n = (double) K * B;
+            double inner = -HUGE_VAL;
+            const double m1[2] = {lo1, hi1};
+            const double m2[2] = {lo2, hi2};
+            for (int i = 0; i < 2; ++i) {
+                for (int j = 0; j < 2; ++j) {
+                    const double v = _prodSum - m1[i] * sum2 - m2[j] * sum1
+                                   + n * m1[i] * m2[j];
+                    inner = std::max(inner, v);
+                }
+            }
+
+            //Edges: the region before the segments and the one after.
+            const int end1 = begin + count - 1 + b._window;
+            const double edge1 = b._t1.maxSpread(begin, p1, p1 + K * B, end1, lo1, hi1);
+            const double edge2 = b._t2.maxSpread(begin + _shift, p2, p2 + K * B,
+                                                 end1 + _shift, lo2, hi2);
+            const double edges = std::sqrt(edge1 * edge2);
+
+            //The sums cancel when the means are far from the trace's,
+            //so allow for rounding relative to the size of the terms.
+            const double m1Size = std::max(std::fabs(lo1), std::fabs(hi1));
+            const double m2Size = std::max(std::fabs(lo2), std::fabs(hi2));
+            const double size = _prodSize + edges + m1Size * std::fabs(sum2)
+                              + m2Size * std::fabs(sum1) + n * m1Size * m2Size;
+            const double c = inner + edges + 1e-12 * size;
+
+            //top = window * c and sqCor = top^2 / (var1 * var2).
+            return b._window * c / std::sqrt(minVar1 * minVar2) + margin();
+        }
+
+      private:
+        double segmentProduct(int p1, int p2) const
+        {
+            const Trace& t1 = _b._t1;
+            const Trace& t2 = _b._t2;
+            const Segment& s1 = t1.segments[p1];
+            const Segment& s2 = t2.segments[p2];
+            return s1.spread * s2.spread + s1.scaledSum * s2.scaledSum;
+        }
+
+        const ShiftBounds& _b;
+        int _shift;
+        int _next;
+        int _steps;
+        double _prodSum;
+        double _prodSize;
+    };
+
+  private:
+    ///Slack on the bounds for rounding.
+    static double margin() { return 1e-7; }
+
+    /**
+     * Per trace tables. The values are taken relative to the trace's
+     * rounded mean, which leaves the correlation unchanged and keeps
+     * the sums small.
+     */
+    /**
+     * A block()-long run of a trace: the root of its sum of squared
+     * deviations and its sum over the root of block().
+     */
+    struct Segment {
+        double spread;
+        double scaledSum;
+    };
+
+    struct Trace {
+        template <typename Table>
+        Trace(const int* y, int length, int window, int block, const Table* table)
+        {
+            long long total = 0;
+            for (int i = 0; i < length; ++i) total += y[i];
+            const long long offset = (length > 0) ?
+                (long long) std::floor((double) total / length + 0.5) : 0;
+
+            sums.resize(length + 1);
+            sqSums.resize(length + 1);
+            sums[0] = 0;
+            sqSums[0] = 0;
+            for (int i = 0; i < length; ++i) {
+                const long long v = y[i] - offset;
+                sums[i + 1] = sums[i] + v;
+                sqSums[i + 1] = sqSums[i] + v * v;
+            }
+
+            const int numSegments = std::max(0, length - block + 1);
+            segments.resize(numSegments);
+            const double scale = 1.0 / std::sqrt((double) block);
+            for (int p = 0; p < numSegments; ++p) {
+                const double s = (double) (sums[p + block] - sums[p]);
+                const double q = (double) (sqSums[p + block] - sqSums[p]);
+                segments[p].spread = std::sqrt(std::max(0.0, q - s * s / block) + 1e-12 * q);
+                segments[p].scaledSum = s * scale;
+            }
+
+            //Range of the window means and smallest var over each run
+            //of block windows (shorter at the end).
+            const int numWindows = std::max(0, length - window + 1);
+            std::vector<double> means(numWindows);
+            std::vector<double> vars(numWindows);
+            for (int p = 0; p < numWindows; ++p) {
+                means[p] = (table[p].sum - (double) window * offset) / window;
+                vars[p] = table[p].var;
+            }
+            runMin(means, block, meanLo, false);
+            runMin(means, block, meanHi, true);
+            runMin(vars, block, minVar, false);
+        }
+
+        /**
+         * out[p] = min (or max) of in[p, p + width), clipped at the end.
+         * Splits in into chunks of width and combines a suffix scan and
+         * a prefix scan of them, which is linear in the length.
+         */
+        static void runMin(const std::vector<double>& in, int width,
+                           std::vector<double>& out, bool max)
+        {
+            const int n = (int) in.size();
+            std::vector<double> prefix(n);
+            std::vector<double> suffix(n);
+            const double sign = max ? -1.0 : 1.0;
+            for (int p = 0; p < n; ++p) {
+                const double v = sign * in[p];
+                prefix[p] = (p % width == 0) ? v : std::min(prefix[p - 1], v);
+            }
+            for (int p = n - 1; p >= 0; --p) {
+                const double v = sign * in[p];
+                suffix[p] = ((p + 1) % width == 0 || p == n - 1) ? v : std::min(suffix[p + 1], v);
+            }
+            out.resize(n);
+            for (int p = 0; p < n; ++p) {
+                const int last = std::min(p + width, n) - 1;
+                out[p] = sign * ((last / width == p / width) ? suffix[p] : std::min(suffix[p], prefix[last]));
+            }
+        }
+
+        ///Range of the means and smallest var of windows [begin, begin + count).
+        void windowRange(int begin, int count, double& lo, double& hi, double& var) const
+        {
+            lo = meanLo[begin];
+            hi = meanHi[begin];
+            var = minVar[begin];
+            //A short block at the end is covered by the full run.
+            (void) count;
+        }
+
+        double regionSum(int begin, int end) const
+        {
+            return (double) (sums[end] - sums[begin]);
+        }
+
+        /**
+         * Largest sum of squared deviations from a mean in [lo, hi]
+         * over [begin1, end1) and [begin2, end2), rounded up. It is
+         * convex in the mean, so the largest is at lo or hi.
+         */
+        double maxSpread(int begin1, int end1, int begin2, int end2,
+                         double lo, double hi) const
+        {
+            const double s = (double) (sums[end1] - sums[begin1] + sums[end2] - sums[begin2]);
+            const double q = (double) (sqSums[end1] - sqSums[begin1] + sqSums[end2] - sqSums[begin2]);
+            const double n = (double) (end1 - begin1 + end2 - begin2);
+            const double atLo = q - 2.0 * lo * s + n * lo * lo;
+            const double atHi = q - 2.0 * hi * s + n * hi * hi;
+            const double m = std::max(std::fabs(lo), std::fabs(hi));
+            const double size = q + 2.0 * m * std::fabs(s) + n * m * m;
+            return std::max(0.0, std::max(atLo, atHi)) + 1e-12 * size;
+        }
+
+        std::vector<long long> sums;
+        std::vector<long long> sqSums;
+        std::vector<Segment> segments;
+        std::vector<double> meanLo;
+        std::vector<double> meanHi;
+        std::vector<double> minVar;
+    };
+
+    int _window;
+    int _block;
+    int _numSegments;
+    Trace _t1;
+    Trace _t2;
+};
+
+#endif
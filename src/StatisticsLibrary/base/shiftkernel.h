@@ -0,0 +1,382 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#ifndef __SHIFTKERNEL_H__
+#define __SHIFTKERNEL_H__
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+#include "simd.h"
+
+/**
+ * Vectorized inner loop of MaxCorrelationWithFlips::maxCorVaryingSecond().
+ *
+ * search() evaluates Lanes adjacent shifts at once: lane k holds the
+ * sliding dot product for shift + k, so the y1 value is broadcast and
+ * the y2 values and SumVar entries are contiguous loads. Each lane keeps
+ * its own best signed squared correlation; the lanes are only reduced
+ * at the end of the group.
+ *
+ * The arithmetic is the same as the scalar loop, operation for operation
+ * (32 bit products, 64 bit sums, then the same double expressions), so
+ * the result is bit-identical to it. That needs every window dot product
+ * to be exact in a double, which exact() checks for the given traces;
+ * if it fails the caller must use the scalar loop. It also assumes the
+ * compiler does not contract a*b - c*d into an fma in the scalar code;
+ * the .pro files pass -ffp-contract=off for that.
+ *
+ * The AVX2 or SSE4.1 version is picked by simdLevel() (see simd.h);
+ * without either the same interface runs a scalar version.
+ */
+class ShiftKernel {
+  public:
+    enum { Lanes = 8 };
+
+    /**
+     * Table is MaxCorrelationWithFlips::SumVar (anything with sum and var).
+     * The tables are copied into separate sum and var arrays.
+     */
+    template <typename Table>
+    ShiftKernel(const int* y1,
+                const int* y2,
+                int length1,
+                int length2,
+                int window,
+                const Table* y1Table,
+                const Table* y2Table) :
+        _y1(y1), _y2(y2), _window(window),
+        _numWindows1(length1 - window + 1),
+        _numWindows2(length2 - window + 1),
+        _sum1(_numWindows1), _var1(_numWindows1),
+        _sum2(_numWindows2), _var2(_numWindows2)
+    {
+        for (int i = 0; i < _numWindows1; ++i) {
+            _sum1[i] = y1Table[i].sum;
+            _var1[i] = y1Table[i].var;
+        }
+        for (int i = 0; i < _numWindows2; ++i) {
+            _sum2[i] = y2Table[i].sum;
+            _var2[i] = y2Table[i].var;
+        }
+
+        long long max1 = 0, max2 = 0;
+        for (int i = 0; i < length1; ++i) max1 = std::max(max1, std::llabs(y1[i]));
+        for (int i = 0; i < length2; ++i) max2 = std::max(max2, std::llabs(y2[i]));
+        //Products must fit in an int (as in the scalar code) and
+        //window * prodSum must be an exact double; 2^51 also covers
+        //the int64 -> double conversion used by the vector code.
+        const double maxProduct = (double) max1 * (double) max2;
+        _exact = maxProduct <= 2147483647.0 &&
+                 (double) window * window * maxProduct < 2251799813685248.0;
+    }
+
+    ///True if search() runs vector code on this machine.
+    static bool vectorized()
+    {
+        return Simd_Scalar != simdLevel();
+    }
+
+    ///True if search() is bit-identical to the scalar loop for these traces.
+    bool exact() const { return _exact; }
+
+    /**
+     * Finds the first maximum over shifts [shift, shift + Lanes),
+     * scanning like maxCorVaryingSecond() would: shift by shift,
+     * window by window. The caller guarantees shift + Lanes - 1 is
+     * a valid shift (<= length2 - window).
+     *
+     * allowNegative -- the prior max sqCor was <= 0, so negative
+     *                  correlations count until a positive one is seen.
+     *
+     * sqCor is -10 and the locations -1 if nothing qualified.
+     */
+    void search(int shift, bool allowNegative, double& sqCor, int& loc1, int& loc2) const
+    {
+        double best[Lanes];
+        int bestLoc[Lanes];
+        long long prodSum[Lanes];
+        int numPos[Lanes];
+        for (int k = 0; k < Lanes; ++k) {
+            best[k] = -10.0;
+            bestLoc[k] = -1;
+            numPos[k] = std::min(_numWindows1, _numWindows2 - (shift + k));
+        }
+
+        //Windows every lane has; larger shifts run out of y2 first.
+        const int common = numPos[Lanes - 1];
+        switch (simdLevel()) {
+#if defined(SIMD_AVX2)
+          case Simd_Avx2:
+            searchAvx2(shift, common, allowNegative, best, bestLoc, prodSum);
+            break;
+#endif
+#if defined(SIMD_SSE41)
+          case Simd_Sse41:
+            searchSse41(shift, common, allowNegative, best, bestLoc, prodSum);
+            break;
+#endif
+          default:
+            for (int k = 0; k < Lanes; ++k) {
+                prodSum[k] = initialProdSum(shift + k);
+                searchLane(shift + k, 0, common, prodSum[k], allowNegative, best[k], bestLoc[k]);
+            }
+        }
+
+        //The lanes that still have windows left.
+        for (int k = 0; k < Lanes && numPos[k] > common; ++k) {
+            const int laneShift = shift + k;
+            slide(laneShift, common - 1, prodSum[k]);
+            searchLane(laneShift, common, numPos[k], prodSum[k], allowNegative, best[k], bestLoc[k]);
+        }
+
+        //In shift order with a strict >, like the scalar loop.
+        int bestLane = 0;
+        for (int k = 1; k < Lanes; ++k) {
+            if (best[k] > best[bestLane]) bestLane = k;
+        }
+        sqCor = best[bestLane];
+        loc1 = bestLoc[bestLane];
+        loc2 = (loc1 < 0) ? -1 : loc1 + shift + bestLane;
+    }
+
+  private:
+    ///Dot product of the first window of y1 with y2 at shift.
+    long long initialProdSum(int shift) const
+    {
+        long long prodSum = 0;
+        for (int j = 0; j != _window; ++j)
+            prodSum += _y1[j] * _y2[shift + j];
+        return prodSum;
+    }
+
+    ///Move prodSum from window pos to pos + 1.
+    void slide(int shift, int pos, long long& prodSum) const
+    {
+        prodSum -= _y1[pos] * _y2[pos + shift];
+        prodSum += _y1[pos + _window] * _y2[pos + shift + _window];
+    }
+
+    ///Scalar search of one shift over windows [posBegin, posEnd).
+    /**
+     * prodSum holds the dot product at posBegin and is left at posEnd - 1.
+     */
+    void searchLane(int shift, int posBegin, int posEnd, long long& prodSum,
+                    bool allowNegative, double& best, int& bestLoc) const
+    {
+        for (int pos = posBegin; pos < posEnd; ++pos) {
+            if (pos > posBegin) slide(shift, pos - 1, prodSum);
+
+            const double top = _window * prodSum - _sum1[pos] * _sum2[pos + shift];
+            const double sqCor = top * top / (_var1[pos] * _var2[pos + shift]);
+            if (top > 0.0) {
+                if (sqCor > best) {
+                    best = sqCor;
+                    bestLoc = pos;
+                }
+            }
+            else if (allowNegative && -sqCor > best) {
+                best = -sqCor;
+                bestLoc = pos;
+            }
+        }
+    }
+
+#if defined(SIMD_AVX2)
+    SIMD_TARGET("avx2")
+    void searchAvx2(int shift, int numPos, bool allowNegative,
+                    double* best, int* bestLoc, long long* prodSum) const
+    {
+        const int* y2s = _y2 + shift;
+
+        //Lanes 0-3 and 4-7 of the 64 bit sliding dot products.
+        __m256i accLo = _mm256_setzero_si256();
+        __m256i accHi = _mm256_setzero_si256();
+        for (int j = 0; j != _window; ++j) {
+            const __m256i prod = _mm256_mullo_epi32(_mm256_set1_epi32(_y1[j]),
+                _mm256_loadu_si256((const __m256i*) (y2s + j)));
+            accLo = _mm256_add_epi64(accLo, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(prod)));
+            accHi = _mm256_add_epi64(accHi, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(prod, 1)));
+        }
+
+        //int64 -> double is exact below 2^51 by adding 2^52 + 2^51.
+        const __m256d magicD = _mm256_set1_pd(6755399441055744.0);
+        const __m256i magicI = _mm256_castpd_si256(magicD);
+        const __m256d windowD = _mm256_set1_pd((double) _window);
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d signBit = _mm256_set1_pd(-0.0);
+        const __m256d allowNeg = allowNegative ? _mm256_castsi256_pd(_mm256_set1_epi64x(-1)) : zero;
+
+        __m256d bestLo = _mm256_set1_pd(-10.0), bestHi = bestLo;
+        __m256d locLo = _mm256_set1_pd(-1.0), locHi = locLo;
+
+        for (int pos = 0; pos < numPos; ++pos) {
+            const __m256d sum1 = _mm256_set1_pd(_sum1[pos]);
+            const __m256d var1 = _mm256_set1_pd(_var1[pos]);
+            const __m256d posD = _mm256_set1_pd((double) pos);
+            const double* sum2 = &_sum2[pos + shift];
+            const double* var2 = &_var2[pos + shift];
+
+            for (int half = 0; half < 2; ++half) {
+                const __m256i acc = half ? accHi : accLo;
+                __m256d& laneBest = half ? bestHi : bestLo;
+                __m256d& laneLoc = half ? locHi : locLo;
+
+                const __m256d prodSumD = _mm256_sub_pd(
+                    _mm256_castsi256_pd(_mm256_add_epi64(acc, magicI)), magicD);
+                const __m256d top = _mm256_sub_pd(_mm256_mul_pd(windowD, prodSumD),
+                    _mm256_mul_pd(sum1, _mm256_loadu_pd(sum2 + 4 * half)));
+                const __m256d sqCor = _mm256_div_pd(_mm256_mul_pd(top, top),
+                    _mm256_mul_pd(var1, _mm256_loadu_pd(var2 + 4 * half)));
+
+                const __m256d positive = _mm256_cmp_pd(top, zero, _CMP_GT_OQ);
+                const __m256d signedSqCor = _mm256_blendv_pd(
+                    _mm256_xor_pd(sqCor, signBit), sqCor, positive);
+                const __m256d better = _mm256_and_pd(_mm256_or_pd(positive, allowNeg),
+                    _mm256_cmp_pd(signedSqCor, laneBest, _CMP_GT_OQ));
+                laneBest = _mm256_blendv_pd(laneBest, signedSqCor, better);
+                laneLoc = _mm256_blendv_pd(laneLoc, posD, better);
+            }
+
+            if (pos + 1 < numPos) {
+                const __m256i oldProd = _mm256_mullo_epi32(_mm256_set1_epi32(_y1[pos]),
+                    _mm256_loadu_si256((const __m256i*) (y2s + pos)));
+                const __m256i newProd = _mm256_mullo_epi32(_mm256_set1_epi32(_y1[pos + _window]),
+                    _mm256_loadu_si256((const __m256i*) (y2s + pos + _window)));
+                accLo = _mm256_sub_epi64(accLo, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(oldProd)));
+                accHi = _mm256_sub_epi64(accHi, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(oldProd, 1)));
+                accLo = _mm256_add_epi64(accLo, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(newProd)));
+                accHi = _mm256_add_epi64(accHi, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(newProd, 1)));
+            }
+        }
+
+        double loc[Lanes];
+        _mm256_storeu_si256((__m256i*) prodSum, accLo);
+        _mm256_storeu_si256((__m256i*) (prodSum + 4), accHi);
+        _mm256_storeu_pd(best, bestLo);
+        _mm256_storeu_pd(best + 4, bestHi);
+        _mm256_storeu_pd(loc, locLo);
+        _mm256_storeu_pd(loc + 4, locHi);
+        for (int k = 0; k < Lanes; ++k) bestLoc[k] = (int) loc[k];
+    }
+#endif
+
+#if defined(SIMD_SSE41)
+    SIMD_TARGET("sse4.1")
+    void searchSse41(int shift, int numPos, bool allowNegative,
+                     double* best, int* bestLoc, long long* prodSum) const
+    {
+        const int* y2s = _y2 + shift;
+
+        //Pairs of lanes: acc[q] holds lanes 2q and 2q + 1.
+        __m128i acc[Lanes / 2];
+        for (int q = 0; q < Lanes / 2; ++q) acc[q] = _mm_setzero_si128();
+        for (int j = 0; j != _window; ++j) {
+            const __m128i y1j = _mm_set1_epi32(_y1[j]);
+            for (int b = 0; b < Lanes / 4; ++b) {
+                const __m128i prod = _mm_mullo_epi32(y1j,
+                    _mm_loadu_si128((const __m128i*) (y2s + j + 4 * b)));
+                acc[2 * b] = _mm_add_epi64(acc[2 * b], _mm_cvtepi32_epi64(prod));
+                acc[2 * b + 1] = _mm_add_epi64(acc[2 * b + 1], _mm_cvtepi32_epi64(_mm_srli_si128(prod, 8)));
+            }
+        }
+
+        //int64 -> double is exact below 2^51 by adding 2^52 + 2^51.
+        const __m128d magicD = _mm_set1_pd(6755399441055744.0);
+        const __m128i magicI = _mm_castpd_si128(magicD);
+        const __m128d windowD = _mm_set1_pd((double) _window);
+        const __m128d zero = _mm_setzero_pd();
+        const __m128d signBit = _mm_set1_pd(-0.0);
+        const __m128d allowNeg = allowNegative ? _mm_castsi128_pd(_mm_set1_epi32(-1)) : zero;
+
+        __m128d laneBest[Lanes / 2];
+        __m128d laneLoc[Lanes / 2];
+        for (int q = 0; q < Lanes / 2; ++q) {
+            laneBest[q] = _mm_set1_pd(-10.0);
+            laneLoc[q] = _mm_set1_pd(-1.0);
+        }
+
+        for (int pos = 0; pos < numPos; ++pos) {
+            const __m128d sum1 = _mm_set1_pd(_sum1[pos]);
+            const __m128d var1 = _mm_set1_pd(_var1[pos]);
+            const __m128d posD = _mm_set1_pd((double) pos);
+            const double* sum2 = &_sum2[pos + shift];
+            const double* var2 = &_var2[pos + shift];
+
+            for (int q = 0; q < Lanes / 2; ++q) {
+                const __m128d prodSumD = _mm_sub_pd(
+                    _mm_castsi128_pd(_mm_add_epi64(acc[q], magicI)), magicD);
+                const __m128d top = _mm_sub_pd(_mm_mul_pd(windowD, prodSumD),
+                    _mm_mul_pd(sum1, _mm_loadu_pd(sum2 + 2 * q)));
+                const __m128d sqCor = _mm_div_pd(_mm_mul_pd(top, top),
+                    _mm_mul_pd(var1, _mm_loadu_pd(var2 + 2 * q)));
+
+                const __m128d positive = _mm_cmpgt_pd(top, zero);
+                const __m128d signedSqCor = _mm_blendv_pd(
+                    _mm_xor_pd(sqCor, signBit), sqCor, positive);
+                const __m128d better = _mm_and_pd(_mm_or_pd(positive, allowNeg),
+                    _mm_cmpgt_pd(signedSqCor, laneBest[q]));
+                laneBest[q] = _mm_blendv_pd(laneBest[q], signedSqCor, better);
+                laneLoc[q] = _mm_blendv_pd(laneLoc[q], posD, better);
+            }
+
+            if (pos + 1 < numPos) {
+                const __m128i y1Old = _mm_set1_epi32(_y1[pos]);
+                const __m128i y1New = _mm_set1_epi32(_y1[pos + _window]);
+                for (int b = 0; b < Lanes / 4; ++b) {
+                    const __m128i oldProd = _mm_mullo_epi32(y1Old,
+                        _mm_loadu_si128((const __m128i*) (y2s + pos + 4 * b)));
+                    const __m128i newProd = _mm_mullo_epi32(y1New,
+                        _mm_loadu_si128((const __m128i*) (y2s + pos + _window + 4 * b)));
+                    acc[2 * b] = _mm_sub_epi64(acc[2 * b], _mm_cvtepi32_epi64(oldProd));
+                    acc[2 * b + 1] = _mm_sub_epi64(acc[2 * b + 1], _mm_cvtepi32_epi64(_mm_srli_si128(oldProd, 8)));
+                    acc[2 * b] = _mm_add_epi64(acc[2 * b], _mm_cvtepi32_epi64(newProd));
+                    acc[2 * b + 1] = _mm_add_epi64(acc[2 * b + 1], _mm_cvtepi32_epi64(_mm_srli_si128(newProd, 8)));
+                }
+            }
+        }
+
+        double loc[Lanes];
+        for (int q = 0; q < Lanes / 2; ++q) {
+            _mm_storeu_si128((__m128i*) (prodSum + 2 * q), acc[q]);
+            _mm_storeu_pd(best + 2 * q, laneBest[q]);
+            _mm_storeu_pd(loc + 2 * q, laneLoc[q]);
+        }
+        for (int k = 0; k < Lanes; ++k) bestLoc[k] = (int) loc[k];
+    }
+#endif
+
+    const int* _y1;
+    const int* _y2;
+    int _window;
+    int _numWindows1;
+    int _numWindows2;
+    std::vector<double> _sum1;
+    std::vector<double> _var1;
+    std::vector<double> _sum2;
+    std::vector<double> _var2;
+    bool _exact;
+};
+
+#endif
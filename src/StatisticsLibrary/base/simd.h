@@ -0,0 +1,89 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+/**
+ * Which SIMD instruction set the vector kernels (ShiftKernel,
+ * DtwCorrelation::distance()) run on.
+ *
+ * With GCC (4.9 on) and Clang on x86 the kernels are always built for
+ * every set, each function marked with SIMD_TARGET, and simdLevel()
+ * picks one from the CPU at run time, so a plain -O2 build uses them.
+ * Other compilers get what the compile flags allow (-mavx2, -msse4.1,
+ * /arch:AVX2), decided at compile time.
+ *
+ * SIMD_AVX2 and SIMD_SSE41 are defined where that version is built.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#include <immintrin.h>
+#define SIMD_AVX2
+#define SIMD_SSE41
+#define SIMD_CPUID
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_AVX2
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#define SIMD_SSE41
+#endif
+
+#ifndef SIMD_TARGET
+#define SIMD_TARGET(isa)
+#endif
+
+enum SimdLevel {
+    Simd_Scalar,
+    Simd_Sse41, ///< SSE4.1 and what comes before it
+    Simd_Avx2   ///< AVX2 and AVX
+};
+
+inline SimdLevel detectSimdLevel()
+{
+#if defined(SIMD_CPUID)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return Simd_Avx2;
+    if (__builtin_cpu_supports("sse4.1")) return Simd_Sse41;
+    return Simd_Scalar;
+#elif defined(SIMD_AVX2)
+    return Simd_Avx2;
+#elif defined(SIMD_SSE41)
+    return Simd_Sse41;
+#else
+    return Simd_Scalar;
+#endif
+}
+
+///The best level this machine and build support, found once.
+inline SimdLevel simdLevel()
+{
+    static const SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+#endif
@@ -26,6 +26,7 @@
 #include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstring>
 #include "stats.h"
 #include <utility>
 #include <iterator> 
@@ -58,6 +59,20 @@ void meanAndVar(const vector<double>& v, double& vMean, double& var)
   var = sum / (n - 1);
 }
 
+void RunningMeanVar::add(double x)
+{
+  ++_n;
+  const double delta = x - _mean;
+  _mean += delta / _n;
+  _m2 += delta * (x - _mean);
+}
+
+double RunningMeanVar::halfWidth(double z) const
+{
+  if (_n < 2) return HUGE_VAL;
+  return z * sqrt(var() / _n);
+}
+
 /**
  * Indicates whether a given value is from the first or second
  * bunch of values.
@@ -177,16 +192,24 @@ computeRankSumSqSum(const vector<T>& values1, const vector<T>& values2)
   return make_pair(rankSum1, sqRankSum);
 }
 
+static double t1FromRankSums(double n, double m, const pair<double, double>& r);
+
 /**
  * Returns Conover's T1 statistic (which is approximately
  * normal) for samples x and y.
  */
 double t1Statistic(const vector<double>& x, const vector<double>& y)
 {
-  double n = x.size();
-  double m = y.size();
+  return t1FromRankSums(x.size(), y.size(), computeRankSumSqSum(x,y));
+}
+
+/**
+ * T1 from the sizes of x and y and what computeRankSumSqSum() gives
+ * for them.
+ */
+static double t1FromRankSums(double n, double m, const pair<double, double>& r)
+{
   double N = m + n;
-  pair<double, double> r(computeRankSumSqSum(x,y));
   double T = r.first;
   double R2 = r.second;
   double N1 = N + 1;
@@ -194,3 +217,147 @@ double t1Statistic(const vector<double>& x, const vector<double>& y)
   double bot2 = n*m/(N*(N-1))*R2 - n*m*N1*N1/(4*(N-1));
   return top / sqrt(bot2);
 }
+
+/**
+ * A key that sorts as value does, with -0 taken as 0 so that equal
+ * values have equal keys: the sign bit is flipped for positive values
+ * and every bit for negative ones.
+ */
+static inline unsigned long long sortKey(double value)
+{
+  if (value == 0.0) value = 0.0;
+  unsigned long long bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const unsigned long long sign = 1ULL << 63;
+  return (bits & sign) ? ~bits : bits | sign;
+}
+
+void RankSums::sortKeys(const double* values, size_t size, unsigned long long* keys)
+{
+  for (size_t i = 0; i != size; ++i)
+    keys[i] = sortKey(values[i]);
+  if (size < RadixMin)
+    sort(keys, keys + size);
+  else
+    radixSort(keys, size);
+}
+
+/**
+ * The keys of samples [0, count), laid out as the values are, each
+ * sample's sorted.
+ */
+void RankSums::sortBatch(const double* values, const size_t* begin, size_t count,
+                         vector<unsigned long long>& keys)
+{
+  const size_t first = begin[0];
+  keys.resize(begin[count] - first);
+  for (size_t s = 0; s != count; ++s) {
+    if (begin[s + 1] > begin[s])
+      sortKeys(values + begin[s], begin[s + 1] - begin[s], &keys[begin[s] - first]);
+  }
+}
+
+/**
+ * LSD radix sort, RadixBits at a time, skipping the digits that are
+ * the same for every key (the sign and exponent mostly are). The
+ * counts of every digit are taken in one read of the keys.
+ */
+void RankSums::radixSort(unsigned long long* keys, size_t size)
+{
+  const int numDigits = (64 + RadixBits - 1) / RadixBits;
+  const size_t numBuckets = (size_t) 1 << RadixBits;
+  const unsigned long long digitMask = numBuckets - 1;
+  _counts.assign(numDigits * numBuckets, 0);
+  for (size_t i = 0; i != size; ++i) {
+    const unsigned long long key = keys[i];
+    for (int d = 0; d < numDigits; ++d)
+      ++_counts[d * numBuckets + ((key >> (d * RadixBits)) & digitMask)];
+  }
+
+  _scratch.resize(size);
+  unsigned long long* from = keys;
+  unsigned long long* to = &_scratch[0];
+  for (int d = 0; d < numDigits; ++d) {
+    const int shift = d * RadixBits;
+    size_t* counts = &_counts[d * numBuckets];
+    if (counts[(from[0] >> shift) & digitMask] == size) continue;
+    //Counts to the first slot of each bucket.
+    size_t sum = 0;
+    for (size_t b = 0; b != numBuckets; ++b) {
+      const size_t c = counts[b];
+      counts[b] = sum;
+      sum += c;
+    }
+    for (size_t i = 0; i != size; ++i)
+      to[counts[(from[i] >> shift) & digitMask]++] = from[i];
+    swap(from, to);
+  }
+  if (from != keys)
+    copy(from, from + size, keys);
+}
+
+/**
+ * The sweep of rankSumSqSum() over keys x[0, n) and y[0, m), each
+ * sorted: each run of equal values is a tie, whichever sample it is
+ * from, and gets its average rank as in computeRankSumSqSum().
+ */
+static pair<double, double> sweepRanks(const unsigned long long* x, size_t n,
+                                       const unsigned long long* y, size_t m)
+{
+  double rankSum1 = 0.0;
+  double sqRankSum = 0.0;
+  size_t a = 0, b = 0;
+  int i = 0;
+  while (a < n || b < m) {
+    const unsigned long long key = (b == m || (a < n && x[a] < y[b])) ? x[a] : y[b];
+    int numberEqual[2] = {0, 0};
+    for (; a < n && x[a] == key; ++a) ++numberEqual[0];
+    for (; b < m && y[b] == key; ++b) ++numberEqual[1];
+
+    int totalNumberEqual = numberEqual[0] + numberEqual[1];
+    double sumOfRanks = (totalNumberEqual * (2*i + 1 + totalNumberEqual))/2;
+    double averageRank = sumOfRanks/totalNumberEqual;
+
+    rankSum1 += averageRank * numberEqual[0];
+    sqRankSum += totalNumberEqual * averageRank * averageRank;
+    i += totalNumberEqual;
+  }
+  return make_pair(rankSum1, sqRankSum);
+}
+
+pair<double, double> RankSums::rankSumSqSum(const double* x, size_t n, const double* y, size_t m)
+{
+  _x.resize(n);
+  _y.resize(m);
+  if (n) sortKeys(x, n, &_x[0]);
+  if (m) sortKeys(y, m, &_y[0]);
+  return sweepRanks(n ? &_x[0] : 0, n, m ? &_y[0] : 0, m);
+}
+
+double RankSums::t1Statistic(const vector<double>& x, const vector<double>& y)
+{
+  const pair<double, double> r = x.empty() || y.empty() ?
+    computeRankSumSqSum(x, y) : rankSumSqSum(&x[0], x.size(), &y[0], y.size());
+  return t1FromRankSums(x.size(), y.size(), r);
+}
+
+void RankSums::t1Statistics(const double* x, const size_t* xBegin,
+                            const double* y, const size_t* yBegin,
+                            size_t count, double* T)
+{
+  if (count == 0) return;
+  sortBatch(x, xBegin, count, _x);
+  sortBatch(y, yBegin, count, _y);
+  for (size_t s = 0; s != count; ++s) {
+    const size_t n = xBegin[s + 1] - xBegin[s];
+    const size_t m = yBegin[s + 1] - yBegin[s];
+    if (n == 0 || m == 0) {
+      T[s] = ::t1Statistic(vector<double>(x + xBegin[s], x + xBegin[s + 1]),
+                           vector<double>(y + yBegin[s], y + yBegin[s + 1]));
+      continue;
+    }
+    const pair<double, double> r = sweepRanks(&_x[xBegin[s] - xBegin[0]], n,
+                                              &_y[yBegin[s] - yBegin[0]], m);
+    T[s] = t1FromRankSums(n, m, r);
+  }
+}
@@ -26,6 +26,8 @@
 #ifndef __STATS_H__
 #define __STATS_H__
 
+#include <cstddef>
+#include <utility>
 #include <vector>
 
 /**
@@ -37,5 +39,85 @@ double t1Statistic(const std::vector<double>& x, const std::vector<double>& y);
 
 void meanAndVar(const std::vector<double>& v, double& vMean, double& var);
 
-#endif
+/**
+ * Mean and variance of values added one at a time (Welford's method),
+ * for deciding when to stop sampling. var() is the sample variance,
+ * as meanAndVar() gives it.
+ */
+class RunningMeanVar {
+public:
+  RunningMeanVar() : _n(0), _mean(0.0), _m2(0.0) {}
+
+  void add(double x);
+
+  size_t count() const { return _n; }
+  double mean() const { return _mean; }
+  ///0 with fewer than two values.
+  double var() const { return (_n > 1) ? _m2 / (_n - 1) : 0.0; }
+  ///Half the width of the normal confidence interval of the mean,
+  ///z standard errors either way.
+  double halfWidth(double z) const;
 
+private:
+  size_t _n;
+  double _mean;
+  double _m2;
+};
+
+/**
+ * t1Statistic() for many samples in a row, e.g. the T samples of one
+ * comparison, without allocating per sample: the buffers are kept
+ * from one call to the next. One per thread.
+ *
+ * Instead of wrapping and sorting the merged values, x and y are
+ * sorted on their own as integer keys and swept together once, with
+ * ties counted on the way. The ranks, ties and sums are those of
+ * t1Statistic(), so the results are identical. The values must not be
+ * NaN (nor may they for t1Statistic()).
+ *
+ * t1Statistics() ranks a batch of samples at once, e.g. a thread's
+ * share of the T samples: their keys go into one buffer, each sample's
+ * run sorted in place, and are swept sample by sample.
+ */
+class RankSums {
+public:
+  ///t1Statistic(x, y).
+  double t1Statistic(const std::vector<double>& x, const std::vector<double>& y);
+
+  /**
+   * T[s] = t1Statistic() of sample s, for s in [0, count): x values
+   * [xBegin[s], xBegin[s + 1]) against y values [yBegin[s], yBegin[s + 1]).
+   */
+  void t1Statistics(const double* x, const size_t* xBegin,
+                    const double* y, const size_t* yBegin,
+                    size_t count, double* T);
+
+  ///The rank sum of x and the sum of squared ranks of x and y merged.
+  std::pair<double, double> rankSumSqSum(const double* x, size_t n,
+                                         const double* y, size_t m);
+
+private:
+  /**
+   * Samples shorter than this are sorted with std::sort, longer ones
+   * with the radix sort. The radix sort costs some 20 ns a key at any
+   * size; timing rankSumSqSum() on n + n values in [-1, 1] (GCC 12,
+   * -O2), std::sort takes 0.9 us to its 3.5 at n = 50, about the same
+   * at n = 1000 and twice as long from n = 2000 on. The default 50
+   * pairs per sample therefore always go to std::sort.
+   */
+  enum { RadixMin = 1024 };
+  ///Bits per radix sort pass.
+  enum { RadixBits = 8 };
+
+  void sortKeys(const double* values, size_t size, unsigned long long* keys);
+  void sortBatch(const double* values, const size_t* begin, size_t count,
+                 std::vector<unsigned long long>& keys);
+  void radixSort(unsigned long long* keys, size_t size);
+
+  std::vector<unsigned long long> _x;
+  std::vector<unsigned long long> _y;
+  std::vector<unsigned long long> _scratch;
+  std::vector<size_t> _counts;
+};
+
+#endif
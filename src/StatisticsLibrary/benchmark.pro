@@ -0,0 +1,63 @@
+# 
+#  Copyright 2008-2014 Iowa State University
+# 
+#  This file is part of Mantis.
+#  
+#  Mantis is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#  
+#  Mantis is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#  
+#  You should have received a copy of the GNU General Public License
+#  along with Mantis.  If not, see <http://www.gnu.org/licenses/>.
+# 
+
+# Times the statistics kernels on synthetic traces (app/benchmark.cpp).
+# Run with --help for the settings; the output is tab separated.
+
+TEMPLATE = app
+TARGET = statbenchmark
+CONFIG -= qt
+CONFIG += console
+CONFIG += release
+CONFIG += c++11
+unix:LIBS += -lpthread
+
+# ShiftKernel (base/shiftkernel.h) is bit-identical to the scalar search
+# only if the compiler does not fuse a*b - c*d into an fma.
+*-g++*|*-clang*: QMAKE_CXXFLAGS += -ffp-contract=off
+
+HEADERS += \
+	io/converttracetoint.h \
+	base/corloc.h \
+	base/correlationsurface.h \
+	base/fftcorrelation.h \
+	base/flipcorrelation.h \
+	base/FlippableCorLoc.h \
+	base/getcurrenttime.h \
+	base/intcorrelation.h \
+	base/intnolev_functors.h \
+	base/mydebug.h \
+	base/parallel.h \
+	base/random.h \
+	base/mtrandom.h \
+	base/sampletraits.h \
+	base/shiftbounds.h \
+	base/shiftkernel.h \
+	base/simd.h \
+	base/stats.h \
+	base/ValueLoc.h
+SOURCES += \
+	app/benchmark.cpp \
+	base/correlationsurface.cpp \
+	base/FlippableCorLoc.cpp \
+	base/mydebug.cpp \
+	base/random.cpp \
+	base/mt19937ar.cpp \
+	base/stats.cpp \
+	base/ValueLoc.cpp
@@ -56,6 +56,20 @@ class ConvertTraceToInt {
       }
       return result;
     }
+
+  /**
+   * As above, straight from n floats (such as Profile depths),
+   * without copying them to doubles first. Gives the same ints.
+   */
+  std::auto_ptr<std::vector<int> >
+    operator()(const float* trace, size_t n)
+    {
+      std::auto_ptr<std::vector<int> > result(new std::vector<int>(n));
+      for (size_t i = 0; i != n; ++i) {
+	(*result)[i] = static_cast<int>(int(100 * (double) trace[i] + 0.5));
+      }
+      return result;
+    }
 };
 
 #endif
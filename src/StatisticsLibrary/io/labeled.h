@@ -50,7 +50,7 @@
  * If the attempt fails, print an error message
  * and exit.
  */
-void readLabel(std::istream& in, const char* expected)
+inline void readLabel(std::istream& in, const char* expected)
 {
   std::string label;
   in >> label;
@@ -95,6 +95,26 @@ void readLabeledValue(std::istream& in, const char* label, T& result)
   readValue(in, label, result);
 }
 
+/**
+ * Like readLabeledValue, but the label may be missing.
+ * If the next token in in is not label, in is left where it was,
+ * result is untouched, and false is returned.
+ */
+template<typename T>
+bool readOptionalLabeledValue(std::istream& in, const char* label, T& result)
+{
+  const std::streampos start = in.tellg();
+  std::string found;
+  in >> found;
+  if (!in || found != label) {
+    in.clear();
+    in.seekg(start);
+    return false;
+  }
+  readValue(in, label, result);
+  return true;
+}
+
 /**
  * Attempts to read result.size() T from in, storing each
  * in the corresponding index of result.
@@ -35,7 +35,7 @@
 #include <sstream>
 #include <vector>
 
-std::auto_ptr<std::vector<int> > readTrace(const std::string& file) {
+inline std::auto_ptr<std::vector<int> > readTrace(const std::string& file) {
   ConvertTraceToInt trans;
   
   std::vector<double> y;
@@ -50,7 +50,7 @@ std::auto_ptr<std::vector<int> > readTrace(const std::string& file) {
 
 // this funciton is added by maverick 
 // but it calls another function written before 
-std::auto_ptr<std::vector<int> > readTrace(const char* dataDir, const char *fname) {
+inline std::auto_ptr<std::vector<int> > readTrace(const char* dataDir, const char *fname) {
 	std::ostringstream file;
 	int len = strlen(dataDir);
 	const char* sep = "";
@@ -69,7 +69,7 @@ std::auto_ptr<std::vector<int> > readTrace(const char* dataDir, const char *fnam
  * prefix is to be of the form: <tip><side><angle><specimen>
  */
 
-std::auto_ptr<std::vector<int> > readTrace(const char* dataDir,
+inline std::auto_ptr<std::vector<int> > readTrace(const char* dataDir,
 					   const char* prefix,
 					   int trace,
 					   const char* suffix = "_y.txt")
@@ -98,7 +98,7 @@ std::auto_ptr<std::vector<int> > readTrace(const char* dataDir,
 }
 
 
-std::auto_ptr<std::vector<int> > readTrace(const char* dataDir,
+inline std::auto_ptr<std::vector<int> > readTrace(const char* dataDir,
 					   int tip,
 					   char side,
 					   int angle,
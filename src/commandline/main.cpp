@@ -45,6 +45,7 @@
 #include "../core/UtlQt.h"
 #include <QThread>
 #include <cstdio>
+#include <cstring>
 
 using std::cout;
 using std::endl;
@@ -52,6 +53,8 @@ using std::endl;
 QScriptValue wait(QScriptContext*, QScriptEngine*);
 int runInvestigator(int argc, char** argv);
 void initCoreApp();
+void loadMarkBackend();
+bool takeFlag(int& argc, char** argv, const char* flag);
 
 //=======================================================================
 //=======================================================================
@@ -59,6 +62,13 @@ int main(int argc, char** argv)
 {
     Log::logToFile("log.txt");
 
+    // make virtual marks without OpenGL, e.g. on servers with no GPU
+    // (or the markopt/cpuMarks setting, see loadMarkBackend)
+    if (takeFlag(argc, argv, "--cpu-marks"))
+    {
+        VirtualTip::setDefaultBackend(VirtualTip::Backend_Cpu);
+    }
+
     // no args, then just run investigator
     if (argc == 1)
     {
@@ -69,7 +79,7 @@ int main(int argc, char** argv)
     // Input processing.
     if (2 != argc)
     {
-        LogError("Usage:  mantis <javascript filename>");
+        LogError("Usage:  mantis [--cpu-marks] [<javascript filename>]");
         exit(-1);
     }
 
@@ -83,6 +93,7 @@ int main(int argc, char** argv)
 
     // for QSettings
     initCoreApp();
+    loadMarkBackend();
 
 	//Allow user to create instances of objects.
     scripter.AddObjectType<RangeImage, QString>("RangeImage");
@@ -179,6 +190,7 @@ int runInvestigator(int argc, char** argv)
     SettingsStore settings;
     settings.loadAll();
     App::settings(&settings);
+    loadMarkBackend();
 
     if (App::settings()->inv().showStartupDlg)
     {
@@ -210,3 +222,36 @@ void initCoreApp()
     QCoreApplication::setOrganizationDomain("iastate.edu");
     QCoreApplication::setApplicationName("Mantis");
 }
+
+//=======================================================================
+//=======================================================================
+void loadMarkBackend()
+{
+    // the setting can only turn the cpu on; --cpu-marks is not saved
+    SettingsStore settings;
+    settings.loadMarkOpt();
+    if (settings.mark().cpuMarks)
+    {
+        VirtualTip::setDefaultBackend(VirtualTip::Backend_Cpu);
+    }
+}
+
+//=======================================================================
+//=======================================================================
+bool takeFlag(int& argc, char** argv, const char* flag)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (0 == strcmp(argv[i], flag))
+        {
+            // drop it, so the remaining args read as before
+            for (int j = i; j < argc; ++j)
+            {
+                argv[j] = argv[j + 1];
+            }
+            --argc;
+            return true;
+        }
+    }
+    return false;
+}
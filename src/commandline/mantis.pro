@@ -52,6 +52,10 @@ CONFIG += c++11
 CONFIG += std=c++11
 CONFIG += stdlib=libc++
 
+# ShiftKernel (base/shiftkernel.h) is bit-identical to the scalar search
+# only if the compiler does not fuse a*b - c*d into an fma.
+*-g++*|*-clang*: QMAKE_CXXFLAGS += -ffp-contract=off
+
 RC_FILE = ../gui/mantis.rc
 
 HEADERS += \
@@ -70,10 +74,17 @@ HEADERS += \
 	../core/CsvTable.h \
 	../core/VirtualTip.h \
 	../core/StreamBuffer.h \
+	../core/MarkRasterizer.h \
         ../core/logger.h \
 	../QtBoxesDemo/QGLExtensionWrangler/glextensions.h \
 	../core/StatInterface.h \
 	../StatisticsLibrary/io/converttracetoint.h \
+	../StatisticsLibrary/io/labeled.h \
+	../StatisticsLibrary/base/arealcorrelation.h \
+	../StatisticsLibrary/base/calibration.h \
+	../StatisticsLibrary/base/correlationsurface.h \
+	../StatisticsLibrary/base/dtwcorrelation.h \
+	../StatisticsLibrary/base/fftcorrelation.h \
 	../StatisticsLibrary/base/flipcorrelation.h \
 	../StatisticsLibrary/base/FlippableCorLoc.h \
 	../StatisticsLibrary/base/intnolev_functors.h \
@@ -81,6 +92,13 @@ HEADERS += \
 	../StatisticsLibrary/base/mydebug.h \
 	../StatisticsLibrary/base/random.h \
 	../StatisticsLibrary/base/mtrandom.h \
+	../StatisticsLibrary/base/parallel.h \
+	../StatisticsLibrary/base/pyramidcorrelation.h \
+	../StatisticsLibrary/base/resample.h \
+	../StatisticsLibrary/base/sampletraits.h \
+	../StatisticsLibrary/base/shiftbounds.h \
+	../StatisticsLibrary/base/shiftkernel.h \
+	../StatisticsLibrary/base/simd.h \
 	../StatisticsLibrary/base/stats.h \
 	../StatisticsLibrary/base/ValueLoc.h \
 	../StatisticsLibrary/base/corloc.h \
@@ -156,12 +174,17 @@ SOURCES += \
 	../core/CsvTable.cpp \
 	../core/VirtualTip.cpp \
 	../core/StreamBuffer.cpp \
+	../core/MarkRasterizer.cpp \
         ../core/logger.cpp \
 	../QtBoxesDemo/QGLExtensionWrangler/glextensions.cpp \
 	../core/StatInterface.cpp \
+	../StatisticsLibrary/base/arealcorrelation.cpp \
+	../StatisticsLibrary/base/calibration.cpp \
+	../StatisticsLibrary/base/correlationsurface.cpp \
 	../StatisticsLibrary/base/FlippableCorLoc.cpp \
 	../StatisticsLibrary/base/mydebug.cpp \
 	../StatisticsLibrary/base/random.cpp \
+	../StatisticsLibrary/base/resample.cpp \
 	../StatisticsLibrary/base/mt19937ar.cpp \
 	../StatisticsLibrary/base/stats.cpp \
 	../StatisticsLibrary/base/ValueLoc.cpp \
@@ -0,0 +1,319 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#include "MarkRasterizer.h"
+#include <QThread>
+#include <QtConcurrentMap>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    ///A band of mesh rows and the private depth buffer it renders into.
+    struct RowBand
+    {
+        int rowBegin;
+        int rowEnd;
+        QVector<float> bins;
+    };
+
+    ///A range of depth buffer bins to merge.
+    struct BinRange
+    {
+        int begin;
+        int end;
+    };
+
+    ///Renders one RowBand; unit of work for QtConcurrent.
+    class RenderBand
+    {
+    public:
+        typedef void result_type;
+
+        RenderBand(const MarkRasterizer *r, const QMatrix4x4 &model, const MarkRasterizer::Projection &proj) :
+            _r(r), _model(model), _proj(proj) {}
+
+        void operator()(RowBand &band) const
+        {
+            band.bins.fill(MarkRasterizer::clearValue(), _proj.bins);
+            _r->renderRows(_model, _proj, band.rowBegin, band.rowEnd, band.bins.data());
+        }
+
+    private:
+        const MarkRasterizer *_r;
+        QMatrix4x4 _model;
+        MarkRasterizer::Projection _proj;
+    };
+
+    ///One mark of a batch and the depth buffer it renders into.
+    struct BatchMark
+    {
+        QMatrix4x4 model;
+        MarkRasterizer::Projection proj;
+        QVector<float> bins;
+    };
+
+    ///Renders one whole BatchMark on the calling thread.
+    class RenderMark
+    {
+    public:
+        typedef void result_type;
+
+        RenderMark(const MarkRasterizer *r) : _r(r) {}
+
+        void operator()(BatchMark &mark) const
+        {
+            mark.bins.fill(MarkRasterizer::clearValue(), mark.proj.bins);
+            _r->renderRows(mark.model, mark.proj, 0, _r->getHeight() - 1, mark.bins.data());
+        }
+
+    private:
+        const MarkRasterizer *_r;
+    };
+
+    ///Depth tests the private buffers of all bands against each other.
+    class MergeBins
+    {
+    public:
+        typedef void result_type;
+
+        MergeBins(const QVector<RowBand> *bands, float *out) : _bands(bands), _out(out) {}
+
+        void operator()(BinRange &range) const
+        {
+            int numBands = _bands->size();
+            for (int i = range.begin; i < range.end; ++i)
+            {
+                float d = MarkRasterizer::clearValue();
+                for (int b = 0; b < numBands; ++b)
+                {
+                    float v = (*_bands)[b].bins[i];
+                    if (v < d) d = v;
+                }
+                _out[i] = d;
+            }
+        }
+
+    private:
+        const QVector<RowBand> *_bands;
+        float *_out;
+    };
+
+    ///Draw the segment (ya, za)-(yb, zb) into the bins whose centers it covers.
+    inline void drawSegment(float ya, float za, float yb, float zb,
+        const MarkRasterizer::Projection &proj, float depthScale, float *bins)
+    {
+        if (ya == yb) return; // zero area triangles, nothing is rasterized.
+
+        float lo = (ya < yb) ? ya : yb;
+        float hi = (ya < yb) ? yb : ya;
+
+        //Bins whose center yMin + (j + 0.5)*resolution is in [lo, hi).
+        int jStart = (int)std::ceil((lo - proj.yMin)/proj.resolution - 0.5f);
+        int jEnd = (int)std::ceil((hi - proj.yMin)/proj.resolution - 0.5f);
+        if (jStart < 0) jStart = 0;
+        if (jEnd > proj.bins) jEnd = proj.bins;
+
+        float dzdy = (zb - za)/(yb - ya);
+        for (int j = jStart; j < jEnd; ++j)
+        {
+            float center = proj.yMin + (j + 0.5f)*proj.resolution;
+            float z = za + (center - ya)*dzdy;
+
+            //Same mapping glOrtho + glViewport apply to the eye z.
+            float d = (-(z + proj.cameraZ) - proj.nearClip)*depthScale;
+            if (d < 0.0f || d > 1.0f) continue; // clipped.
+            if (d < bins[j]) bins[j] = d; // GL_LESS.
+        }
+    }
+}
+
+//=======================================================================
+//=======================================================================
+MarkRasterizer::MarkRasterizer(int width, int height, float pixelSizeX, float pixelSizeY,
+    const QVector<float>& depth, const QBitArray& mask) :
+    _width(width),
+    _height(height),
+    _pixelSizeX(pixelSizeX),
+    _pixelSizeY(pixelSizeY),
+    _depth(depth)
+{
+    //Same topology as VirtualTip::draw(). The "only draw at end"
+    //edges there can never be reached inside its loops, so they
+    //are left out here too.
+    _edges.fill(0, width*height);
+    for (int i = 0; i < height - 1; ++i)
+    {
+        for (int j = 0; j < width - 1; ++j)
+        {
+            int idx0 = width*i + j;
+            int idx1 = idx0 + 1;
+            int idx2 = width + idx0;
+            int idx3 = idx2 + 1;
+
+            bool m0 = mask.testBit(idx0);
+            bool m1 = mask.testBit(idx1);
+            bool m2 = mask.testBit(idx2);
+            bool m3 = mask.testBit(idx3);
+
+            uchar flags = 0;
+            if (m0 && m1) flags |= Edge_Right;
+            if (m0 && m2) flags |= Edge_Down;
+            if (m1 && m2) flags |= Edge_Anti;
+            if (m0 && m3) flags |= Edge_Diag;
+            _edges[idx0] = flags;
+        }
+    }
+}
+
+//=======================================================================
+//=======================================================================
+void MarkRasterizer::projectRow(const QMatrix4x4& model, int row, float* ys, float* zs) const
+{
+    //Only y and z survive the squish matrix.
+    const float y0 = model(1, 0), y1 = model(1, 1), y2 = model(1, 2), y3 = model(1, 3);
+    const float z0 = model(2, 0), z1 = model(2, 1), z2 = model(2, 2), z3 = model(2, 3);
+
+    const float* depthPtr = _depth.constData() + row*_width;
+    const float y = row*_pixelSizeY;
+    const float yOffset = y1*y + y3;
+    const float zOffset = z1*y + z3;
+    for (int j = 0; j < _width; ++j)
+    {
+        float x = j*_pixelSizeX;
+        float z = depthPtr[j];
+        ys[j] = y0*x + y2*z + yOffset;
+        zs[j] = z0*x + z2*z + zOffset;
+    }
+}
+
+//=======================================================================
+//=======================================================================
+void MarkRasterizer::renderRows(const QMatrix4x4& model, const Projection& proj,
+    int rowBegin, int rowEnd, float* bins) const
+{
+    if (rowEnd > _height - 1) rowEnd = _height - 1;
+    if (rowBegin >= rowEnd) return;
+
+    const float depthScale = 1.0f/(proj.farClip - proj.nearClip);
+
+    //Two rows of projected points: the current one and the one below.
+    QVector<float> buffer(4*_width);
+    float* ysCur = buffer.data();
+    float* zsCur = ysCur + _width;
+    float* ysNext = zsCur + _width;
+    float* zsNext = ysNext + _width;
+
+    projectRow(model, rowBegin, ysCur, zsCur);
+    for (int i = rowBegin; i < rowEnd; ++i)
+    {
+        projectRow(model, i + 1, ysNext, zsNext);
+
+        const uchar* edges = _edges.constData() + i*_width;
+        for (int j = 0; j < _width - 1; ++j)
+        {
+            uchar flags = edges[j];
+            if (!flags) continue;
+
+            if (flags & Edge_Right)
+                drawSegment(ysCur[j], zsCur[j], ysCur[j + 1], zsCur[j + 1], proj, depthScale, bins);
+            if (flags & Edge_Down)
+                drawSegment(ysNext[j], zsNext[j], ysCur[j], zsCur[j], proj, depthScale, bins);
+            if (flags & Edge_Anti)
+                drawSegment(ysNext[j], zsNext[j], ysCur[j + 1], zsCur[j + 1], proj, depthScale, bins);
+            if (flags & Edge_Diag)
+                drawSegment(ysCur[j], zsCur[j], ysNext[j + 1], zsNext[j + 1], proj, depthScale, bins);
+        }
+
+        std::swap(ysCur, ysNext);
+        std::swap(zsCur, zsNext);
+    }
+}
+
+//=======================================================================
+//=======================================================================
+QVector<float> MarkRasterizer::render(const QMatrix4x4& model, const Projection& proj,
+    int numThreads) const
+{
+    QVector<float> ret(proj.bins, clearValue());
+    if (proj.bins <= 0 || _height < 2) return ret;
+
+    if (numThreads <= 0) numThreads = QThread::idealThreadCount();
+    if (numThreads <= 0) numThreads = 1;
+
+    //Triangles: a few bands per thread so uneven masks still balance.
+    int numRows = _height - 1;
+    int numBands = qMin(4*numThreads, numRows);
+    QVector<RowBand> bands(numBands);
+    for (int b = 0; b < numBands; ++b)
+    {
+        bands[b].rowBegin = (int)((qint64)numRows*b/numBands);
+        bands[b].rowEnd = (int)((qint64)numRows*(b + 1)/numBands);
+    }
+    QtConcurrent::blockingMap(bands, RenderBand(this, model, proj));
+
+    //Bins: depth test the bands against each other.
+    int numRanges = qMin(numThreads, proj.bins);
+    QVector<BinRange> ranges(numRanges);
+    for (int r = 0; r < numRanges; ++r)
+    {
+        ranges[r].begin = (int)((qint64)proj.bins*r/numRanges);
+        ranges[r].end = (int)((qint64)proj.bins*(r + 1)/numRanges);
+    }
+    QtConcurrent::blockingMap(ranges, MergeBins(&bands, ret.data()));
+
+    return ret;
+}
+
+//=======================================================================
+//=======================================================================
+QVector<QVector<float> > MarkRasterizer::renderBatch(const QVector<QMatrix4x4>& models,
+    const QVector<Projection>& projs, int numThreads) const
+{
+    Q_ASSERT(models.size() == projs.size());
+
+    if (numThreads <= 0) numThreads = QThread::idealThreadCount();
+    if (numThreads <= 0) numThreads = 1;
+
+    int numMarks = models.size();
+    QVector<QVector<float> > ret(numMarks);
+    if (numMarks < numThreads)
+    {
+        for (int i = 0; i < numMarks; ++i)
+            ret[i] = render(models[i], projs[i], numThreads);
+        return ret;
+    }
+
+    QVector<BatchMark> marks(numMarks);
+    for (int i = 0; i < numMarks; ++i)
+    {
+        marks[i].model = models[i];
+        marks[i].proj = projs[i];
+    }
+    QtConcurrent::blockingMap(marks, RenderMark(this));
+
+    for (int i = 0; i < numMarks; ++i)
+        ret[i] = marks[i].bins;
+    return ret;
+}
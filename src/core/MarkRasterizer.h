@@ -0,0 +1,121 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#ifndef MARKRASTERIZER_H
+#define MARKRASTERIZER_H
+
+#include <QVector>
+#include <QBitArray>
+#include <QMatrix4x4>
+
+/**
+ * Software replacement for the OpenGL virtual marking pipeline in VirtualTip.
+ *
+ * The tip is meshed with the same "cat's cradle" strategy VirtualTip::draw()
+ * uses. Because the squish matrix flattens x, every pair of triangles
+ * collapses to a line segment in (y, z) and the depth test reduces to keeping
+ * the nearest z for every resolution bin along y. The output is a depth
+ * buffer in OpenGL window coordinates ([0, 1], clearValue() where nothing was
+ * drawn) so it can go through the same CleanVirtualMark steps as a buffer
+ * read back from the GPU.
+ *
+ * Everything that does not depend on the marking angle (the mesh topology)
+ * is built once in the constructor.
+ */
+class MarkRasterizer
+{
+public:
+    ///Orthographic projection parameters for a single mark.
+    struct Projection
+    {
+        float yMin; ///< Bottom edge of the scene (um).
+        float resolution; ///< Height of one bin (um).
+        int bins; ///< Number of bins in the depth buffer.
+        float nearClip;
+        float farClip;
+        float cameraZ;
+    };
+
+public:
+    MarkRasterizer(int width, int height, float pixelSizeX, float pixelSizeY,
+        const QVector<float>& depth, const QBitArray& mask);
+
+    ///Depth value of a bin that nothing was drawn into (glClearDepth default).
+    static float clearValue() { return 1.0f; }
+
+    ///Rasterize the tip transformed by model into a depth buffer.
+    /**
+     * model is the full object transform (rotation * coordinate system).
+     * The work is split across row bands of the mesh and then across bins
+     * for the final depth test. numThreads <= 0 uses
+     * QThread::idealThreadCount().
+     */
+    QVector<float> render(const QMatrix4x4& model, const Projection& proj,
+        int numThreads = 0) const;
+
+    ///Rasterize the tip once per model/projection pair.
+    /**
+     * The marks are spread across threads, one whole mark per task,
+     * all sharing the mesh built in the constructor. If there are
+     * fewer marks than threads, each mark is split with render() instead.
+     */
+    QVector<QVector<float> > renderBatch(const QVector<QMatrix4x4>& models,
+        const QVector<Projection>& projs, int numThreads = 0) const;
+
+    ///Rasterize rows [rowBegin, rowEnd) of the mesh into bins.
+    /**
+     * bins must hold proj.bins values and be initialized by the caller.
+     * This is single threaded; it is the unit of work for render().
+     */
+    void renderRows(const QMatrix4x4& model, const Projection& proj,
+        int rowBegin, int rowEnd, float* bins) const;
+
+    inline int getWidth() const { return _width; }
+    inline int getHeight() const { return _height; }
+
+protected:
+    ///Edges of the mesh that leave a given point.
+    enum EdgeFlags
+    {
+        Edge_Right = 0x1, ///< 0-1
+        Edge_Down = 0x2, ///< 0-2
+        Edge_Anti = 0x4, ///< 1-2
+        Edge_Diag = 0x8 ///< 0-3
+    };
+
+    ///Project one row of the tip into (y, z) scene coordinates.
+    void projectRow(const QMatrix4x4& model, int row, float* ys, float* zs) const;
+
+protected:
+    int _width;
+    int _height;
+    float _pixelSizeX;
+    float _pixelSizeY;
+    ///Tip depth (implicitly shared).
+    QVector<float> _depth;
+    ///EdgeFlags for every point; one byte per point.
+    QVector<uchar> _edges;
+};
+
+#endif // MARKRASTERIZER_H
@@ -34,6 +34,7 @@
 #include <QTextStream>
 #include <QPainter>
 #include <cmath>
+#include <algorithm>
 #include "logger.h"
 #include "UtlQt3d.h"
 
@@ -74,6 +75,7 @@ RangeImage::RangeImage(int w, int h, float pixX,
     _depth = zdata;
     _texture = tex2D;
     _mask = maskdata;
+    packMask();
     _coordinateSystem = csys;
 
 	//Member assignment
@@ -97,6 +99,7 @@ RangeImage::RangeImage(const RangeImage& other,
     _depth = other.getDepth();
     _texture = other.getTexture();
     _mask = other.getMask();
+    packMask();
     _coordinateSystem = other.getCoordinateSystemMatrix();
 
 	//Member assignment
@@ -231,6 +234,7 @@ bool RangeImage::readFileData(QDataStream &fileReader, const QString& fname, int
         if (iconOnly) return true;
 
         fileReader >> _mask;
+        packMask();
         fileReader >> _coordinateSystem;
         return true;
     }
@@ -242,6 +246,7 @@ bool RangeImage::readFileData(QDataStream &fileReader, const QString& fname, int
         fileReader >> _depth;
         fileReader >> _texture;
         fileReader >> _mask;
+        packMask();
         fileReader >> _coordinateSystem;
         return true;
     }
@@ -469,6 +474,21 @@ const QImage& RangeImage::getTexture() const
 void RangeImage::setMask(const QBitArray &ba)
 {
     _mask = ba;
+    packMask();
+}
+
+//=======================================================================
+//=======================================================================
+void RangeImage::packMask()
+{
+    const int size = _mask.size();
+    _maskWords.fill(0, (size + 63)/64);
+    quint64* words = _maskWords.data();
+    for (int k = 0; k < size; ++k)
+    {
+        if (_mask.testBit(k))
+            words[k >> 6] |= Q_UINT64_C(1) << (k & 63);
+    }
 }
 
 //=======================================================================
@@ -934,11 +954,13 @@ Profile* RangeImage::getColumn(int idx)
 		return NULL;
 	
 	//Populate depth and mask.
-	QVector<float> column;
+    QVector<float> column (_height);
     QBitArray colMask (_height, true);
-    for (int i = 0; i < _height; ++i)
+    const float* depth = _depth.constData() + idx;
+    float* out = column.data();
+    for (int i = 0; i < _height; ++i, depth += _width)
 	{
-        column.push_back(_depth[_width*i + idx]);
+        out[i] = *depth;
         if (!_mask.testBit(_width*i + idx))
 			colMask.clearBit(i);
 	}
@@ -946,6 +968,92 @@ Profile* RangeImage::getColumn(int idx)
     return new Profile(_pixelSizeY, column, colMask);
 }
 
+//=======================================================================
+//=======================================================================
+Profile* RangeImage::getColumnBand(int center, int halfWidth, int reducer,
+    float trimFraction)
+{
+    if ((center < 0) || (center > _width - 1))
+        return NULL;
+
+    const int first = qMax(center - qMax(halfWidth, 0), 0);
+    const int last = qMin(center + qMax(halfWidth, 0), _width - 1);
+    const int bandWidth = last - first + 1;
+    const float trim = qBound(0.0f, trimFraction, 0.49f);
+
+    QVector<float> column (_height);
+    QBitArray colMask (_height, false);
+    float* out = column.data();
+    //The unmasked depths of one row of the band; rows are contiguous in _depth.
+    QVector<float> row (bandWidth);
+    float* v = row.data();
+    const quint64* words = _maskWords.constData();
+    for (int i = 0; i < _height; ++i)
+    {
+        const int rowStart = _width*i;
+        const float* depth = _depth.constData() + rowStart;
+        memcpy(v, depth + first, bandWidth*sizeof(float));
+
+        //The mask 64 pixels at a time; masked depths are squeezed out
+        //in place, so a run of whole unmasked words costs nothing.
+        int n = 0;
+        for (int k = 0; k < bandWidth; k += 64)
+        {
+            const int count = qMin(64, bandWidth - k);
+            const quint64 all = (count < 64) ? (Q_UINT64_C(1) << count) - 1 : ~Q_UINT64_C(0);
+            const int bit = rowStart + first + k;
+            const int shift = bit & 63;
+            quint64 bits = words[bit >> 6] >> shift;
+            if (shift + count > 64)
+                bits |= words[(bit >> 6) + 1] << (64 - shift);
+            bits &= all;
+
+            if (bits == all && n == k)
+            {
+                n += count;
+                continue;
+            }
+            for (int j = k; bits; ++j, bits >>= 1)
+            {
+                if (bits & 1)
+                    v[n++] = v[j];
+            }
+        }
+
+        //A row masked across the band keeps the center depth, as in getColumn().
+        if (n == 0)
+        {
+            out[i] = depth[center];
+            continue;
+        }
+        colMask.setBit(i);
+
+        if (Reducer_Median == reducer)
+        {
+            std::nth_element(v, v + n/2, v + n);
+            float median = v[n/2];
+            if (n % 2 == 0)
+                median = 0.5f*(median + *std::max_element(v, v + n/2));
+            out[i] = median;
+            continue;
+        }
+
+        int lo = 0, hi = n;
+        if (Reducer_TrimmedMean == reducer)
+        {
+            std::sort(v, v + n);
+            lo = (int) (trim*n);
+            hi = n - lo;
+        }
+        double sum = 0.0;
+        for (int j = lo; j < hi; ++j)
+            sum += v[j];
+        out[i] = (float) (sum/(hi - lo));
+    }
+
+    return new Profile(_pixelSizeY, column, colMask);
+}
+
 //=======================================================================
 //=======================================================================
 void RangeImage::logInfo()
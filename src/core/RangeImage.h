@@ -70,6 +70,15 @@ public:
         ImgType_Max = 4
     };
 
+    ///How getColumnBand() makes one depth out of a row of the band.
+    enum EColumnReducer
+    {
+        Reducer_Mean = 0,
+        Reducer_Median = 1,
+        ///Mean of what is left after trimming a fraction off either end.
+        Reducer_TrimmedMean = 2
+    };
+
 public:
 	///Load from .mt file.
     RangeImage(const QString& fname, QObject *parent = 0);
@@ -190,6 +199,20 @@ public slots:
 	 * Returns NULL if idx is out of range.
 	 */
 	Profile* getColumn(int idx);
+	///Retrieve columns center - halfWidth to center + halfWidth as one Profile.
+	/**
+	 * Each row of the band is reduced to one depth with reducer (an
+	 * EColumnReducer value) over its unmasked pixels; a row with none
+	 * is masked and keeps the depth of the center column.
+	 * Reducer_TrimmedMean drops trimFraction of them from either end
+	 * first. The band is clipped to the image, and is read row by row
+	 * in a single pass, its mask 64 pixels at a time. halfWidth 0
+	 * gives getColumn(). You are responsible for the pointer.
+	 *
+	 * Returns NULL if center is out of range.
+	 */
+	Profile* getColumnBand(int center, int halfWidth, int reducer = Reducer_Mean,
+		float trimFraction = 0.2f);
 
     virtual void logInfo();
 
@@ -204,6 +227,8 @@ protected:
     bool readFileData(QDataStream &fileReader, const QString& fname, int version, bool iconOnly);
     void guessImgType(const QString& fname);
     bool createIcon();
+    ///Refill _maskWords from _mask; call whenever _mask is assigned.
+    void packMask();
 
     //Check to make sure the data is consistent.
     bool isConsistent();
@@ -225,6 +250,8 @@ protected:
   QImage _texture;
   ///The mask point data in the order @f$ M_1M_2M_3 @f$....
   QBitArray _mask;
+  ///_mask 64 pixels per word: pixel k is bit k%64 of word k/64.
+  QVector<quint64> _maskWords;
   ///Matrix defining the object coordinate system.
   QMatrix4x4 _coordinateSystem;
 
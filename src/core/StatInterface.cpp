@@ -25,15 +25,25 @@
  */
 
 #include "StatInterface.h"
+#include "RangeImage.h"
 #include "../StatisticsLibrary/io/converttracetoint.h"
 #include <memory>
 #include <vector>
 #include <stdexcept>
+#include <cmath>
+#include <fstream>
 #include <QDebug>
+#include "../StatisticsLibrary/base/calibration.h"
+#include "../StatisticsLibrary/base/correlationsurface.h"
+#include "../StatisticsLibrary/base/dtwcorrelation.h"
 #include "../StatisticsLibrary/base/flipcorrelation.h"
 #include "../StatisticsLibrary/base/FlippableCorLoc.h"
+#include "../StatisticsLibrary/base/pyramidcorrelation.h"
 #include "../StatisticsLibrary/base/intnolev_functors.h"
 #include "../StatisticsLibrary/base/stats.h"
+#include "../StatisticsLibrary/base/random.h"
+#include "../StatisticsLibrary/base/resample.h"
+#include "../StatisticsLibrary/base/parallel.h"
 #include <QScriptContext>
 #include <QScriptEngine>
 
@@ -41,10 +51,45 @@ using std::vector;
 using std::auto_ptr;
 using std::runtime_error;
 
+///T samples per round when sampling until tTolerance is met.
+static const int TBatch = 16;
+///Standard errors either way of mean T for tTolerance (95%).
+static const double TConfidenceZ = 1.96;
+
+/**
+ * One search workspace per sample type, and the validation correlations
+ * and rank buffers of each chunk of T samples in sampleT(). Chunk c
+ * only ever runs on one thread at a time, so it can own samples[c].
+ */
+struct StatInterface::Scratch
+{
+	struct Samples
+	{
+		std::vector<double> rigidCor;
+		std::vector<double> randomCor;
+		//The chunk's samples end to end, ranked together (see RankSums).
+		std::vector<double> rigidCors;
+		std::vector<double> randomCors;
+		std::vector<size_t> rigidBegin;
+		std::vector<size_t> randomBegin;
+		std::vector<int> ranked;
+		std::vector<double> T;
+		RankSums ranks;
+	};
+
+	MaxCorrelationWithFlips<const int*>::Workspace intSearch;
+	MaxCorrelationWithFlips<const float*>::Workspace floatSearch;
+	std::vector<Samples> samples;
+
+	MaxCorrelationWithFlips<const int*>::Workspace& search(const int*) {return intSearch;}
+	MaxCorrelationWithFlips<const float*>::Workspace& search(const float*) {return floatSearch;}
+};
+
 StatInterface::StatInterface(QObject *parent):
     QObject(parent),
     _dataLen1(0),
-    _dataLen2(0)
+    _dataLen2(0),
+    _scratch(new Scratch)
 {
 	//Default values (from Amy's mytest.param).
 	T_sample_size = 200; 
@@ -53,6 +98,23 @@ StatInterface::StatInterface(QObject *parent):
 	numRigidPairs = 50;
 	numRandomPairs = 50;
 	maxShiftPercentage = 1.0f;
+	numThreads = 0;
+	seed = 337;
+	numCandidates = 1;
+	pruneSearch = false;
+	searchStrategy = Search_Exhaustive;
+	sampleType = Sample_Int;
+	tTolerance = 0.0;
+	tSamplesUsed = 0;
+	minValidFraction = 0.0f;
+	checkFlip = false;
+	warpBand = 8;
+	resampling = Resample_Linear;
+	flipped = false;
+	sweepColumn = -1;
+	likelihoodRatio = 0.0;
+	candidate = 0;
+	prunedShifts = 0;
 }
 
 StatInterface::~StatInterface()
@@ -69,9 +131,43 @@ StatInterface::StatConfig StatInterface::getConfig()
     cfg.numRandomPairs = numRandomPairs;
     cfg.maxShiftPercentage = maxShiftPercentage;
     cfg.tSampleSize = T_sample_size;
+    cfg.numThreads = numThreads;
+    cfg.seed = seed;
+    cfg.numCandidates = numCandidates;
+    cfg.pruneSearch = pruneSearch;
+    cfg.searchStrategy = searchStrategy;
+    cfg.sampleType = sampleType;
+    cfg.tTolerance = tTolerance;
+    cfg.minValidFraction = minValidFraction;
+    cfg.checkFlip = checkFlip;
+    cfg.warpBand = warpBand;
+    cfg.resampling = resampling;
+    cfg.calibration = calibration;
     return cfg;
 }
 
+void StatInterface::setConfig(const StatConfig& cfg)
+{
+    setMaxShiftPercentage(cfg.maxShiftPercentage);
+    setNumRandomPairs(cfg.numRandomPairs);
+    setNumRigidPairs(cfg.numRigidPairs);
+    setSearchWindow(cfg.searchWindow);
+    setValidWindow(cfg.validWindow);
+    setTSampleSize(cfg.tSampleSize);
+    setTTolerance(cfg.tTolerance);
+    setNumThreads(cfg.numThreads);
+    setSeed(cfg.seed);
+    setNumCandidates(cfg.numCandidates);
+    setPruneSearch(cfg.pruneSearch);
+    setSearchStrategy(cfg.searchStrategy);
+    setSampleType(cfg.sampleType);
+    setMinValidFraction(cfg.minValidFraction);
+    setCheckFlip(cfg.checkFlip);
+    setWarpBand(cfg.warpBand);
+    setResampling(cfg.resampling);
+    setCalibration(cfg.calibration);
+}
+
 //This works without deep copies because 
 //QVector is implicitly shared.
 QVector<double> StatInterface::toDouble(const QVector<float> data)
@@ -85,14 +181,27 @@ QVector<double> StatInterface::toDouble(const QVector<float> data)
 }
 
 QVector<float> StatInterface::trimProfileEnds(Profile *data)
+{
+	const TraceView<float> depth = trimmedDepth(data);
+
+	//Trim it.
+	QVector<float> ret;
+	for (size_t i = 0; i < depth.size(); ++i)
+		ret.push_back(depth[i]);
+
+	return ret;
+}
+
+TraceView<float> StatInterface::trimmedDepth(Profile *data,
+	std::vector<unsigned char>* valid)
 {
 	//Cache some things.
-	QVector<float> depth = data->getDepth();
-	QBitArray mask = data->getMask();
+	const QVector<float>& depth = data->getDepth();
+	const QBitArray& mask = data->getMask();
 
 	//Find the ends to trim off.
 	int dataLength = depth.size();
-	int startIdx, endIdx;
+	int startIdx = dataLength, endIdx = -1;
 	for (int i = 0; i < dataLength; ++i)
 	{
 		if (mask.testBit(i))
@@ -111,40 +220,149 @@ QVector<float> StatInterface::trimProfileEnds(Profile *data)
 		}
 	}
 
-	//Trim it.
-	QVector<float> ret;
-	for (int i = startIdx; i < endIdx + 1; ++i)
-		ret.push_back(depth[i]);
+	if (endIdx < startIdx)
+		return TraceView<float>();
+	const int length = endIdx + 1 - startIdx;
+	if (!valid)
+		return TraceView<float>(depth.constData() + startIdx, length);
 
-	return ret;
+	valid->resize(length);
+	for (int i = 0; i < length; ++i)
+		(*valid)[i] = mask.testBit(startIdx + i) ? 1 : 0;
+	return TraceView<float>(depth.constData() + startIdx, length, valid->data());
+}
+
+float StatInterface::commonPixelSize(float pixelSize1, float pixelSize2) const
+{
+	if (pixelSize1 == pixelSize2)
+		return pixelSize1;
+	if (Resample_Off == resampling)
+	{
+		QString what (tr("The Profiles do not have matching pixel sizes."
+			"It does not make sense to compare them."
+			"TValue and other outputs not updated."));
+		qDebug() << what.toStdString().c_str();
+		throw std::range_error(what.toStdString());
+	}
+	return qMax(pixelSize1, pixelSize2);
+}
+
+TraceView<float> StatInterface::gridDepth(Profile *data, float pixelSize,
+	std::vector<float>& resampled, std::vector<unsigned char>* valid)
+{
+	if (data->getPixelSize() == pixelSize)
+		return trimmedDepth(data, valid);
+
+	//Resampled around the mask even if the mask is not correlated.
+	std::vector<unsigned char> ownValid;
+	const TraceView<float> depth = trimmedDepth(data, &ownValid);
+	const TraceResampler resample(Resample_Sinc == resampling ?
+		TraceResampler::Lanczos : TraceResampler::Linear);
+	resample(depth.data(), depth.valid(), (int) depth.size(),
+		data->getPixelSize(), pixelSize, resampled, valid);
+	return TraceView<float>(resampled.data(), resampled.size(), valid ? valid->data() : 0);
+}
+
+int StatInterface::minValid(int window) const
+{
+	return (int) std::ceil(minValidFraction * window);
 }
 
 void StatInterface::compare(QVector<float> data1, QVector<float> data2)
 {
+	compareDepths(TraceView<float>(data1.constData(), data1.size()),
+		TraceView<float>(data2.constData(), data2.size()));
+}
+
+void StatInterface::compareDepths(const TraceView<float>& depth1,
+	const TraceView<float>& depth2)
+{
+	if (Sample_Float == sampleType)
+	{
+		compareTraces(depth1, depth2);
+		return;
+	}
+
 	//Vector prep.
 	ConvertTraceToInt intConverter;
-    auto_ptr<vector<int> > trace1 = intConverter(toDouble(data1).toStdVector());
-    auto_ptr<vector<int> > trace2 = intConverter(toDouble(data2).toStdVector());
-	
+	auto_ptr<vector<int> > ints1 = intConverter(depth1.data(), depth1.size());
+	auto_ptr<vector<int> > ints2 = intConverter(depth2.data(), depth2.size());
+	compareTraces(TraceView<int>(ints1->data(), ints1->size(), depth1.valid()),
+		TraceView<int>(ints2->data(), ints2->size(), depth2.valid()));
+}
+
+template <typename Sample>
+void StatInterface::compareTraces(const TraceView<Sample>& trace1,
+	const TraceView<Sample>& trace2, const StatInterface* tables1)
+{
 	//Run without checking for flips.
 	//maxCorWithFlips is in flipcorrelation.h.
 	//Ru He says, "Once searchWindow is fixed, the 
 	//returned c.loc1(), c.loc2() in c object should be unique."
-	const int length1 = trace1->size();
-	const int length2 = trace2->size();
+	const int length1 = trace1.size();
+	const int length2 = trace2.size();
     _dataLen1 = length1;
     _dataLen2 = length2;
 
-	FlippableCorLoc c (0, 0, 0, true); //"default" FCL object.
+	//With more than one candidate, the search also keeps the next best
+	//non-overlapping peaks, and each one is validated in turn; the one
+	//with the highest T is reported. Candidate 0 is always the max
+	//correlation, and a spurious max no longer decides the result alone.
+	std::vector<FlippableCorLoc> candidates;
+	PruneStats pruned;
 	try
 	{
-		c = maxCorWithFlips(trace1->begin(),
-							trace2->begin(),
-							length1,
-							length2,
+		if (Search_Pyramid == searchStrategy)
+		{
+			candidates = maxCorPyramidPeaks(trace1,
+							trace2,
 							searchWindow,
 							maxShiftPercentage,
-							false);
+							numCandidates,
+							3,
+							numThreads,
+							minValid(searchWindow));
+		}
+		else if (Search_Elastic == searchStrategy)
+		{
+			candidates = maxCorDtwPeaks(trace1,
+							trace2,
+							searchWindow,
+							maxShiftPercentage,
+							numCandidates,
+							warpBand,
+							numThreads,
+							minValid(searchWindow));
+		}
+		else
+		{
+			//The tables go in the workspace kept for the next comparison.
+			typedef MaxCorrelationWithFlips<const Sample*> Search;
+			typename Search::Workspace& ws = _scratch->search((const Sample*) 0);
+			if (!tables1)
+				ws.t1.assign(trace1, searchWindow);
+			const typename Search::Prepared& t1 = tables1 ?
+				tables1->_scratch->search((const Sample*) 0).t1 : ws.t1;
+			ws.t2.assign(trace2, searchWindow);
+			if (numCandidates > 1)
+			{
+				candidates = Search(numThreads, false, minValid(searchWindow)).peaks(
+					t1, ws.t2, maxShiftPercentage, numCandidates);
+				//The best flipped pair gets validated along with the peaks.
+				if (checkFlip && !candidates.empty())
+				{
+					const FlippableCorLoc f = Search(numThreads, false, minValid(searchWindow)).flipped(
+						t1, ws.t2, maxShiftPercentage);
+					if (f.loc1() >= 0)
+						candidates.push_back(f);
+				}
+			}
+			if (candidates.empty())
+			{
+				candidates.push_back(Search(numThreads, pruneSearch, minValid(searchWindow))(
+					t1, ws.t2, maxShiftPercentage, &pruned, checkFlip));
+			}
+		}
 	} catch (runtime_error err) {
 		qDebug() << "There was a runtime error in the" <<
 			"stat package:";
@@ -153,83 +371,419 @@ void StatInterface::compare(QVector<float> data1, QVector<float> data2)
 		return; //exit from this function. r and t and loc1 and loc2 will stale.
 	}
 
-	//Calculate T value (and average if T_sample_size is > 1).
-	QVector<double> T_vector;
-	for (int i = 0; i < T_sample_size; ++i)
+	//Validate. Errors for candidate 0 go up as they always have;
+	//a later candidate whose validation windows do not fit is skipped.
+	//A flipped candidate is validated against trace2 read backwards;
+	//only its mask, if any, is copied in that order.
+	std::vector<unsigned char> mirroredValid;
+	if (trace2.valid())
+		mirroredValid.assign(std::reverse_iterator<const unsigned char*>(trace2.valid() + trace2.size()),
+			std::reverse_iterator<const unsigned char*>(trace2.valid()));
+	const MirroredTraceView<Sample> mirrored2(trace2, trace2.valid() ? mirroredValid.data() : 0);
+
+	int best = -1;
+	double bestT = 0;
+	int bestUsed = 0;
+	for (int i = 0; i < (int) candidates.size(); ++i)
 	{
-		//Maverick says, "[R]igid pairs correlation.
-		//In other words, the correlation for two windows
-		//that has [sic] the same shifts with respect to the
-		//position of maximum correlation."
-		//IntRigidCorSampExcludeSearch is in intnolev_functors.h
-		IntRigidCorSampExcludeSearch compRigidCor;
-		auto_ptr<vector<double> > rigidCor = 
-			compRigidCor(*trace1, *trace2, c.loc1(), c.loc2(),
-					  searchWindow, numRigidPairs, validWindow);
-		if (0 == rigidCor->size())
+		double T;
+		int used;
+		try
+		{
+			const FlippableCorLoc& c = candidates[i];
+			T = c.flipped() ?
+				sampleT(trace1, mirrored2, c.loc1(), c.loc2(), i, used) :
+				sampleT(trace1, trace2, c.loc1(), c.loc2(), i, used);
+		} catch (std::range_error err) {
+			if (0 == i) throw;
+			continue;
+		}
+		if (best < 0 || T > bestT)
 		{
-			//Ran out of space for the validation window.
-			QString what (tr("The rigid-shift "
-				"validation window "
-				"did not fit inside one of the trace data sets. "
-				"Bear in mind that the validation window "
-				"cannot lie inside the search window.\n\n"
-				"Try a smaller validation and/or search window."));
-			qDebug() << what;
-			throw std::range_error(what.toStdString());
-			return; //exit from this function.
+			best = i;
+			bestT = T;
+			bestUsed = used;
 		}
+	}
 
-		//Maverick says, "For the random pairs correlation,
-		//the shifts of two pairs are different w.r.t. to [sic]
-		//the position of maximum correlation.
-		//IntRandomCorSampExcludeSearch is in intnolev_functors.h
-		IntRandomCorSampExcludeSearch compRandomCor;
-		auto_ptr<vector<double> > randomCor =
-			compRandomCor(*trace1, *trace2, c.loc1(), c.loc2(),
-				searchWindow, numRandomPairs, validWindow);
-		if (0 == randomCor->size())
+	//Store the results.
+	const FlippableCorLoc& c = candidates[best];
+	tValue = bestT;
+	rValue = c.cor();
+	loc1 = c.loc1();
+	loc2 = c.loc2();
+	candidate = best;
+	flipped = c.flipped();
+	tSamplesUsed = bestUsed;
+	prunedShifts = (int) pruned.prunedShifts;
+	likelihoodRatio = calibration ? calibration->likelihoodRatio(tValue) : 0.0;
+}
+
+template <typename Trace1, typename Trace2>
+double StatInterface::sampleT(const Trace1& trace1, const Trace2& trace2,
+	int l1, int l2, int comparison, int& samplesUsed)
+{
+	//Calculate T value (and average if T_sample_size is > 1).
+	//Each sample draws from its own stream (seed, comparison, sample
+	//index), so the samples can run in any order on any number of threads
+	//and T_vector comes out the same.
+	enum SampleStatus {Sample_Ok = 0, Sample_NoRigid, Sample_NoRandom};
+	std::vector<double> T_vector(qMax(T_sample_size, 0));
+	std::vector<int> status(T_vector.size(), Sample_Ok);
+	const int cap = (int) T_vector.size();
+
+	//All the samples in one go or, with a tolerance, TBatch at a time
+	//until the mean is known well enough. The batches do not depend on
+	//numThreads, so neither does where sampling stops.
+	const bool adaptive = tTolerance > 0.0;
+	const int batch = adaptive ? TBatch : qMax(cap, 1);
+	RunningMeanVar running;
+	int used = 0;
+	while (used < cap)
+	{
+		const int begin = used;
+		const int count = qMin(batch, cap - begin);
+		//A chunk of samples per thread, each with its own buffers (see
+		//Scratch), so that the T samples do not allocate once warm.
+		const int numChunks = qMin(count, resolveNumThreads(numThreads));
+		if ((int) _scratch->samples.size() < numChunks)
+			_scratch->samples.resize(numChunks);
+		parallelFor(numChunks, numThreads, [&](int c) {
+			Scratch::Samples& scratch = _scratch->samples[c];
+			const int first = begin + count * c / numChunks;
+			const int last = begin + count * (c + 1) / numChunks;
+			scratch.rigidCors.clear();
+			scratch.randomCors.clear();
+			scratch.rigidBegin.assign(1, 0);
+			scratch.randomBegin.assign(1, 0);
+			scratch.ranked.clear();
+			for (int i = first; i < last; ++i)
+			{
+				RandomStream rng(seed, comparison, i);
+
+				//Maverick says, "[R]igid pairs correlation.
+				//In other words, the correlation for two windows
+				//that has [sic] the same shifts with respect to the
+				//position of maximum correlation."
+				//IntRigidCorSampExcludeSearch is in intnolev_functors.h
+				IntRigidCorSampExcludeSearch compRigidCor(minValid(validWindow));
+				vector<double>& rigidCor = scratch.rigidCor;
+				compRigidCor(trace1, trace2, l1, l2,
+					searchWindow, numRigidPairs, validWindow, rng, rigidCor);
+				if (0 == rigidCor.size())
+				{
+					status[i] = Sample_NoRigid;
+					continue;
+				}
+
+				//Maverick says, "For the random pairs correlation,
+				//the shifts of two pairs are different w.r.t. to [sic]
+				//the position of maximum correlation.
+				//IntRandomCorSampExcludeSearch is in intnolev_functors.h
+				IntRandomCorSampExcludeSearch compRandomCor(minValid(validWindow));
+				vector<double>& randomCor = scratch.randomCor;
+				compRandomCor(trace1, trace2, l1, l2,
+					searchWindow, numRandomPairs, validWindow, rng, randomCor);
+				if (0 == randomCor.size())
+				{
+					status[i] = Sample_NoRandom;
+					continue;
+				}
+
+				//Compute T value, below with the rest of the chunk's.
+				scratch.rigidCors.insert(scratch.rigidCors.end(), rigidCor.begin(), rigidCor.end());
+				scratch.randomCors.insert(scratch.randomCors.end(), randomCor.begin(), randomCor.end());
+				scratch.rigidBegin.push_back(scratch.rigidCors.size());
+				scratch.randomBegin.push_back(scratch.randomCors.size());
+				scratch.ranked.push_back(i);
+			}
+			if (scratch.ranked.empty())
+				return;
+			scratch.T.resize(scratch.ranked.size());
+			scratch.ranks.t1Statistics(scratch.rigidCors.data(), scratch.rigidBegin.data(),
+				scratch.randomCors.data(), scratch.randomBegin.data(),
+				scratch.ranked.size(), scratch.T.data());
+			for (size_t k = 0; k < scratch.ranked.size(); ++k)
+				T_vector[scratch.ranked[k]] = scratch.T[k];
+		});
+
+		used += count;
+
+		//Report the first failed sample, as the serial loop would have.
+		for (int i = begin; i < used; ++i)
 		{
-			//Ran out of space for the validation window.
-			QString whatnow (tr("The random-shift "
-				"validation window "
-				"did not fit inside one of the trace data sets. "
-				"Bear in mind that the validation window "
-				"cannot lie inside the search window.\n\n"
-				"Try a smaller validation and/or search window."));
-			qDebug() << whatnow;
-			throw std::range_error(whatnow.toStdString());
-			return; //exit from this function.
+			if (Sample_NoRigid == status[i])
+			{
+				//Ran out of space for the validation window.
+				QString what (tr("The rigid-shift "
+					"validation window "
+					"did not fit inside one of the trace data sets. "
+					"Bear in mind that the validation window "
+					"cannot lie inside the search window.\n\n"
+					"Try a smaller validation and/or search window."));
+				qDebug() << what;
+				throw std::range_error(what.toStdString());
+			}
+			if (Sample_NoRandom == status[i])
+			{
+				//Ran out of space for the validation window.
+				QString whatnow (tr("The random-shift "
+					"validation window "
+					"did not fit inside one of the trace data sets. "
+					"Bear in mind that the validation window "
+					"cannot lie inside the search window.\n\n"
+					"Try a smaller validation and/or search window."));
+				qDebug() << whatnow;
+				throw std::range_error(whatnow.toStdString());
+			}
 		}
 
-		//Compute T value
-		T_vector.push_back(t1Statistic(*rigidCor, *randomCor));
+		if (adaptive)
+		{
+			for (int i = begin; i < used; ++i)
+				running.add(T_vector[i]);
+			if (running.halfWidth(TConfidenceZ) < tTolerance)
+				break;
+		}
 	}
+	T_vector.resize(used);
+	samplesUsed = used;
+
 	//Average T values.
 	//If we made it this far, there were no errors.
 	double T_mean, T_var;
-	meanAndVar(T_vector.toStdVector(), T_mean, T_var);
+	meanAndVar(T_vector, T_mean, T_var);
 
-	//Store the results.
-	tValue = T_mean;
-	rValue = c.cor();
-	loc1 = c.loc1();
-	loc2 = c.loc2();
+	return T_mean;
 }
 
 void StatInterface::compare(Profile *data1, Profile *data2)
 {
-	if (data1->getPixelSize() != data2->getPixelSize())
+	const float pixelSize = commonPixelSize(data1->getPixelSize(), data2->getPixelSize());
+
+	//The masks and resampled depths only need to live as long as the comparison.
+	std::vector<unsigned char> valid1, valid2;
+	std::vector<float> grid1, grid2;
+	const bool masked = minValidFraction > 0.0f;
+	compareDepths(gridDepth(data1, pixelSize, grid1, masked ? &valid1 : 0),
+		gridDepth(data2, pixelSize, grid2, masked ? &valid2 : 0));
+}
+
+///A plate column as the samples of a sweep: the depths in place, or as ints.
+static TraceView<float> sweepTrace(const TraceView<float>& depth, const float*,
+	auto_ptr<vector<int> >&)
+{
+	return depth;
+}
+
+static TraceView<int> sweepTrace(const TraceView<float>& depth, const int*,
+	auto_ptr<vector<int> >& ints)
+{
+	ConvertTraceToInt intConverter;
+	ints = intConverter(depth.data(), depth.size());
+	return TraceView<int>(ints->data(), ints->size(), depth.valid());
+}
+
+QVector<StatInterface::ColumnResult> StatInterface::sweepColumns(Profile *data1,
+	RangeImage *plate, int step, int bandHalfWidth)
+{
+	if (data1->getPixelSize() != plate->getPixelSizeY() && Resample_Off == resampling)
 	{
-		QString what (tr("The Profiles do not have matching pixel sizes."
+		QString what (tr("The Profile and the plate columns do not have matching pixel sizes."
 			"It does not make sense to compare them."
 			"TValue and other outputs not updated."));
 		qDebug() << what.toStdString().c_str();
 		throw std::range_error(what.toStdString());
+	}
+
+	std::vector<unsigned char> valid1;
+	std::vector<float> grid1;
+	const bool masked = minValidFraction > 0.0f;
+	const TraceView<float> depth1 = gridDepth(data1, plate->getPixelSizeY(), grid1,
+		masked ? &valid1 : 0);
+	if (Sample_Float == sampleType)
+		return sweepTraces(depth1, plate, qMax(step, 1), bandHalfWidth);
+
+	ConvertTraceToInt intConverter;
+	auto_ptr<vector<int> > ints1 = intConverter(depth1.data(), depth1.size());
+	return sweepTraces(TraceView<int>(ints1->data(), ints1->size(), depth1.valid()),
+		plate, qMax(step, 1), bandHalfWidth);
+}
+
+template <typename Sample>
+QVector<StatInterface::ColumnResult> StatInterface::sweepTraces(const TraceView<Sample>& trace1,
+	RangeImage *plate, int step, int bandHalfWidth)
+{
+	//data1's tables, made once for every column; each worker below has
+	//its own tables for the column and its own T sample buffers.
+	typedef MaxCorrelationWithFlips<const Sample*> Search;
+	if (Search_Exhaustive == searchStrategy)
+		_scratch->search((const Sample*) 0).t1.assign(trace1, searchWindow);
+
+	const int numColumns = (plate->getWidth() + step - 1) / step;
+	QVector<ColumnResult> results(numColumns);
+	const int threads = resolveNumThreads(numThreads);
+	const int numChunks = qMin(numColumns, 4 * threads);
+	StatConfig cfg = getConfig();
+	cfg.numThreads = 1;
+	const bool masked = minValidFraction > 0.0f;
+
+	//Columns are compared whole on one thread each, so the results do
+	//not depend on how they are spread.
+	parallelFor(numChunks, threads, [&](int c) {
+		StatInterface worker;
+		worker.setConfig(cfg);
+		const int begin = (int) ((long long) numColumns * c / numChunks);
+		const int end = (int) ((long long) numColumns * (c + 1) / numChunks);
+		for (int k = begin; k < end; ++k)
+		{
+			ColumnResult& r = results[k];
+			r.column = k * step;
+			auto_ptr<Profile> column((bandHalfWidth > 0) ?
+				plate->getColumnBand(r.column, bandHalfWidth) : plate->getColumn(r.column));
+			std::vector<unsigned char> valid2;
+			auto_ptr<vector<int> > ints2;
+			const TraceView<float> depth2 = trimmedDepth(column.get(), masked ? &valid2 : 0);
+			try
+			{
+				worker.compareTraces(trace1, sweepTrace(depth2, (const Sample*) 0, ints2), this);
+			} catch (std::exception&) {
+				continue;
+			}
+			r.valid = true;
+			r.rValue = worker.rValue;
+			r.tValue = worker.tValue;
+			r.loc1 = worker.loc1;
+			r.loc2 = worker.loc2;
+			r.flipped = worker.flipped;
+			r.likelihoodRatio = worker.likelihoodRatio;
+		}
+	});
+
+	//The first column with the highest T.
+	sweepColumn = -1;
+	for (int k = 0; k < numColumns; ++k)
+	{
+		const ColumnResult& r = results[k];
+		if (!r.valid || (sweepColumn >= 0 && r.tValue <= tValue))
+			continue;
+		sweepColumn = r.column;
+		rValue = r.rValue;
+		tValue = r.tValue;
+		loc1 = r.loc1;
+		loc2 = r.loc2;
+		flipped = r.flipped;
+		likelihoodRatio = r.likelihoodRatio;
+	}
+	return results;
+}
+
+void StatInterface::correlationSurface(Profile *data1, Profile *data2, SurfaceSink& sink)
+{
+	const float pixelSize = commonPixelSize(data1->getPixelSize(), data2->getPixelSize());
+	std::vector<unsigned char> valid1, valid2;
+	std::vector<float> grid1, grid2;
+	const bool masked = minValidFraction > 0.0f;
+	const TraceView<float> depth1 = gridDepth(data1, pixelSize, grid1, masked ? &valid1 : 0);
+	const TraceView<float> depth2 = gridDepth(data2, pixelSize, grid2, masked ? &valid2 : 0);
+	if (Sample_Float == sampleType)
+	{
+		corSurface(depth1, depth2, searchWindow, sink, numThreads, minValid(searchWindow));
 		return;
 	}
 
-	compare(trimProfileEnds(data1), trimProfileEnds(data2));
+	ConvertTraceToInt intConverter;
+	auto_ptr<vector<int> > ints1 = intConverter(depth1.data(), depth1.size());
+	auto_ptr<vector<int> > ints2 = intConverter(depth2.data(), depth2.size());
+	corSurface(TraceView<int>(ints1->data(), ints1->size(), depth1.valid()),
+		TraceView<int>(ints2->data(), ints2->size(), depth2.valid()),
+		searchWindow, sink, numThreads, minValid(searchWindow));
+}
+
+bool StatInterface::saveCorrelationSurface(Profile *data1, Profile *data2,
+	const QString& fileName, bool halfFloat)
+{
+	SurfaceFileWriter writer(fileName.toLocal8Bit().constData(), halfFloat);
+	if (!writer.ok())
+	{
+		qDebug() << "Could not open" << fileName << "for the correlation surface.";
+		return false;
+	}
+	correlationSurface(data1, data2, writer);
+	return writer.ok();
+}
+
+QImage StatInterface::correlationHeatMap(Profile *data1, Profile *data2,
+	int width, int height)
+{
+	SurfaceHeatMap heatMap(width, height);
+	correlationSurface(data1, data2, heatMap);
+	return heatMapImage(heatMap);
+}
+
+QImage StatInterface::heatMapImage(const SurfaceHeatMap& heatMap)
+{
+	QImage image(heatMap.width(), heatMap.height(), QImage::Format_RGB32);
+	const std::vector<float>& bins = heatMap.bins();
+	for (int i = 0; i < heatMap.height(); ++i)
+	{
+		QRgb* line = (QRgb*) image.scanLine(i);
+		for (int j = 0; j < heatMap.width(); ++j)
+		{
+			const float r = bins.empty() ? 0.0f : bins[i * heatMap.width() + j];
+			if (r != r)
+			{
+				line[j] = qRgb(128, 128, 128);
+				continue;
+			}
+			//White at 0, fading to red for 1 and to blue for -1.
+			const int fade = 255 - (int) (255 * qMin(qAbs(r), 1.0f) + 0.5f);
+			line[j] = (r > 0) ? qRgb(255, fade, fade) : qRgb(fade, fade, 255);
+		}
+	}
+	return image;
+}
+
+ArealMatch StatInterface::compareAreal(Profile *data1, RangeImage *plate,
+	int bandWidth, int col0, int numCols, SurfaceSink *sink)
+{
+	if (data1->getPixelSize() != plate->getPixelSizeY() && Resample_Off == resampling)
+	{
+		QString what (tr("The Profile and the plate columns do not have matching pixel sizes."
+			"It does not make sense to compare them."));
+		qDebug() << what.toStdString().c_str();
+		throw std::range_error(what.toStdString());
+	}
+	if (numCols <= 0)
+		numCols = plate->getWidth() - col0;
+	if (col0 < 0 || numCols <= 0 || col0 + numCols > plate->getWidth())
+		throw std::out_of_range("compareAreal: the columns are not inside the plate");
+
+	std::vector<unsigned char> valid;
+	std::vector<float> grid;
+	const TraceView<float> depth = gridDepth(data1, plate->getPixelSizeY(), grid, &valid);
+	const ArealImage band = extrudedTrace(depth.data(), depth.valid(), depth.size(), bandWidth);
+
+	//The plate columns, with the mask as 0/1 weights.
+	const int width = plate->getWidth();
+	const QVector<float>& z = plate->getDepth();
+	const QBitArray& mask = plate->getMask();
+	ArealImage region(numCols, plate->getHeight());
+	region.weights.resize(region.values.size());
+	for (int i = 0; i < region.height; ++i)
+	{
+		for (int j = 0; j < numCols; ++j)
+		{
+			const int idx = width*i + col0 + j;
+			region.values[i*numCols + j] = z[idx];
+			region.weights[i*numCols + j] = mask.testBit(idx) ? 1.0f : 0.0f;
+		}
+	}
+
+	ArealMatch match = arealCorrelation(band, region, numThreads, minValidFraction, sink);
+	if (match.found())
+		match.col += col0;
+	return match;
 }
 
 QScriptValue StatInterface::compare()
@@ -290,3 +844,143 @@ void StatInterface::setMaxShiftPercentage(double num)
 	maxShiftPercentage = (float) num;
 }
 
+void StatInterface::setNumThreads(int num)
+{
+	numThreads = num;
+}
+
+void StatInterface::setSeed(uint num)
+{
+	seed = num;
+}
+
+void StatInterface::setNumCandidates(int num)
+{
+	numCandidates = num;
+}
+
+void StatInterface::setPruneSearch(bool prune)
+{
+	pruneSearch = prune;
+}
+
+void StatInterface::setSearchStrategy(int strategy)
+{
+	if (Search_Exhaustive == strategy || Search_Pyramid == strategy ||
+		Search_Elastic == strategy)
+		searchStrategy = strategy;
+}
+
+void StatInterface::setWarpBand(int band)
+{
+	if (band >= 0)
+		warpBand = band;
+}
+
+void StatInterface::setResampling(int method)
+{
+	if (Resample_Off == method || Resample_Linear == method ||
+		Resample_Sinc == method)
+		resampling = method;
+}
+
+void StatInterface::setTTolerance(double tolerance)
+{
+	if (tolerance >= 0.0)
+		tTolerance = tolerance;
+}
+
+void StatInterface::setSampleType(int type)
+{
+	if (Sample_Int == type || Sample_Float == type)
+		sampleType = type;
+}
+
+void StatInterface::setMinValidFraction(double fraction)
+{
+	if (fraction >= 0.0 && fraction <= 1.0)
+		minValidFraction = (float) fraction;
+}
+
+void StatInterface::setCheckFlip(bool check)
+{
+	checkFlip = check;
+}
+
+void StatInterface::setCalibration(const std::tr1::shared_ptr<const ScoreCalibration>& tables)
+{
+	calibration = tables;
+}
+
+///The numbers in list; anything else is left out.
+static std::vector<double> toTValues(const QVariantList& list)
+{
+	std::vector<double> ret;
+	for (int i = 0; i < list.size(); ++i)
+	{
+		bool ok = false;
+		const double t = list[i].toDouble(&ok);
+		if (ok)
+			ret.push_back(t);
+	}
+	return ret;
+}
+
+bool StatInterface::calibrate(const QVariantList& matchT, const QVariantList& nonMatchT,
+	int method, int numPoints)
+{
+	try
+	{
+		calibration.reset(new ScoreCalibration(toTValues(matchT), toTValues(nonMatchT),
+			(Calibration_Binned == method) ? ScoreCalibration::Binned : ScoreCalibration::Kde,
+			numPoints));
+		return true;
+	}
+	catch (std::exception& err)
+	{
+		qDebug() << "Could not calibrate:" << err.what();
+		return false;
+	}
+}
+
+bool StatInterface::saveCalibration(const QString& fileName) const
+{
+	if (!calibration)
+	{
+		qDebug() << "No calibration to save.";
+		return false;
+	}
+	std::ofstream out(fileName.toLocal8Bit().constData());
+	calibration->write(out);
+	if (!out)
+	{
+		qDebug() << "Could not save the calibration to" << fileName;
+		return false;
+	}
+	return true;
+}
+
+bool StatInterface::loadCalibration(const QString& fileName)
+{
+	std::ifstream in(fileName.toLocal8Bit().constData());
+	if (!in)
+	{
+		qDebug() << "Could not open" << fileName << "for the calibration.";
+		return false;
+	}
+	try
+	{
+		calibration.reset(new ScoreCalibration(ScoreCalibration::read(in)));
+		return true;
+	}
+	catch (std::exception& err)
+	{
+		qDebug() << fileName << ":" << err.what();
+		return false;
+	}
+}
+
+void StatInterface::clearCalibration()
+{
+	calibration.reset();
+}
@@ -26,11 +26,22 @@
 
 #ifndef __STATINTERFACE_H__
 #define __STATINTERFACE_H__
+#include <QImage>
 #include <QObject>
 #include <QVector>
 #include "Profile.h"
 #include <QScriptable>
 #include <QScriptValue>
+#include <QVariant>
+#include <memory>
+#include <vector>
+#include "../StatisticsLibrary/base/arealcorrelation.h"
+#include "../StatisticsLibrary/base/sampletraits.h"
+
+class RangeImage;
+class ScoreCalibration;
+class SurfaceHeatMap;
+class SurfaceSink;
 
 /**
  * Class that communicates with the statistics package to
@@ -49,12 +60,69 @@ class StatInterface: public QObject, protected QScriptable
 	Q_PROPERTY(int numRandomPairs READ getNumRandomPairs WRITE setNumRandomPairs)
 	Q_PROPERTY(float maxShiftPercentage READ getMaxShiftPercentage WRITE setMaxShiftPercentage)
 	Q_PROPERTY(int T_sample_size READ getTSampleSize WRITE setTSampleSize)
+	Q_PROPERTY(double tTolerance READ getTTolerance WRITE setTTolerance)
+	Q_PROPERTY(int numThreads READ getNumThreads WRITE setNumThreads)
+	Q_PROPERTY(uint seed READ getSeed WRITE setSeed)
+	Q_PROPERTY(int numCandidates READ getNumCandidates WRITE setNumCandidates)
+	Q_PROPERTY(bool pruneSearch READ getPruneSearch WRITE setPruneSearch)
+	Q_PROPERTY(int searchStrategy READ getSearchStrategy WRITE setSearchStrategy)
+	Q_PROPERTY(int sampleType READ getSampleType WRITE setSampleType)
+	Q_PROPERTY(float minValidFraction READ getMinValidFraction WRITE setMinValidFraction)
+	Q_PROPERTY(bool checkFlip READ getCheckFlip WRITE setCheckFlip)
+	Q_PROPERTY(int warpBand READ getWarpBand WRITE setWarpBand)
+	Q_PROPERTY(int resampling READ getResampling WRITE setResampling)
 	Q_PROPERTY(double rValue READ getRValue)
 	Q_PROPERTY(double tValue READ getTValue)
 	Q_PROPERTY(int loc1 READ getLoc1)
+	Q_PROPERTY(int candidate READ getCandidate)
 	Q_PROPERTY(int loc2 READ getLoc2)
+	Q_PROPERTY(int prunedShifts READ getPrunedShifts)
+	Q_PROPERTY(int tSamplesUsed READ getTSamplesUsed)
+	Q_PROPERTY(bool flipped READ getFlipped)
+	Q_PROPERTY(int sweepColumn READ getSweepColumn)
+	Q_PROPERTY(double likelihoodRatio READ getLikelihoodRatio)
 
   public:
+    ///How the max correlation is searched for.
+    enum SearchStrategy
+    {
+        ///Every window pair, as the stat package always has.
+        Search_Exhaustive = 0,
+        ///Coarse to fine on averaged traces (PyramidCorrelation); not exact.
+        Search_Pyramid = 1,
+        ///Dynamic time warping within warpBand (DtwCorrelation); not exact.
+        Search_Elastic = 2
+    };
+
+    ///What the traces are correlated as.
+    enum SampleType
+    {
+        ///Depths times 100, rounded to ints, as the stat package always has.
+        Sample_Int = 0,
+        ///The float depths as they are, without copies.
+        Sample_Float = 1
+    };
+
+    ///What is done with Profiles of different pixel sizes.
+    enum Resampling
+    {
+        ///Refuse to compare them, as before.
+        Resample_Off = 0,
+        ///Interpolate linearly onto the coarser grid.
+        Resample_Linear = 1,
+        ///Windowed sinc (Lanczos, 3 lobes) onto the coarser grid.
+        Resample_Sinc = 2
+    };
+
+    ///How calibrate() tabulates the T distributions.
+    enum Calibration
+    {
+        ///A histogram (ScoreCalibration::Binned).
+        Calibration_Binned = 0,
+        ///A Gaussian kernel density estimate (ScoreCalibration::Kde).
+        Calibration_Kde = 1
+    };
+
     struct StatConfig
     {
         int searchWindow;
@@ -63,6 +131,36 @@ class StatInterface: public QObject, protected QScriptable
         int numRandomPairs;
         float maxShiftPercentage;
         int tSampleSize;
+        double tTolerance;
+        int numThreads;
+        uint seed;
+        int numCandidates;
+        bool pruneSearch;
+        int searchStrategy;
+        int sampleType;
+        float minValidFraction;
+        bool checkFlip;
+        int warpBand;
+        int resampling;
+        std::tr1::shared_ptr<const ScoreCalibration> calibration;
+    };
+
+    ///The comparison with one plate column in sweepColumns().
+    struct ColumnResult
+    {
+        int column;
+        ///False if the column could not be compared (too short, or masked).
+        bool valid;
+        double rValue;
+        double tValue;
+        int loc1;
+        int loc2;
+        bool flipped;
+        ///0 unless calibrated.
+        double likelihoodRatio;
+
+        ColumnResult() : column(-1), valid(false), rValue(0), tValue(0), loc1(0), loc2(0), flipped(false),
+            likelihoodRatio(0) {}
     };
 
   public:
@@ -82,7 +180,78 @@ class StatInterface: public QObject, protected QScriptable
 	 */
     void compare(Profile *data1, Profile *data2);
 
+	///The correlation of every searchWindow pair of the Profiles, in tiles.
+	/**
+	 * See MaxCorrelationWithFlips::surface(). The traces are trimmed
+	 * and masked, and taken as ints or floats, as compare() takes them.
+	 * Does not delete either pointer. May throw std::out_of_range if
+	 * searchWindow is longer than either trace.
+	 */
+	void correlationSurface(Profile *data1, Profile *data2, SurfaceSink& sink);
+	///Writes correlationSurface() to fileName (see SurfaceFileWriter).
+	/**
+	 * halfFloat stores each r in 2 bytes instead of 4.
+	 * Returns false if the file could not be written.
+	 */
+	bool saveCorrelationSurface(Profile *data1, Profile *data2,
+		const QString& fileName, bool halfFloat = false);
+	///correlationSurface() shrunk to a width x height heat map.
+	/**
+	 * Each pixel has the largest r of the window pairs it covers,
+	 * blue for -1 through white to red for 1; grey where r is undefined.
+	 * loc1 runs down, loc2 across.
+	 */
+	QImage correlationHeatMap(Profile *data1, Profile *data2, int width, int height);
+	///The colours of correlationHeatMap() for bins already computed.
+	static QImage heatMapImage(const SurfaceHeatMap& heatMap);
+
+	///Areal comparison: the first Profile as a band against a plate region.
+	/**
+	 * data1, trimmed as compare() trims it, is extruded bandWidth
+	 * columns wide along the striations and correlated against every
+	 * placement inside columns [col0, col0 + numCols) of plate (to the
+	 * last column if numCols <= 0), with both masks as weights; see
+	 * arealCorrelation(). Returns the band's best top left corner in
+	 * plate rows and columns. sink, if given, gets r for every
+	 * placement, counted from col0.
+	 *
+	 * Uses numThreads and minValidFraction; data1 is resampled onto the
+	 * plate's rows if its pixel size differs (see setResampling()).
+	 * Does not delete either pointer. May throw std::out_of_range if the
+	 * band does not fit the region, or std::range_error if the pixel
+	 * sizes differ and resampling is Resample_Off.
+	 */
+	ArealMatch compareAreal(Profile *data1, RangeImage *plate, int bandWidth,
+		int col0 = 0, int numCols = 0, SurfaceSink *sink = 0);
+
     StatConfig getConfig();
+    ///Take every input setting from cfg.
+    void setConfig(const StatConfig& cfg);
+
+	///Report likelihoodRatio from these tables; null to stop.
+	/**
+	 * The tables are shared, not copied, by getConfig() and so by every
+	 * StatInterface set up from it.
+	 */
+	void setCalibration(const std::tr1::shared_ptr<const ScoreCalibration>& tables);
+	inline std::tr1::shared_ptr<const ScoreCalibration> getCalibration() {return calibration;}
+
+	///Compares data1 with every step-th column of plate, in parallel.
+	/**
+	 * Each column (averaged over bandHalfWidth columns either side if
+	 * that is above 0, see RangeImage::getColumnBand()) is compared as
+	 * compare() would, on numThreads threads in all, one column per
+	 * thread at a time. data1's search tables are made once and shared
+	 * by every column. The results do not depend on the thread count.
+	 *
+	 * Returns the T/r curve across the plate. The outputs are left as
+	 * for the column with the highest T, and sweepColumn says which
+	 * it was (-1 if no column could be compared). Does not delete
+	 * either pointer. data1 is resampled onto the plate's rows if its
+	 * pixel size differs; with Resample_Off, that throws std::range_error.
+	 */
+	QVector<ColumnResult> sweepColumns(Profile *data1, RangeImage *plate,
+		int step = 1, int bandHalfWidth = 0);
 
   public slots:
 	///Wraps the comparison for scripting.
@@ -92,6 +261,25 @@ class StatInterface: public QObject, protected QScriptable
 	 */
 	QScriptValue compare();
 
+	///Calibrate T against the Ts of a reference run.
+	/**
+	 * matchT and nonMatchT are the T values of comparisons known to be
+	 * matches and known not to be; from now on every comparison also
+	 * reports likelihoodRatio, the ratio of their densities at its T
+	 * (see ScoreCalibration). method is a Calibration value; numPoints
+	 * is the size of the tables. Returns false, leaving the calibration
+	 * as it was, if either list has fewer than 2 numbers.
+	 */
+	bool calibrate(const QVariantList& matchT, const QVariantList& nonMatchT,
+		int method = Calibration_Kde, int numPoints = 256);
+	///Save the calibration tables to a text file.
+	bool saveCalibration(const QString& fileName) const;
+	///Load calibration tables saved by saveCalibration().
+	bool loadCalibration(const QString& fileName);
+	///Stop reporting likelihoodRatio.
+	void clearCalibration();
+	inline bool isCalibrated() {return calibration.get() != 0;}
+
 	//Get inputs.
 	inline int getSearchWindow() {return searchWindow;}
 	inline int getValidWindow() {return validWindow;}
@@ -99,12 +287,35 @@ class StatInterface: public QObject, protected QScriptable
 	inline int getNumRandomPairs() {return numRandomPairs;}
 	inline float getMaxShiftPercentage() {return maxShiftPercentage;}
 	inline int getTSampleSize() {return T_sample_size;}
+	inline double getTTolerance() {return tTolerance;}
+	inline int getNumThreads() {return numThreads;}
+	inline uint getSeed() {return seed;}
+	inline int getNumCandidates() {return numCandidates;}
+	inline bool getPruneSearch() {return pruneSearch;}
+	inline int getSearchStrategy() {return searchStrategy;}
+	inline int getSampleType() {return sampleType;}
+	inline float getMinValidFraction() {return minValidFraction;}
+	inline bool getCheckFlip() {return checkFlip;}
+	inline int getWarpBand() {return warpBand;}
+	inline int getResampling() {return resampling;}
 
 	//Get outputs.
 	inline double getTValue() {return tValue;}
 	inline double getRValue() {return rValue;}
 	inline int getLoc1() {return loc1;}
 	inline int getLoc2() {return loc2;}
+	///Which candidate alignment was reported (0 = the max correlation).
+	inline int getCandidate() {return candidate;}
+	///Shifts the pruned search skipped entirely (0 unless pruneSearch).
+	inline int getPrunedShifts() {return prunedShifts;}
+	///T samples averaged into tValue (T_sample_size unless tTolerance is set).
+	inline int getTSamplesUsed() {return tSamplesUsed;}
+	///The second Profile matched back to front; loc2 is then counted from its end.
+	inline bool getFlipped() {return flipped;}
+	///The plate column the last sweepColumns() picked, or -1.
+	inline int getSweepColumn() {return sweepColumn;}
+	///f_match(T) / f_nonmatch(T) from the calibration, or 0 if there is none.
+	inline double getLikelihoodRatio() {return likelihoodRatio;}
     inline int getDataLen1() { return _dataLen1; }
     inline int getDataLen2() { return _dataLen2; }
 
@@ -119,8 +330,96 @@ class StatInterface: public QObject, protected QScriptable
 	void setNumRandomPairs(int num);
 	///Set the number of T value samples.
 	void setTSampleSize(int num);
+	///Stop sampling T once mean T is known to within this.
+	/**
+	 * With a tolerance above 0, T is sampled in rounds of 16 until the
+	 * 95% confidence interval of its mean is within +-tolerance, or
+	 * T_sample_size samples are taken. tSamplesUsed says how many
+	 * were. 0 (the default) always takes T_sample_size samples.
+	 */
+	void setTTolerance(double tolerance);
 	///Set the maximum shift percentage (the "leash")
 	void setMaxShiftPercentage(double num);
+	///Set the number of threads for the search and the T samples.
+	/**
+	 * 1 runs serially, 0 (the default) uses every core.
+	 * The results do not depend on this.
+	 */
+	void setNumThreads(int num);
+	///Set the seed for the random validation windows.
+	/**
+	 * Each T sample draws from its own stream derived from the seed,
+	 * so a comparison is repeatable for a given seed.
+	 */
+	void setSeed(uint num);
+	///Set how many candidate alignments to validate.
+	/**
+	 * The search keeps the num best non-overlapping peaks, T is
+	 * computed for each, and the one with the highest T is reported.
+	 * 1 (the default) validates only the max correlation.
+	 */
+	void setNumCandidates(int num);
+	///Skip the parts of the search that cannot hold the max.
+	/**
+	 * Upper bounds on the correlation are used to skip blocks of
+	 * windows; the result is the same as without. Pays off on long
+	 * search windows and smooth profiles.
+	 */
+	void setPruneSearch(bool prune);
+	///Pick the search for the max correlation (a SearchStrategy value).
+	/**
+	 * Search_Pyramid finds the candidates on traces averaged down by
+	 * up to 8x and refines them at full resolution; it is much faster
+	 * on long traces but may settle on a different window pair.
+	 * Masked samples are left out as the exhaustive search leaves
+	 * them out, minValidFraction included.
+	 * Search_Elastic lets the windows stretch against each other by
+	 * up to warpBand samples; rValue is then the warped correlation.
+	 * There, masked samples are bridged from their valid neighbours, and
+	 * windows with fewer than minValidFraction valid are skipped.
+	 */
+	void setSearchStrategy(int strategy);
+	///Pick what the traces are correlated as (a SampleType value).
+	/**
+	 * Sample_Float reads the Profile depths in place, skipping the
+	 * conversion to ints and its rounding to 0.01. pruneSearch has no
+	 * effect then.
+	 */
+	void setSampleType(int type);
+	///Honour the mask inside the Profiles, not just at their ends.
+	/**
+	 * With a fraction above 0, masked points in the middle are left
+	 * out of every correlation, and a window pair counts only if at
+	 * least this fraction of its points is unmasked in both Profiles.
+	 * 0 (the default) passes them on as depths, as before. This holds
+	 * for every search strategy and for the validation samples.
+	 */
+	void setMinValidFraction(double fraction);
+	///Also try the second Profile back to front.
+	/**
+	 * For marks of unknown orientation: the search also correlates the
+	 * first Profile with the second one reversed, in the same tables,
+	 * and a flipped match is validated against it reversed. See
+	 * flipped. Not done by Search_Pyramid or Search_Elastic.
+	 */
+	void setCheckFlip(bool check);
+	///How far Search_Elastic may warp a window, in samples (default 8).
+	/**
+	 * The Sakoe-Chiba band of DtwCorrelation: the path matching two
+	 * windows stays within this many samples of the straight one.
+	 * 0 gives the rigid correlation.
+	 */
+	void setWarpBand(int band);
+	///Pick what is done when the pixel sizes differ (a Resampling value).
+	/**
+	 * Unless Resample_Off, the finer Profile is resampled onto the
+	 * grid of the coarser one (a Profile onto the plate's rows in
+	 * sweepColumns() and compareAreal()), masked points left out, and
+	 * the windows are in samples of that grid. Profiles of the same
+	 * pixel size are compared as they are. Resample_Linear by default.
+	 * With Resample_Off, any difference throws std::range_error.
+	 */
+	void setResampling(int method);
 
 protected:
   //Input settings.
@@ -137,12 +436,46 @@ protected:
   float maxShiftPercentage;
   ///How many samples of T do you want (for an averaged T)?
   int T_sample_size;
+  ///Half width of the interval of mean T to stop at; 0 to never stop early.
+  double tTolerance;
+  ///Threads used to search for the max correlation and sample T (0 = all cores).
+  int numThreads;
+  ///Seed of the per-sample random streams.
+  uint seed;
+  ///Peaks of the search to validate.
+  int numCandidates;
+  ///Prune the max correlation search.
+  bool pruneSearch;
+  ///A SearchStrategy value.
+  int searchStrategy;
+  ///A SampleType value.
+  int sampleType;
+  ///Fraction of a window that must be unmasked; 0 to ignore the mask.
+  float minValidFraction;
+  ///Try the second Profile reversed too.
+  bool checkFlip;
+  ///Sakoe-Chiba band of Search_Elastic, in samples.
+  int warpBand;
+  ///A Resampling value.
+  int resampling;
+  ///T distributions of known matches and non-matches; null if not calibrated.
+  std::tr1::shared_ptr<const ScoreCalibration> calibration;
 
   //Outputs.
   double rValue, tValue;
   int loc1, loc2;
+  int candidate;
+  int prunedShifts;
+  int tSamplesUsed;
+  bool flipped;
+  int sweepColumn;
+  double likelihoodRatio;
   int _dataLen1, _dataLen2;
 
+  ///Buffers the search and the T samples reuse from comparison to comparison.
+  struct Scratch;
+  std::auto_ptr<Scratch> _scratch;
+
   //Private functions
   ///Convert a QVector<float> to a QVector<double>
   QVector<double> toDouble(const QVector<float> data);
@@ -155,6 +488,52 @@ protected:
    * Does not delete pointer.
    */
   QVector<float> trimProfileEnds(Profile *data);
+  ///As trimProfileEnds, but pointing into the Profile's depth instead of copying it.
+  /**
+   * Empty if every point is masked. Valid as long as the Profile is.
+   * If valid is not null, it is filled with the mask of the trimmed
+   * points and the view carries it (see TraceView::valid()).
+   */
+  TraceView<float> trimmedDepth(Profile *data, std::vector<unsigned char>* valid = 0);
+  ///The pixel size two traces are compared at: the coarser of the two.
+  /**
+   * Throws std::range_error if they differ and resampling is Resample_Off.
+   */
+  float commonPixelSize(float pixelSize1, float pixelSize2) const;
+  ///As trimmedDepth, but on a grid of pixelSize um.
+  /**
+   * If that is not the Profile's own pixel size, the trimmed depths
+   * are resampled into resampled (see setResampling()), and the view
+   * points there.
+   */
+  TraceView<float> gridDepth(Profile *data, float pixelSize,
+      std::vector<float>& resampled, std::vector<unsigned char>* valid = 0);
+  ///Samples of a window that must be valid, from minValidFraction.
+  int minValid(int window) const;
+  ///compare() on Profile depths, as floats or converted to ints (see SampleType).
+  void compareDepths(const TraceView<float>& depth1, const TraceView<float>& depth2);
+  ///Search and validate, and store the outputs; the body of compare().
+  /**
+   * If tables1 is not null, its search workspace already holds the
+   * tables of trace1, and they are used as they are (see sweepColumns()).
+   */
+  template <typename Sample>
+  void compareTraces(const TraceView<Sample>& trace1, const TraceView<Sample>& trace2,
+      const StatInterface* tables1 = 0);
+  ///sweepColumns() with data1 ready to correlate.
+  template <typename Sample>
+  QVector<ColumnResult> sweepTraces(const TraceView<Sample>& trace1, RangeImage *plate,
+      int step, int bandHalfWidth);
+  ///Average T over T_sample_size samples validating (l1, l2).
+  /**
+   * comparison keys the random streams along with the seed.
+   * samplesUsed gets how many were averaged (see tTolerance).
+   * trace2 is a MirroredTraceView to validate a flipped match.
+   * Throws std::range_error if a validation window does not fit.
+   */
+  template <typename Trace1, typename Trace2>
+  double sampleT(const Trace1& trace1, const Trace2& trace2,
+    int l1, int l2, int comparison, int& samplesUsed);
 };
 
 Q_DECLARE_METATYPE(StatInterface*)
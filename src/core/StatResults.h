@@ -8,6 +8,7 @@ struct StatResult
     int yaw;
     double t;
     double r;
+    double lr; ///< Likelihood ratio of t; 0 if the stats are not calibrated.
     bool markFailed;
     bool compareFailed;
 
@@ -16,6 +17,7 @@ struct StatResult
         yaw = iyaw;
         t = -999999999;
         r = -999999999;
+        lr = 0;
         markFailed = bMarkFailed;
         compareFailed = bCompareFailed;
     }
@@ -25,6 +27,7 @@ struct StatResult
         yaw = iyaw;
         t = dt;
         r = dr;
+        lr = 0;
         markFailed = bMarkFailed;
         compareFailed = bCompareFailed;
     }
@@ -34,6 +37,7 @@ struct StatResult
         yaw = 0;
         t = -999999999;
         r = -999999999;
+        lr = 0;
         markFailed = false;
         compareFailed = false;
     }
@@ -59,18 +59,66 @@ using std::endl;
 static QGLPixelBuffer* s_pbuffer = NULL;
 ///Global to this file.  Used to get OpenGL context
 static QGLWidget* s_widget = NULL;
+///Global to this file.  Backend for new tips.
+static VirtualTip::MarkBackend s_defaultBackend = VirtualTip::Backend_OpenGL;
 
 //=======================================================================
 //=======================================================================
 VirtualTip::VirtualTip(RangeImage *newTip, QGLContext* newContext, IProgress *prog, QObject* parent):
     QObject(parent),
     _progress(prog)
+{
+    init(newTip, newContext, s_defaultBackend);
+}
+
+//=======================================================================
+//=======================================================================
+VirtualTip::VirtualTip(RangeImage *newTip, MarkBackend backend, IProgress *prog, QObject* parent):
+    QObject(parent),
+    _progress(prog)
+{
+    init(newTip, NULL, backend);
+}
+
+//=======================================================================
+//=======================================================================
+void VirtualTip::init(RangeImage *newTip, QGLContext* newContext, MarkBackend backend)
 {
     _tip = newTip;
     _depth = _tip->getDepth(); //implicitly shared
     _mask = _tip->getMask(); //implicitly shared
 	computeBoundingBox();
 
+    //OpenGL resources are made by initOpenGL().
+    _context = NULL;
+    _prog = NULL;
+    _sbuffer = NULL;
+    _fboID = 0;
+    _rboID = 0;
+    _backend = backend;
+    _rasterizer = NULL;
+
+	//put camera a good way back
+	//for orthographic projection.
+    _camera.translate(0, 0, CAMERAZ);
+
+	//init resolution with maximum pixel spacing.
+    float pixX = _tip->getPixelSizeX();
+    float pixY = _tip->getPixelSizeY();
+	if (pixX > pixY)
+        _resDefault = pixX;
+	else
+        _resDefault = pixY;
+    _resolution = _resDefault;
+
+    if (_backend == Backend_OpenGL)
+        initOpenGL(newContext);
+}
+
+//=======================================================================
+//=======================================================================
+void VirtualTip::initOpenGL(QGLContext* newContext)
+{
 	//Now, we can get a context.
 	if (newContext != NULL)
         _context = newContext;
@@ -95,19 +143,6 @@ VirtualTip::VirtualTip(RangeImage *newTip, QGLContext* newContext, IProgress *pr
     ret = _prog->addShaderFromSourceFile(QGLShader::Fragment, ":/glsl/mark.frag");
     ret = _prog->link();
 
-	//put camera a good way back
-	//for orthographic projection.
-    _camera.translate(0, 0, CAMERAZ);
-
-	//init resolution with maximum pixel spacing.
-    float pixX = _tip->getPixelSizeX();
-    float pixY = _tip->getPixelSizeY();
-	if (pixX > pixY)
-        _resDefault = pixX;
-	else
-        _resDefault = pixY;
-    _resolution = _resDefault;
-
 	//Create the stream buffer.
     _sbuffer = new StreamBuffer(3*NTRIS);
     LogTrace("VirtualTip - stream buffer size: %.2f mb", StreamBuffer::toMB(_sbuffer->getCapacity()));
@@ -129,6 +164,7 @@ VirtualTip::~VirtualTip()
 	//context belongs to someone else
 	//prog belongs to QT.
     delete _sbuffer;
+    delete _rasterizer;
 	//pbuffer and widget cannot be deleted here
 	//they need to persist to other instances.
 }
@@ -178,8 +214,7 @@ void VirtualTip::computeBoundingBox()
 
 //=======================================================================
 //=======================================================================
-void VirtualTip::computeProjection(const QMatrix4x4& transform, int* rboHeight,
-	int* partitions, float* yMin, float* yDelta)
+void VirtualTip::computeYRange(const QMatrix4x4& transform, float* yMin, float* yMax)
 {
 	//Determine orientation of tip.
 	
@@ -218,6 +253,17 @@ void VirtualTip::computeProjection(const QMatrix4x4& transform, int* rboHeight,
 		if (maxY < boundingBox[i].y())
 			maxY = boundingBox[i].y();
 	}
+	*yMin = minY;
+	*yMax = maxY;
+}
+
+//=======================================================================
+//=======================================================================
+void VirtualTip::computeProjection(const QMatrix4x4& transform, int* rboHeight,
+	int* partitions, float* yMin, float* yDelta)
+{
+	float minY, maxY;
+	computeYRange(transform, &minY, &maxY);
 	*yMin = minY; //Store ymin.
 
 	//Auto calculate number of partitions.
@@ -487,13 +533,8 @@ void VirtualTip::destroyOpenGLContext()
 
 //=======================================================================
 //=======================================================================
-Profile* VirtualTip::mark(float xAxis, float yAxis, float zAxis)
+QMatrix4x4 VirtualTip::makeTransform(float xAxis, float yAxis, float zAxis)
 {
-    //Declare/initialize some things.
-    int rboHeight; //Number of pixels in 1D "renderbuffer."
-    int partitions; //Number of scene partitions.
-    float yMin; //Bottom edge of the overall scene.
-    float yDelta; //Length of a partition in um.
     //Create the transform matrix.
     QMatrix4x4 transform;
     //Transforms in PYR order.
@@ -502,6 +543,29 @@ Profile* VirtualTip::mark(float xAxis, float yAxis, float zAxis)
     transform.rotate(zAxis, QVector3D(0, 0, 1)); //z-roll
     transform.rotate(yAxis, QVector3D(0, 1, 0)); //y-yaw
     transform.rotate(xAxis, QVector3D(1, 0, 0)); //x-pitch
+    return transform;
+}
+
+//=======================================================================
+//=======================================================================
+Profile* VirtualTip::mark(float xAxis, float yAxis, float zAxis)
+{
+    QMatrix4x4 transform = makeTransform(xAxis, yAxis, zAxis);
+    if (_backend == Backend_Cpu)
+        return markCpu(transform);
+
+    return markOpenGL(transform);
+}
+
+//=======================================================================
+//=======================================================================
+Profile* VirtualTip::markOpenGL(const QMatrix4x4& transform)
+{
+    //Declare/initialize some things.
+    int rboHeight; //Number of pixels in 1D "renderbuffer."
+    int partitions; //Number of scene partitions.
+    float yMin; //Bottom edge of the overall scene.
+    float yDelta; //Length of a partition in um.
 
     //Activate the context.
     //LogTrace("VirtualTip::mark() activating opengl context in thead: %d", QThread::currentThreadId());
@@ -588,16 +652,123 @@ Profile* VirtualTip::mark(float xAxis, float yAxis, float zAxis)
         topClip += yDelta;
     }
 
+    float maskValue;
+    glGetFloatv(GL_DEPTH_CLEAR_VALUE, &maskValue);
+
+    //Clean up.
+    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+
     if (!progStep()) // 2
     {
-        //Clean up.
-        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
         return NULL;
     }
 
+    return finishMark(rawMarkData, maskValue);
+}
+
+//=======================================================================
+//=======================================================================
+MarkRasterizer::Projection VirtualTip::computeCpuProjection(const QMatrix4x4& transform)
+{
+    float yMin, yMax;
+    computeYRange(transform, &yMin, &yMax);
+
+    //Same sizing as computeProjection() with a single partition.
+    MarkRasterizer::Projection proj;
+    proj.yMin = yMin;
+    proj.resolution = _resolution;
+    proj.bins = (yMax - yMin)/_resolution + 1;
+    proj.nearClip = NEARCLIP;
+    proj.farClip = FARCLIP;
+    proj.cameraZ = CAMERAZ;
+    return proj;
+}
+
+//=======================================================================
+//=======================================================================
+MarkRasterizer* VirtualTip::getRasterizer()
+{
+    if (!_rasterizer)
+    {
+        _rasterizer = new MarkRasterizer(_tip->getWidth(), _tip->getHeight(),
+            _tip->getPixelSizeX(), _tip->getPixelSizeY(), _depth, _mask);
+    }
+    return _rasterizer;
+}
+
+//=======================================================================
+//=======================================================================
+Profile* VirtualTip::markCpu(const QMatrix4x4& transform)
+{
+    MarkRasterizer* rasterizer = getRasterizer();
+
+    MarkRasterizer::Projection proj = computeCpuProjection(transform);
+    if (!progStep()) // 1
+    {
+        return NULL;
+    }
+
+    //The camera and squish only move z and drop x,
+    //so the rasterizer just needs the object transform.
+    QMatrix4x4 model = transform * _tip->getCoordinateSystemMatrix();
+    QVector<float> rawMarkData = rasterizer->render(model, proj);
+
+    if (!progStep()) // 2
+    {
+        return NULL;
+    }
+
+    return finishMark(rawMarkData, MarkRasterizer::clearValue());
+}
+
+//=======================================================================
+//=======================================================================
+QList<Profile*> VirtualTip::markBatch(const QVector<float>& yAxis, float xAxis, float zAxis)
+{
+    QList<Profile*> ret;
+    int numMarks = yAxis.size();
+
+    if (_backend != Backend_Cpu)
+    {
+        for (int i = 0; i < numMarks; ++i)
+        {
+            ret.push_back(progCancel() ? NULL : mark(xAxis, yAxis[i], zAxis));
+        }
+        return ret;
+    }
+
+    //Everything angle dependent is cheap: a transform and a projection.
+    MarkRasterizer* rasterizer = getRasterizer();
+    QVector<QMatrix4x4> models(numMarks);
+    QVector<MarkRasterizer::Projection> projs(numMarks);
+    for (int i = 0; i < numMarks; ++i)
+    {
+        QMatrix4x4 transform = makeTransform(xAxis, yAxis[i], zAxis);
+        projs[i] = computeCpuProjection(transform);
+        models[i] = transform * _tip->getCoordinateSystemMatrix();
+    }
+
+    QVector<QVector<float> > rawMarks = rasterizer->renderBatch(models, projs);
+
+    //Cleaning is per mark and cheap; do it here so the
+    //Profiles belong to this thread.
+    for (int i = 0; i < numMarks; ++i)
+    {
+        Profile* profile = NULL;
+        if (progStep() && progStep()) // 1, 2
+        {
+            profile = finishMark(rawMarks[i], MarkRasterizer::clearValue());
+        }
+        ret.push_back(profile);
+    }
+    return ret;
+}
+
+//=======================================================================
+//=======================================================================
+Profile* VirtualTip::finishMark(const QVector<float>& rawMarkData, float maskValue)
+{
     //Remove the masked data from the ends.
-    float maskValue;
-    glGetFloatv(GL_DEPTH_CLEAR_VALUE, &maskValue);
     QVector<float> markData = CleanVirtualMark::unmask(rawMarkData, maskValue);
 
     //Convert data to um.
@@ -619,9 +790,7 @@ Profile* VirtualTip::mark(float xAxis, float yAxis, float zAxis)
 
     if (!progStep()) // 3
     {
-        //Clean up.
-        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-        return NULL; // 3
+        return NULL;
     }
 
     //Find the mark edges for trimming.
@@ -635,11 +804,9 @@ Profile* VirtualTip::mark(float xAxis, float yAxis, float zAxis)
         profileMask.clearBit(i);
     Profile* ret = new Profile(_resolution, markData, profileMask);
 
-    //Clean up.
-    glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-
     if (!progStep()) // 4
     {
+        delete ret;
         return NULL;
     }
     return ret;
@@ -779,7 +946,7 @@ QScriptValue VirtualTip::scriptableCreate(QScriptContext* scriptContext, QScript
 	if (argc < 1)
 	{
 		qDebug() << "Incorrect number of arguments to create.";
-		qDebug() << "Correct number of arguments is 1.";
+		qDebug() << "Correct number of arguments is 1 (or 2 with a backend).";
 		qDebug() << "Returning a null object.";
 		return QScriptValue();
 	}
@@ -788,8 +955,28 @@ QScriptValue VirtualTip::scriptableCreate(QScriptContext* scriptContext, QScript
 
 	RangeImage* argument0 = qscriptvalue_cast<RangeImage*>(
 		scriptContext->argument(0) );
+
+    //Optional second argument picks the backend, so scripts
+    //can run without ever creating an OpenGL context.
+    MarkBackend backend = s_defaultBackend;
+    if (argc > 1)
+    {
+        const int requested = scriptContext->argument(1).toInt32();
+        if (requested == Backend_Cpu)
+            backend = Backend_Cpu;
+        else if (requested == Backend_OpenGL)
+            backend = Backend_OpenGL;
+        else
+        {
+            qDebug() << "Unknown backend" << requested << "given to create.";
+            qDebug() << "Use" << Backend_OpenGL << "(OpenGL) or" << Backend_Cpu << "(CPU).";
+            qDebug() << "Returning a null object.";
+            return QScriptValue();
+        }
+    }
+
 	return engine->newQObject(
-		new VirtualTip(argument0), 
+		new VirtualTip(argument0, backend), 
 		QScriptEngine::AutoOwnership, 
 		QScriptEngine::AutoCreateDynamicProperties);
 }
@@ -814,6 +1001,35 @@ bool VirtualTip::setResolution(float newRes)
 	else return true;
 }
 
+//=======================================================================
+//=======================================================================
+void VirtualTip::setBackend(int backend)
+{
+    if (backend == Backend_Cpu)
+    {
+        _backend = Backend_Cpu;
+        return;
+    }
+
+    if (!_context)
+        initOpenGL(NULL);
+    _backend = Backend_OpenGL;
+}
+
+//=======================================================================
+//=======================================================================
+void VirtualTip::setDefaultBackend(MarkBackend backend)
+{
+    s_defaultBackend = backend;
+}
+
+//=======================================================================
+//=======================================================================
+VirtualTip::MarkBackend VirtualTip::getDefaultBackend()
+{
+    return s_defaultBackend;
+}
+
 //=======================================================================
 //=======================================================================
 bool VirtualTip::progStep(const char *msg)
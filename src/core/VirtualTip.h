@@ -38,6 +38,7 @@
 #include <QScriptContext>
 #include <QScriptEngine>
 #include "IProgress.h"
+#include "MarkRasterizer.h"
 
 /**
  * Class for making a virtual mark with a RangeImage object.
@@ -53,6 +54,10 @@
  * Note: Call destroyOpenGLContext() at application termination to ensure
  * proper final destruction of all Virtual Tip objects.
  *
+ * Note: Marks can also be made without OpenGL by a MarkRasterizer
+ * (Backend_Cpu). This is meant for machines without a GPU or display.
+ * No OpenGL context is created until Backend_OpenGL is used.
+ *
  * @author Laura Ekstrand
  */
 
@@ -61,6 +66,15 @@ class VirtualTip: public QObject
 	Q_OBJECT
 	Q_PROPERTY(float resolution READ getResolution WRITE setResolution)
 	Q_PROPERTY(float resDefault READ getDefaultResolution)
+	Q_PROPERTY(int backend READ getBackend WRITE setBackend)
+
+public:
+    ///Engines that can make the mark.
+    enum MarkBackend
+    {
+        Backend_OpenGL = 0,
+        Backend_Cpu = 1
+    };
 
 public:
 	///Create a virtual tip from a RangeImage; won't delete the RangeImage*.
@@ -75,11 +89,21 @@ public:
 	 * widget if you would like. Of course, you own the passed-in newContext.
 	 */
     VirtualTip(RangeImage* newTip, QGLContext* newContext=NULL, IProgress *prog=NULL, QObject* parent=0);
+    ///Create a virtual tip that uses the given backend.
+    /**
+     * With Backend_Cpu no OpenGL context is touched.
+     */
+    VirtualTip(RangeImage* newTip, MarkBackend backend, IProgress *prog=NULL, QObject* parent=0);
 	virtual ~VirtualTip();
 
 	///Call this at program termination to deallocate persisting context.
 	static void destroyOpenGLContext();
 
+    ///Backend used by tips made with the first constructor. Default is Backend_OpenGL;
+    ///mantis sets Backend_Cpu for --cpu-marks or the markopt/cpuMarks setting.
+    static void setDefaultBackend(MarkBackend backend);
+    static MarkBackend getDefaultBackend();
+
     int getProgSteps() const { return 4; }
 
 public slots:
@@ -95,6 +119,18 @@ public slots:
 	 */
     Profile* mark(float xAxis, float yAxis, float zAxis);
 
+	///Make one mark per y (yaw) angle, sharing the tip preprocessing.
+	/**
+	 * Equivalent to calling mark(xAxis, yAxis[i], zAxis) for each i.
+	 * With Backend_Cpu the tip mesh is built once and the angles are
+	 * spread across cores. Backend_OpenGL falls back to a mark()
+	 * per angle since there is only one context.
+	 *
+	 * The returned list has one entry per angle; an entry is NULL
+	 * if that mark failed or was cancelled. You own the Profiles.
+	 */
+	QList<Profile*> markBatch(const QVector<float>& yAxis, float xAxis = 0, float zAxis = 0);
+
 	///Wraps creation of Virtual Tip so you get an OpenGL context while scripting.
 	static QScriptValue scriptableCreate(QScriptContext* scriptContext, 
 		QScriptEngine* engine);
@@ -112,6 +148,14 @@ public slots:
 	///Return actual resolution of the data.
     inline float getResolution() {return _resolution;}
 
+    ///Pick the engine used by mark() (a MarkBackend value).
+    /**
+     * Switching to Backend_OpenGL creates the OpenGL resources
+     * if this tip was made without them.
+     */
+    void setBackend(int backend);
+    inline int getBackend() {return _backend;}
+
 protected:
     //Protected member functions
     ///Get a persisting OpenGL context for constructing your VirtualTip.
@@ -123,6 +167,14 @@ protected:
      * that the internal pbuffer or widget is destroyed properly.
      */
     static QGLContext* getOpenGLContext();
+    ///Shared constructor code.
+    void init(RangeImage* newTip, QGLContext* newContext, MarkBackend backend);
+    ///Create the shader, stream buffer and framebuffer; needs a context.
+    void initOpenGL(QGLContext* newContext);
+    ///Build the PYR transform for mark().
+    static QMatrix4x4 makeTransform(float xAxis, float yAxis, float zAxis);
+    ///Find the y extent of the transformed tip bounding box.
+    void computeYRange(const QMatrix4x4& transform, float* yMin, float* yMax);
     ///Compute the bounding box.
     void computeBoundingBox();
     ///Determine the correct projection matrix parameters.
@@ -140,6 +192,20 @@ protected:
         float y0, float z0, float x1, float y1, float z1);
     ///Draws the tip.
     void draw();
+    ///mark() using OpenGL.
+    Profile* markOpenGL(const QMatrix4x4& transform);
+    ///mark() using the MarkRasterizer.
+    Profile* markCpu(const QMatrix4x4& transform);
+    ///Build the MarkRasterizer if needed.
+    MarkRasterizer* getRasterizer();
+    ///Projection the MarkRasterizer needs to reproduce the OpenGL mark.
+    MarkRasterizer::Projection computeCpuProjection(const QMatrix4x4& transform);
+    ///Turn a raw depth buffer into the final Profile.
+    /**
+     * Shared by both backends: unmask, convert to um, flip
+     * and trim the mark edges. Returns NULL if cancelled.
+     */
+    Profile* finishMark(const QVector<float>& rawMarkData, float maskValue);
 
     bool progStep(const char *msg=NULL);
     bool progCancel();
@@ -170,6 +236,10 @@ protected:
   ///"Renderbuffer" object id. (Actually, it's now a texture.)
   GLuint _rboID;
 
+  ///Engine used by mark().
+  MarkBackend _backend;
+  ///Software marking engine. Built on first use.
+  MarkRasterizer* _rasterizer;
 };
 
 Q_DECLARE_METATYPE(VirtualTip*)
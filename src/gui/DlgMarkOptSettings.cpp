@@ -2,6 +2,7 @@
 #include "ui_DlgMarkOptSettings.h"
 #include "SettingsStore.h"
 #include "App.h"
+#include "../core/VirtualTip.h"
 
 DlgMarkOptSettings::DlgMarkOptSettings(QWidget *parent) :
     QDialog(parent),
@@ -20,6 +21,8 @@ DlgMarkOptSettings::DlgMarkOptSettings(QWidget *parent) :
     ui->spinBoxYawInc->setMinimum(1);
     ui->spinBoxYawInc->setMaximum(30);
     ui->spinBoxYawInc->setValue(App::settings()->mark().yawInc);
+    ui->checkBoxCpuMarks->setChecked(
+        VirtualTip::getDefaultBackend() == VirtualTip::Backend_Cpu);
 
     connect(ui->buttonBox, SIGNAL(accepted()), this, SLOT(onOk()));
 }
@@ -34,10 +37,13 @@ void DlgMarkOptSettings::onOk()
     int yawStart = ui->spinBoxYawStart->value();
     int yawEnd = ui->spinBoxYawEnd->value();
     int yawInc = ui->spinBoxYawInc->value();
+    bool cpuMarks = ui->checkBoxCpuMarks->isChecked();
 
     App::settings()->mark().yawMin = yawStart;
     App::settings()->mark().yawMax = yawEnd;
     App::settings()->mark().yawInc = yawInc;
+    App::settings()->mark().cpuMarks = cpuMarks;
+    VirtualTip::setDefaultBackend(cpuMarks ? VirtualTip::Backend_Cpu : VirtualTip::Backend_OpenGL);
     if (yawStart > yawEnd)
     {
         App::settings()->mark().yawMin = yawEnd;
@@ -48,6 +48,9 @@ RangeImageRenderer::RangeImageRenderer(PRangeImage newModel,
     //_depth
     setModel(newModel);
 
+    _plateBandHalfWidth = 0;
+    _plateBandReducer = RangeImage::Reducer_Mean;
+
 	//Default drawing mode.
     _currentShaderProgram = 0;
     _drawCS = true;
@@ -1419,6 +1422,14 @@ int RangeImageRenderer::getProfilePlateCol()
     return col;
 }
 
+//=======================================================================
+//=======================================================================
+void RangeImageRenderer::setPlateBand(int halfWidth, int reducer)
+{
+    _plateBandHalfWidth = qMax(halfWidth, 0);
+    _plateBandReducer = reducer;
+}
+
 //=======================================================================
 //=======================================================================
 Profile* RangeImageRenderer::getProfile()
@@ -1429,7 +1440,9 @@ Profile* RangeImageRenderer::getProfile()
     }
 
     int col = getProfilePlateCol();
-    Profile *profile = _model->getColumn(col);
+    Profile *profile = (_plateBandHalfWidth > 0)
+        ? _model->getColumnBand(col, _plateBandHalfWidth, _plateBandReducer)
+        : _model->getColumn(col);
     _tipData.draw = false;
 
     return profile;
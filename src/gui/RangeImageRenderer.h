@@ -210,6 +210,16 @@ public:
     virtual void setSelectionMode(Selection::drawModes mode) { _selection->setDrawMode(mode); }
     virtual void setSelectionMultiplier(int mult) { _selection->setMultiplier(mult); }
 
+    ///Average the plate profile over the columns around the selection.
+    /**
+     * halfWidth columns either side of it are reduced with reducer,
+     * a RangeImage::EColumnReducer value (see RangeImage::getColumnBand()).
+     * 0 (the default) takes the one column.
+     */
+    void setPlateBand(int halfWidth, int reducer = RangeImage::Reducer_Mean);
+    int getPlateBandHalfWidth() { return _plateBandHalfWidth; }
+    int getPlateBandReducer() { return _plateBandReducer; }
+
     Profile* getProfile();
     PProfile getProfilePlate();
     PProfile getProfileTip(float rotx, float roty, float rotz);
@@ -313,6 +323,11 @@ protected:
   ///Scaled QImage for texture shader.
   QImage _scaledTexture;
 
+  ///Columns either side of the selection the plate profile averages.
+  int _plateBandHalfWidth;
+  ///A RangeImage::EColumnReducer value.
+  int _plateBandReducer;
+
   //Drawing buffer variables.
   ///Matrix defining model transformations.
   QMatrix4x4 _transform;
@@ -144,6 +144,7 @@ void SettingsStore::saveMarkOpt(const MarkOptSettings &mark)
     settings.setValue("yawMin", mark.yawMin);
     settings.setValue("yawMax", mark.yawMax);
     settings.setValue("yawInc", mark.yawInc);
+    settings.setValue("cpuMarks", mark.cpuMarks);
     settings.endGroup();
 }
 
@@ -156,6 +157,7 @@ void SettingsStore::loadMarkOpt(MarkOptSettings *mark)
     mark->yawMin = settings.value("yawMin", mark->yawMin).toInt();
     mark->yawMax = settings.value("yawMax", mark->yawMax).toInt();
     mark->yawInc = settings.value("yawInc", mark->yawInc).toInt();
+    mark->cpuMarks = settings.value("cpuMarks", mark->cpuMarks).toBool();
     settings.endGroup();
 }
 
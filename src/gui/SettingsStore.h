@@ -46,12 +46,14 @@ public:
         int yawMin;
         int yawMax;
         int yawInc;
+        bool cpuMarks; ///< Make virtual marks without OpenGL (VirtualTip::Backend_Cpu).
 
         MarkOptSettings(int iYawMin=25, int iYawMax=85, int iYawInc=5)
         {
             yawMin = iYawMin;
             yawMax = iYawMax;
             yawInc = iYawInc;
+            cpuMarks = false;
         }
     };
 
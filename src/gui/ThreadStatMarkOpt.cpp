@@ -16,12 +16,7 @@ ThreadStatMarkOpt::ThreadStatMarkOpt(const StatInterface::StatConfig &cfg, PProf
     _ts.tipImg = tipImg;
 
     _stat.reset(new StatInterface());
-    _stat->setMaxShiftPercentage(cfg.maxShiftPercentage);
-    _stat->setNumRandomPairs(cfg.numRandomPairs);
-    _stat->setNumRigidPairs(cfg.numRigidPairs);
-    _stat->setSearchWindow(cfg.searchWindow);
-    _stat->setValidWindow(cfg.validWindow);
-    _stat->setTSampleSize(cfg.tSampleSize);
+    _stat->setConfig(cfg);
 
     _results.reset(new StatResults());
 }
@@ -46,17 +41,29 @@ bool ThreadStatMarkOpt::onPreRunLoop()
         emit signalInitFailed(QString("Tip Image not valid"));
     }
 
-    _context = getContext();
-    if (!_context)
-    {
-        emit signalInitFailed(QString("Failed to create an opengl context"));
-        return false;
-    }
-
     _results->_resultMaxT.clear();
     _results->_results.clear();
+    _batchMarks.clear();
     _profileTipMax.reset();
-    _ts.vt.reset(new VirtualTip(_ts.tipImg.data(), _context, this));
+
+    //Set by "Make marks on the CPU" (DlgMarkOptSettings) or --cpu-marks.
+    if (VirtualTip::getDefaultBackend() == VirtualTip::Backend_Cpu)
+    {
+        //No opengl context needed.
+        _context = NULL;
+        _ts.vt.reset(new VirtualTip(_ts.tipImg.data(), VirtualTip::Backend_Cpu, this));
+    }
+    else
+    {
+        _context = getContext();
+        if (!_context)
+        {
+            emit signalInitFailed(QString("Failed to create an opengl context"));
+            return false;
+        }
+
+        _ts.vt.reset(new VirtualTip(_ts.tipImg.data(), _context, this));
+    }
 
     int statSteps = 1;
     int profiles = (int)((float)(_ts.yawMax - _ts.yawMin) / (float)_ts.yawInc) + 1;
@@ -88,17 +95,20 @@ void ThreadStatMarkOpt::doWork()
     progMsg(msg.toStdString().c_str());
 
 
-    Profile *profile = _ts.vt->mark(0, _ts.yawCur, 0);
-    if (profile)
+    PProfile proTip = markCurrent();
+    if (proTip)
     {
         progMsg("Calculating stats...");
-        PProfile proTip(profile);
         if (statCompare(proTip, _profilePlate))
         {
             StatResult result(_ts.yawCur, _stat->getTValue(), _stat->getRValue());
+            result.lr = _stat->getLikelihoodRatio();
             _results->_results.push_back(result);
 
-            LogInfo("Stats for angle: %d, t: %f, r: %f", result.yaw, result.t, result.r);
+            if (_stat->isCalibrated())
+                LogInfo("Stats for angle: %d, t: %f, r: %f, lr: %g", result.yaw, result.t, result.r, result.lr);
+            else
+                LogInfo("Stats for angle: %d, t: %f, r: %f", result.yaw, result.t, result.r);
             if (_profileTipMax == NULL || result.t > _results->_resultMaxT.t)
             {
                 _profileTipMax = proTip;
@@ -123,7 +133,7 @@ void ThreadStatMarkOpt::doWork()
     {
         if (_profileTipMax)
         {
-            LogInfo("Stat Results For Max T: angle: %d, t: %.2f, r: %.2f", _results->_resultMaxT.yaw, _results->_resultMaxT.t, _results->_resultMaxT.r);
+            LogInfo("Stat Results For Max T: angle: %d, t: %.2f, r: %.2f, lr: %g", _results->_resultMaxT.yaw, _results->_resultMaxT.t, _results->_resultMaxT.r, _results->_resultMaxT.lr);
         }
         else
         {
@@ -138,6 +148,36 @@ void ThreadStatMarkOpt::doWork()
     }
 }
 
+//=======================================================================
+//=======================================================================
+PProfile ThreadStatMarkOpt::markCurrent()
+{
+    if (_ts.vt->getBackend() != VirtualTip::Backend_Cpu)
+    {
+        return PProfile(_ts.vt->mark(0, _ts.yawCur, 0));
+    }
+
+    // cpu marks are made all at once; the tip mesh is shared by every yaw
+    if (_batchMarks.isEmpty())
+    {
+        QVector<float> yaws;
+        for (int yaw = _ts.yawMin; yaw <= _ts.yawMax; yaw += _ts.yawInc)
+        {
+            yaws.push_back(yaw);
+        }
+
+        QList<Profile*> marks = _ts.vt->markBatch(yaws);
+        for (int i = 0; i < marks.size(); ++i)
+        {
+            _batchMarks.push_back(PProfile(marks[i]));
+        }
+    }
+
+    int idx = (_ts.yawCur - _ts.yawMin) / _ts.yawInc;
+    if (idx < 0 || idx >= _batchMarks.size()) return PProfile();
+    return _batchMarks[idx];
+}
+
 //=======================================================================
 //=======================================================================
 bool ThreadStatMarkOpt::statCompare(PProfile pro1, PProfile pro2)
@@ -62,6 +62,8 @@ protected:
     QGLContext* getContext();
 
     bool statCompare(PProfile pro1, PProfile pro2);
+    ///Mark the tip at the current yaw (from the batch if there is one).
+    PProfile markCurrent();
 
 
 
@@ -71,6 +73,8 @@ protected:
     TipSettings _ts;
     PStatInterface _stat;
     PStatResults _results;
+    ///Marks for every yaw, made up front when the tip can mark in batches.
+    QList<PProfile> _batchMarks;
 
     QGLContext *_context;
     std::tr1::shared_ptr<QGLPixelBuffer> _pbuffer; // Used to get OpenGL context
@@ -110,3 +110,28 @@ heightMap::setProfileCurve(const QVector<QPointF>& profilePts, double zMin, doub
 
 	replot();
 }
+
+void
+heightMap::setSurface(const QVector<double>& values, int numColumns)
+{
+	//Blue for -1, white for 0, red for 1.
+	QwtLinearColorMap* map = new QwtLinearColorMap(Qt::blue, Qt::red);
+	map->addColorStop(0.5, Qt::white);
+	profileCurve->setColorMap(map);
+
+	//Rows of the surface are loc1 and go down the plot.
+	heightData->setValueMatrix(values, numColumns);
+	const int numRows = (numColumns > 0) ? values.size() / numColumns : 0;
+	heightData->setInterval(Qt::XAxis, QwtInterval(0, numColumns));
+	heightData->setInterval(Qt::YAxis, QwtInterval(0, numRows));
+	zInterval.setMinValue(-1);
+	zInterval.setMaxValue(1);
+	heightData->setInterval(Qt::ZAxis, zInterval);
+
+	map = new QwtLinearColorMap(Qt::blue, Qt::red);
+	map->addColorStop(0.5, Qt::white);
+	rightAxis->setColorMap(zInterval, map);
+	setAxisScale(QwtPlot::yRight, zInterval.minValue(), zInterval.maxValue());
+
+	replot();
+}
@@ -59,6 +59,12 @@ public:
 
 public slots:
 	void setProfileCurve(const QVector<QPointF>& profilePts, double zMin, double zMax);
+	///Show a correlation surface heat map (r in [-1, 1]), row-major.
+	/**
+	 * For SurfaceHeatMap::bins() or a correlation surface read back
+	 * from a file; NaN bins are left blank.
+	 */
+	void setSurface(const QVector<double>& values, int numColumns);
 };
 
 #endif // HEIGHTMAP_H
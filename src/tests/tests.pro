@@ -0,0 +1,45 @@
+# 
+#  Copyright 2008-2014 Iowa State University
+# 
+#  This file is part of Mantis.
+#  
+#  Mantis is free software: you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation, either version 3 of the License, or
+#  (at your option) any later version.
+#  
+#  Mantis is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU General Public License for more details.
+#  
+#  You should have received a copy of the GNU General Public License
+#  along with Mantis.  If not, see <http://www.gnu.org/licenses/>.
+# 
+
+
+# Unit tests (QTestLib). Build with qmake and run ./mantistests.
+
+TEMPLATE = app
+TARGET = mantistests
+QT += script \
+	  testlib
+CONFIG += console
+CONFIG += c++11
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../core
+
+HEADERS += \
+	../core/RangeImage.h \
+	../core/al3d_file.h \
+	../core/Profile.h \
+	../core/logger.h \
+	../core/UtlQt3d.h
+SOURCES += \
+	tst_RangeImage.cpp \
+	../core/RangeImage.cpp \
+	../core/al3d_file.cpp \
+	../core/Profile.cpp \
+	../core/logger.cpp \
+	../core/UtlQt3d.cpp
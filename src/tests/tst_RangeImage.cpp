@@ -0,0 +1,177 @@
+/*
+ * Copyright 2008-2014 Iowa State University
+ *
+ * This file is part of Mantis.
+ * 
+ * This computer software was prepared by The Ames 
+ * Laboratory, hereinafter the Contractor, under 
+ * Interagency Agreement number 2009-DN-R-119 between 
+ * the National Institute of Justice (NIJ) and the 
+ * Department of Energy (DOE). All rights in the computer 
+ * software are reserved by NIJ/DOE on behalf of the 
+ * United States Government and the Contractor as provided 
+ * in its Contract, DE-AC02-07CH11358.  You are authorized 
+ * to use this computer software for Governmental purposes
+ * but it is not to be released or distributed to the public.  
+ * NEITHER THE GOVERNMENT NOR THE CONTRACTOR MAKES ANY WARRANTY, 
+ * EXPRESS OR IMPLIED, OR ASSUMES ANY LIABILITY FOR THE USE 
+ * OF THIS SOFTWARE.  
+ *
+ * This notice including this sentence 
+ * must appear on any copies of this computer software.
+ *
+ */
+
+#include <QtTest>
+#include "RangeImage.h"
+
+class TestRangeImage: public QObject
+{
+	Q_OBJECT
+
+  private:
+	///A small plate with a few masked pixels and a row masked all across.
+	RangeImage* maskedPlate();
+
+  private slots:
+	void columnBandOfZeroWidthIsColumn();
+	void maskedBandRowKeepsCenterDepth();
+	void columnBandMedian();
+	void columnBandTrimmedMean();
+	void wideColumnBandCrossesMaskWords();
+};
+
+RangeImage* TestRangeImage::maskedPlate()
+{
+	const int w = 5, h = 6;
+	QVector<float> depth;
+	QBitArray mask (w*h, true);
+	for (int i = 0; i < h; ++i)
+	{
+		for (int j = 0; j < w; ++j)
+			depth.push_back(10.0f*i + j + 0.5f);
+	}
+	mask.clearBit(w*1 + 2);
+	mask.clearBit(w*4 + 0);
+	mask.clearBit(w*4 + 4);
+	for (int j = 0; j < w; ++j)
+		mask.clearBit(w*3 + j);
+
+	QMatrix4x4 csys;
+	return new RangeImage(w, h, 1.5f, 2.0f, depth, QImage(w, h, QImage::Format_RGB32), mask, csys);
+}
+
+void TestRangeImage::columnBandOfZeroWidthIsColumn()
+{
+	QScopedPointer<RangeImage> plate (maskedPlate());
+	for (int reducer = RangeImage::Reducer_Mean; reducer <= RangeImage::Reducer_TrimmedMean; ++reducer)
+	{
+		for (int c = 0; c < plate->getWidth(); ++c)
+		{
+			QScopedPointer<Profile> column (plate->getColumn(c));
+			QScopedPointer<Profile> band (plate->getColumnBand(c, 0, reducer));
+			QVERIFY(!band.isNull());
+			QCOMPARE(band->getPixelSize(), column->getPixelSize());
+			QCOMPARE(band->getMask(), column->getMask());
+			QCOMPARE(band->getDepth(), column->getDepth());
+		}
+	}
+}
+
+void TestRangeImage::maskedBandRowKeepsCenterDepth()
+{
+	QScopedPointer<RangeImage> plate (maskedPlate());
+	QScopedPointer<Profile> band (plate->getColumnBand(2, 1));
+	QVERIFY(!band.isNull());
+	QVERIFY(!band->getMask().testBit(3));
+	QCOMPARE(band->getDepth()[3], 32.5f);
+	//Row 1 has its center masked but not its neighbours.
+	QVERIFY(band->getMask().testBit(1));
+	QCOMPARE(band->getDepth()[1], 12.5f);
+}
+
+///Two rows of 1 2 3 4 100; the second has its 3 masked.
+static RangeImage* outlierPlate()
+{
+	const int w = 5, h = 2;
+	const float values[w] = {1.0f, 2.0f, 3.0f, 4.0f, 100.0f};
+	QVector<float> depth;
+	QBitArray mask (w*h, true);
+	for (int i = 0; i < h; ++i)
+	{
+		for (int j = 0; j < w; ++j)
+			depth.push_back(values[j]);
+	}
+	mask.clearBit(w*1 + 2);
+
+	QMatrix4x4 csys;
+	return new RangeImage(w, h, 1.0f, 1.0f, depth, QImage(w, h, QImage::Format_RGB32), mask, csys);
+}
+
+void TestRangeImage::columnBandMedian()
+{
+	QScopedPointer<RangeImage> plate (outlierPlate());
+	QScopedPointer<Profile> band (plate->getColumnBand(2, 2, RangeImage::Reducer_Median));
+	QVERIFY(!band.isNull());
+	QCOMPARE(band->getDepth()[0], 3.0f);
+	//Even count: the mean of 2 and 4.
+	QCOMPARE(band->getDepth()[1], 3.0f);
+	QVERIFY(band->getMask().testBit(1));
+
+	//Clipped at the edge: 3 4 100.
+	band.reset(plate->getColumnBand(4, 2, RangeImage::Reducer_Median));
+	QCOMPARE(band->getDepth()[0], 4.0f);
+}
+
+void TestRangeImage::columnBandTrimmedMean()
+{
+	QScopedPointer<RangeImage> plate (outlierPlate());
+	QScopedPointer<Profile> band (plate->getColumnBand(2, 2, RangeImage::Reducer_TrimmedMean, 0.25f));
+	QVERIFY(!band.isNull());
+	//1 and 100 dropped.
+	QCOMPARE(band->getDepth()[0], 3.0f);
+	QCOMPARE(band->getDepth()[1], 3.0f);
+
+	//Too few to trim: the plain mean.
+	band.reset(plate->getColumnBand(2, 2, RangeImage::Reducer_TrimmedMean, 0.1f));
+	QCOMPARE(band->getDepth()[0], 22.0f);
+}
+
+void TestRangeImage::wideColumnBandCrossesMaskWords()
+{
+	//A band of 141 pixels that starts and ends inside mask words.
+	const int w = 150, h = 4;
+	QVector<float> depth;
+	QBitArray mask (w*h, true);
+	for (int k = 0; k < w*h; ++k)
+	{
+		depth.push_back((float) (k % 7));
+		if (k % 5 == 0 && k / w != 2)
+			mask.clearBit(k);
+	}
+	QMatrix4x4 csys;
+	QScopedPointer<RangeImage> plate (new RangeImage(w, h, 1.0f, 1.0f, depth,
+		QImage(w, h, QImage::Format_RGB32), mask, csys));
+
+	const int center = 75, halfWidth = 70;
+	QScopedPointer<Profile> band (plate->getColumnBand(center, halfWidth));
+	QVERIFY(!band.isNull());
+	for (int i = 0; i < h; ++i)
+	{
+		double sum = 0.0;
+		int n = 0;
+		for (int j = center - halfWidth; j <= center + halfWidth; ++j)
+		{
+			if (mask.testBit(w*i + j))
+			{
+				sum += depth[w*i + j];
+				++n;
+			}
+		}
+		QVERIFY(band->getMask().testBit(i));
+		QCOMPARE(band->getDepth()[i], (float) (sum/n));
+	}
+}
+
+QTEST_MAIN(TestRangeImage)
+#include "tst_RangeImage.moc"